@@ -11,8 +11,10 @@
 #include <string.h>
 #include <math.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "mandel-lib.h"
+#include "mandel-render.h"
 
 #define MANDEL_MAX_ITERATION 100000
 
@@ -34,11 +36,11 @@ double xmin = -1.8, xmax = 1.0;
 double ymin = -1.0, ymax = 1.0;
 	
 /*
- * Every character in the final output is
- * xstep x ystep units wide on the complex plane.
+ * The same, as handed to libmandel, along with
+ * the context every line is rendered in.
  */
-double xstep;
-double ystep;
+struct mandel_viewport viewport;
+struct mandel_ctx *ctx;
 
 /*
  * This function computes a line of output
@@ -46,84 +48,85 @@ double ystep;
  */
 void compute_mandel_line(int line, int color_val[])
 {
-	/*
-	 * x and y traverse the complex plane.
-	 */
-	double x, y;
-
-	int n;
-	int val;
-
-	/* Find out the y value corresponding to this line */
-	y = ymax - ystep * line;
-
-	/* and iterate for all points on this line */
-	for (x = xmin, n = 0; n < x_chars; x+= xstep, n++) {
-
-		/* Compute the point's color value */
-		val = mandel_iterations_at_point(x, y, MANDEL_MAX_ITERATION);
-		if (val > 255)
-			val = 255;
-
-		/* And store it in the color_val[] array */
-		val = xterm_color(val);
-		color_val[n] = val;
+	if (mandel_render_lines(ctx, &viewport, line, 1, color_val) < 0) {
+		perror("mandel_render_lines");
+		exit(1);
 	}
+	mandel_render_colors(ctx, color_val, x_chars, color_val);
 }
 
-/*
- * This function outputs an array of x_char color values
- * to a 256-color xterm.
- */
-void output_mandel_line(int fd, int color_val[])
+double wall_time(void)
 {
-	int i;
-	
-	char point ='@';
-	char newline='\n';
-
-	for (i = 0; i < x_chars; i++) {
-		/* Set the current color, then output the point */
-		set_xterm_color(fd, color_val[i]);
-		if (write(fd, &point, 1) != 1) {
-			perror("compute_and_output_mandel_line: write point");
-			exit(1);
-		}
-	}
+	struct timespec ts;
 
-	/* Now that the line is done, output a newline character */
-	if (write(fd, &newline, 1) != 1) {
-		perror("compute_and_output_mandel_line: write newline");
-		exit(1);
-	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
-void compute_and_output_mandel_line(int fd, int line)
+/*
+ * Time spent computing lines; the rest of the run, encoding
+ * and output, is reported as idle time.
+ */
+double busy;
+
+/*
+ * This function computes a line and encodes it into the frame,
+ * to be output along with all the others.
+ */
+void compute_and_encode_mandel_line(struct xterm_frame *frame, int line)
 {
 	/*
 	 * A temporary array, used to hold color values for the line being drawn
 	 */
 	int color_val[x_chars];
+	double t0;
 
+	t0 = wall_time();
 	compute_mandel_line(line, color_val);
-	output_mandel_line(fd, color_val);
+	busy += wall_time() - t0;
+	xterm_frame_line(frame, line, color_val);
 }
 
 int main(void)
 {
+	struct xterm_frame *frame;
+	double start = wall_time();
 	int line;
 
-	xstep = (xmax - xmin) / x_chars;
-	ystep = (ymax - ymin) / y_chars;
+	viewport.xmin = xmin;
+	viewport.xmax = xmax;
+	viewport.ymin = ymin;
+	viewport.ymax = ymax;
+	viewport.width = x_chars;
+	viewport.height = y_chars;
+	viewport.max_iteration = MANDEL_MAX_ITERATION;
+	if ((ctx = mandel_ctx_create(MANDEL_DOUBLE, NULL)) == NULL) {
+		perror("mandel_ctx_create");
+		exit(1);
+	}
+
+	if ((frame = xterm_frame_create(x_chars, y_chars)) == NULL) {
+		fprintf(stderr, "Out of memory, failed to allocate a frame\n");
+		exit(1);
+	}
 
 	/*
-	 * draw the Mandelbrot Set, one line at a time.
-	 * Output is sent to file descriptor '1', i.e., standard output.
+	 * draw the Mandelbrot Set, one line at a time, into the frame,
+	 * then send the whole frame to file descriptor '1', i.e.,
+	 * standard output, at once.
 	 */
 	for (line = 0; line < y_chars; line++) {
-		compute_and_output_mandel_line(1, line);
+		compute_and_encode_mandel_line(frame, line);
 	}
+	xterm_frame_write(1, frame, 0, y_chars);
+	xterm_frame_destroy(frame);
+	mandel_ctx_destroy(ctx);
 
 	reset_xterm_color(1);
+	fprintf(stderr, "Thread 0: busy %.3f s, idle %.3f s\n",
+		busy, wall_time() - start - busy);
+	fprintf(stderr, "Ran %llu iterations\n", mandel_run_iterations());
+	fprintf(stderr, "Skipped %llu iterations (main bulbs, periodic orbits)\n",
+		mandel_skipped_iterations());
 	return 0;
 }
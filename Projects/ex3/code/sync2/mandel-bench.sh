@@ -0,0 +1,136 @@
+#!/bin/sh
+#
+# mandel-bench.sh
+#
+# Run every way of drawing the Mandelbrot Set headless, over a fixed
+# set of viewports and thread counts, and report how fast each one
+# went as JSON on standard output. Run it through "make bench".
+#
+# BENCH_THREADS and BENCH_RUNS override the thread counts tried and
+# how many times every case is run; the fastest run is reported.
+#
+
+THREADS=${BENCH_THREADS:-"1 2 4 8"}
+RUNS=${BENCH_RUNS:-5}
+
+SYNC=../sync/mandel
+SYNC2=./mandel
+SYNC3=../sync3/mandel
+FORK=../../../ex4/code/sync-mmap/mandel-fork
+
+# Name, WIDTHxHEIGHT, XMIN,XMAX,YMIN,YMAX and iteration limit of every
+# viewport. Only sync2 takes a viewport; the other programs always draw
+# the first one, so they are only run on it.
+VIEWPORTS="default 90x50 -1.8,1.0,-1.0,1.0 100000
+full 1280x720 -2.5,1.0,-1.0,1.0 1000
+seahorse 640x360 -0.7600,-0.7300,0.0900,0.1200 20000
+elephant 640x360 0.2500,0.3100,-0.0200,0.0200 10000"
+
+ERR=$(mktemp) || exit 1
+BEST=$(mktemp) || exit 1
+trap 'rm -f "$ERR" "$BEST"' EXIT
+trap 'exit 1' INT TERM
+
+# Run "$@" RUNS times, leaving the standard error of the fastest run
+# in $BEST and its wall clock time, in nanoseconds, in $best.
+run_best() {
+	best=
+	i=0
+	while [ $i -lt "$RUNS" ]; do
+		start=$(date +%s%N)
+		if ! "$@" </dev/null >/dev/null 2>"$ERR"; then
+			echo "$0: $* failed:" >&2
+			cat "$ERR" >&2
+			exit 1
+		fi
+		ns=$(($(date +%s%N) - start))
+		if [ -z "$best" ] || [ $ns -lt $best ]; then
+			best=$ns
+			cp "$ERR" "$BEST"
+		fi
+		i=$((i + 1))
+	done
+}
+
+# Report the case just run, as one element of the results array:
+# strategy, program, viewport, WIDTHxHEIGHT, iteration limit, threads.
+# Scaling efficiency is relative to the first thread count of the case.
+sep=
+report() {
+	awk -v sep="$sep" -v strategy="$1" -v program="$2" \
+	    -v viewport="$3" -v geometry="$4" -v max="$5" -v threads="$6" \
+	    -v ns="$best" -v base_ns="$base_ns" -v base_threads="$base_threads" '
+	/^(Thread|Child) [0-9]+: busy / {
+		i = $2 + 0
+		busy[i] = $4
+		idle[i] = $7
+		if (i >= n)
+			n = i + 1
+	}
+	/^Ran [0-9]+ iterations/ { iters += $2 }
+	/^Child [0-9]+ ran [0-9]+ iterations/ { iters += $4 }
+	END {
+		split(geometry, g, "x")
+		secs = ns / 1e9
+		printf "%s\n    {\"strategy\": \"%s\", \"program\": \"%s\", ", \
+			sep, strategy, program
+		printf "\"viewport\": \"%s\", \"width\": %d, \"height\": %d, ", \
+			viewport, g[1], g[2]
+		printf "\"max_iteration\": %d, \"threads\": %d,\n", max, threads
+		printf "     \"seconds\": %.6f, \"mpixels_per_s\": %.3f, ", \
+			secs, g[1] * g[2] / secs / 1e6
+		printf "\"iterations_per_s\": %.0f, \"iterations\": %.0f,\n", \
+			iters / secs, iters
+		printf "     \"speedup\": %.3f, \"efficiency\": %.3f,\n", \
+			base_ns / ns, base_ns * base_threads / (ns * threads)
+		printf "     \"thread_time\": ["
+		for (i = 0; i < n; i++)
+			printf "%s{\"busy\": %s, \"idle\": %s}", \
+				i ? ", " : "", busy[i], idle[i]
+		printf "]}"
+	}' "$BEST"
+	sep=,
+}
+
+# Run a strategy over every thread count:
+# strategy, viewport, WIDTHxHEIGHT, iteration limit, program [args...].
+# The thread count is appended to the arguments.
+bench() {
+	strategy=$1 viewport=$2 geometry=$3 max=$4
+	shift 4
+	base_ns=
+	for t in $THREADS; do
+		run_best "$@" "$t"
+		if [ -z "$base_ns" ]; then
+			base_ns=$best
+			base_threads=$t
+		fi
+		report "$strategy" "$1" "$viewport" "$geometry" "$max" "$t"
+	done
+}
+
+printf '{\n  "cpus": %d, "runs": %d, "simd": "%s",\n  "results": [' \
+	"$(getconf _NPROCESSORS_ONLN)" "$RUNS" "${MANDEL_SIMD:-auto}"
+
+# The sequential program takes no thread count
+base_ns=
+run_best $SYNC
+base_ns=$best
+base_threads=1
+report sequential $SYNC default 90x50 100000 1
+
+bench interleaved-ring default 90x50 100000 $SYNC3
+bench fork-chain default 90x50 100000 $FORK
+
+# Read the viewports from a here-document rather than a pipe, so the
+# loop runs in this shell and a failed run_best exits the script.
+while read -r name geometry view max; do
+	for mode in lines steal plan tile; do
+		bench "$mode" "$name" "$geometry" "$max" \
+			$SYNC2 -m $mode -g "$geometry" -v "$view" -i "$max"
+	done
+done <<EOF
+$VIEWPORTS
+EOF
+
+printf '\n  ]\n}\n'
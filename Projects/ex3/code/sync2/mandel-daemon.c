@@ -0,0 +1,574 @@
+/*
+ * mandel-daemon.c
+ *
+ * A render daemon serving frames of the tile grid over a Unix
+ * domain socket, see mandel-daemon.h.
+ *
+ * One thread polls the socket and the clients. Once a request is
+ * complete, it waits up to DAEMON_BATCH_WAIT for more to arrive,
+ * then serves them all together: the tiles they need are sorted,
+ * the duplicates dropped, and each one left is a task on the pool.
+ * Every frame is then put together from those tiles, and written
+ * back to its client as the socket takes it: client sockets are
+ * non-blocking, so that a client not reading its reply holds up no
+ * one but itself.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "mandel-lib.h"
+#include "mandel-render.h"
+#include "mandel-cache.h"
+#include "mandel.h"
+#include "mandel-daemon.h"
+
+/* Clients connected at once, at most */
+#define DAEMON_CLIENTS 64
+
+/* Seconds a batch waits for more requests after its first */
+#define DAEMON_BATCH_WAIT 0.002
+
+/* Seconds between checks for a signal taken by another thread */
+#define DAEMON_IDLE_WAIT 0.5
+
+/*
+ * Tiles a batch computes at most, before dropping duplicates, 256 MB
+ * of escape times; the requests past it wait for the next batch,
+ * which starts with them.
+ */
+#define DAEMON_BATCH_TILES MANDEL_DAEMON_MAX_TILES
+
+#define TILE_PIXELS (MANDEL_TILE_SIZE * MANDEL_TILE_SIZE)
+
+/*
+ * A client reads a request, waits for its batch, then writes the reply
+ * out, and only then reads the next request.
+ */
+struct daemon_client {
+	int fd;			/* -1 if the slot is free */
+	struct mandel_daemon_request req;
+	size_t got;		/* Bytes of req read so far */
+	int batched;		/* req is in the batch being served */
+	struct mandel_daemon_reply reply;
+	int *frame;		/* The frame after reply, or NULL */
+	size_t sent, size;	/* Bytes of reply and frame written, in all */
+};
+
+/* A tile some request of the batch needs */
+struct daemon_tile {
+	struct mandel_tile_key key;
+	struct daemon *d;
+	int *iter;		/* Its escape times, in d->iter */
+};
+
+struct daemon {
+	struct pool *pool;
+	struct mandel_ctx *ctx;
+	struct mandel_cache *cache;
+	struct daemon_client client[DAEMON_CLIENTS];
+	int first;		/* Client the next batch starts with */
+	struct daemon_tile *tile;
+	size_t ntiles, tile_cap;
+	int *iter;		/* The escape times of all tiles of the batch */
+	size_t iter_cap;	/* Tiles iter has room for */
+	unsigned long requests, batches, tiles, shared;
+};
+
+static volatile sig_atomic_t daemon_stop;
+
+static void daemon_signal(int signum)
+{
+	daemon_stop = 1;
+}
+
+static int daemon_tile_cmp(const void *a, const void *b)
+{
+	const struct mandel_tile_key *x = a, *y = b;
+
+	if (x->zoom != y->zoom)
+		return x->zoom < y->zoom ? -1 : 1;
+	if (x->max_iteration != y->max_iteration)
+		return x->max_iteration < y->max_iteration ? -1 : 1;
+	if (x->ty != y->ty)
+		return x->ty < y->ty ? -1 : 1;
+	if (x->tx != y->tx)
+		return x->tx < y->tx ? -1 : 1;
+	return 0;
+}
+
+/* The number of tiles req covers, once it has passed the checks below */
+static long daemon_request_tiles(const struct mandel_daemon_request *req)
+{
+	return (mandel_floor_div(req->px + req->width - 1, MANDEL_TILE_SIZE) -
+		mandel_floor_div(req->px, MANDEL_TILE_SIZE) + 1) *
+		(mandel_floor_div(req->py + req->height - 1, MANDEL_TILE_SIZE) -
+		mandel_floor_div(req->py, MANDEL_TILE_SIZE) + 1);
+}
+
+static int daemon_request_check(const struct mandel_daemon_request *req)
+{
+	if ((req->what != MANDEL_DAEMON_ITERATIONS &&
+	     req->what != MANDEL_DAEMON_COLORS) ||
+	    req->width <= 0 || req->height <= 0 ||
+	    req->width > MANDEL_DAEMON_MAX_PIXELS / req->height ||
+	    req->max_iteration <= 0 ||
+	    req->zoom < -1000 || req->zoom > 1000 ||
+	    req->px < -MANDEL_DAEMON_MAX_COORD ||
+	    req->px > MANDEL_DAEMON_MAX_COORD ||
+	    req->py < -MANDEL_DAEMON_MAX_COORD ||
+	    req->py > MANDEL_DAEMON_MAX_COORD ||
+	    req->reserved != 0 ||
+	    daemon_request_tiles(req) > MANDEL_DAEMON_MAX_TILES)
+		return -1;
+	return 0;
+}
+
+static void daemon_close(struct daemon_client *cl)
+{
+	close(cl->fd);
+	free(cl->frame);
+	cl->fd = -1;
+	cl->got = 0;
+	cl->batched = 0;
+	cl->frame = NULL;
+	cl->sent = cl->size = 0;
+}
+
+/* Add the tiles req covers to the batch, duplicates and all */
+static void daemon_add_tiles(struct daemon *d,
+	const struct mandel_daemon_request *req)
+{
+	long tx, ty, tx0, tx1, ty0, ty1;
+
+	tx0 = mandel_floor_div(req->px, MANDEL_TILE_SIZE);
+	tx1 = mandel_floor_div(req->px + req->width - 1, MANDEL_TILE_SIZE);
+	ty0 = mandel_floor_div(req->py, MANDEL_TILE_SIZE);
+	ty1 = mandel_floor_div(req->py + req->height - 1, MANDEL_TILE_SIZE);
+
+	for (ty = ty0; ty <= ty1; ty++)
+		for (tx = tx0; tx <= tx1; tx++) {
+			if (d->ntiles == d->tile_cap) {
+				d->tile_cap = d->tile_cap ?
+					2 * d->tile_cap : 64;
+				d->tile = realloc(d->tile,
+					d->tile_cap * sizeof(*d->tile));
+				if (!d->tile) {
+					fprintf(stderr, "Out of memory, "
+						"failed to allocate tiles\n");
+					exit(1);
+				}
+			}
+			d->tile[d->ntiles].key.zoom = req->zoom;
+			d->tile[d->ntiles].key.tx = tx;
+			d->tile[d->ntiles].key.ty = ty;
+			d->tile[d->ntiles].key.max_iteration =
+				req->max_iteration;
+			d->tile[d->ntiles].key.prec =
+				mandel_ctx_precision(d->ctx);
+			d->ntiles++;
+		}
+}
+
+/* Fill in a tile of the batch, from the cache if it is there */
+static void daemon_tile_task(void *arg)
+{
+	struct daemon_tile *t = arg;
+	struct mandel_grid_view v = {
+		t->key.zoom, t->key.tx * MANDEL_TILE_SIZE,
+		t->key.ty * MANDEL_TILE_SIZE, MANDEL_TILE_SIZE,
+		MANDEL_TILE_SIZE, t->key.max_iteration
+	};
+
+	if (mandel_render_cached(t->d->ctx, t->d->cache, &v, t->iter) < 0) {
+		perror("render_mandel_daemon: mandel_render_cached");
+		exit(1);
+	}
+}
+
+/* Put the frame of req together from the tiles of the batch */
+static void daemon_frame(struct daemon *d,
+	const struct mandel_daemon_request *req, int out[])
+{
+	struct daemon_tile *t;
+	struct mandel_tile_key key = { .zoom = req->zoom,
+		.max_iteration = req->max_iteration };
+	struct mandel_grid_view v = { req->zoom, req->px, req->py,
+		req->width, req->height, req->max_iteration };
+
+	for (key.ty = mandel_floor_div(v.py, MANDEL_TILE_SIZE);
+	     key.ty * MANDEL_TILE_SIZE < v.py + v.height; key.ty++)
+		for (key.tx = mandel_floor_div(v.px, MANDEL_TILE_SIZE);
+		     key.tx * MANDEL_TILE_SIZE < v.px + v.width; key.tx++) {
+			t = bsearch(&key, d->tile, d->ntiles, sizeof(*t),
+				daemon_tile_cmp);
+			mandel_tile_blit(t->iter, key.tx, key.ty, &v, out,
+				v.width);
+		}
+}
+
+/*
+ * Write as much of the reply of cl as its socket takes; once all of
+ * it is out, cl goes back to reading its next request.
+ */
+static void daemon_flush(struct daemon_client *cl)
+{
+	const char *buf;
+	size_t count;
+	ssize_t ret;
+
+	while (cl->sent < cl->size) {
+		if (cl->sent < sizeof(cl->reply)) {
+			buf = (const char *)&cl->reply + cl->sent;
+			count = sizeof(cl->reply) - cl->sent;
+		} else {
+			buf = (const char *)cl->frame +
+				(cl->sent - sizeof(cl->reply));
+			count = cl->size - cl->sent;
+		}
+		ret = write(cl->fd, buf, count);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				daemon_close(cl);
+			return;
+		}
+		cl->sent += ret;
+	}
+	free(cl->frame);
+	cl->frame = NULL;
+	cl->sent = cl->size = 0;
+}
+
+/* Answer the request of cl with status, and cl->frame if it is 0 */
+static void daemon_reply(struct daemon_client *cl, int status)
+{
+	cl->reply.status = status;
+	cl->reply.width = cl->reply.height = 0;
+	cl->size = sizeof(cl->reply);
+	if (!status) {
+		cl->reply.width = cl->req.width;
+		cl->reply.height = cl->req.height;
+		cl->size += (size_t)cl->req.width * cl->req.height *
+			sizeof(int);
+	} else {
+		free(cl->frame);
+		cl->frame = NULL;
+	}
+	cl->sent = 0;
+	cl->got = 0;
+	cl->batched = 0;
+	daemon_flush(cl);
+}
+
+/*
+ * Serve the clients with a complete request, as many as fit in
+ * DAEMON_BATCH_TILES, starting from d->first so that the ones left
+ * out this time go first the next.
+ */
+static void daemon_serve(struct daemon *d)
+{
+	struct daemon_client *cl;
+	size_t i, n, size;
+	int c, deferred = -1;
+
+	d->ntiles = 0;
+	for (i = 0; i < DAEMON_CLIENTS; i++) {
+		c = (d->first + i) % DAEMON_CLIENTS;
+		cl = &d->client[c];
+		if (cl->fd < 0 || cl->got < sizeof(cl->req))
+			continue;
+		if (daemon_request_check(&cl->req) < 0) {
+			d->requests++;
+			daemon_reply(cl, EINVAL);
+			continue;
+		}
+		if (d->ntiles + daemon_request_tiles(&cl->req) >
+		    DAEMON_BATCH_TILES) {
+			if (deferred < 0)
+				deferred = c;
+			continue;
+		}
+		d->requests++;
+		daemon_add_tiles(d, &cl->req);
+		cl->batched = 1;
+	}
+	if (deferred >= 0)
+		d->first = deferred;
+	if (!d->ntiles)
+		return;
+
+	/* Compute every tile once, however many frames it is part of */
+	qsort(d->tile, d->ntiles, sizeof(*d->tile), daemon_tile_cmp);
+	for (i = 1, n = 1; i < d->ntiles; i++)
+		if (daemon_tile_cmp(&d->tile[i], &d->tile[n - 1]))
+			d->tile[n++].key = d->tile[i].key;
+	d->shared += d->ntiles - n;
+	d->ntiles = n;
+	d->tiles += n;
+	d->batches++;
+	if (n > d->iter_cap) {
+		free(d->iter);
+		d->iter = safe_malloc(n * TILE_PIXELS * sizeof(int));
+		d->iter_cap = n;
+	}
+	for (i = 0; i < n; i++) {
+		d->tile[i].d = d;
+		d->tile[i].iter = &d->iter[i * TILE_PIXELS];
+		pool_submit(d->pool, daemon_tile_task, &d->tile[i]);
+	}
+	pool_wait(d->pool);
+
+	for (i = 0; i < DAEMON_CLIENTS; i++) {
+		cl = &d->client[i];
+		if (cl->fd < 0 || !cl->batched)
+			continue;
+		size = (size_t)cl->req.width * cl->req.height;
+		if ((cl->frame = malloc(size * sizeof(int))) == NULL) {
+			daemon_reply(cl, ENOMEM);
+			continue;
+		}
+		daemon_frame(d, &cl->req, cl->frame);
+		if (cl->req.what == MANDEL_DAEMON_COLORS)
+			mandel_render_colors(d->ctx, cl->frame, size,
+				cl->frame);
+		daemon_reply(cl, 0);
+	}
+}
+
+/* Read what has arrived of the request of cl */
+static void daemon_read(struct daemon_client *cl)
+{
+	ssize_t ret;
+
+	ret = read(cl->fd, (char *)&cl->req + cl->got,
+		sizeof(cl->req) - cl->got);
+	if (ret <= 0) {
+		if (ret < 0 && (errno == EINTR || errno == EAGAIN ||
+		    errno == EWOULDBLOCK))
+			return;
+		daemon_close(cl);
+		return;
+	}
+	cl->got += ret;
+}
+
+static int daemon_listen(const char *path)
+{
+	struct sockaddr_un addr;
+	int sock, other;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		/* Take over the socket of a daemon no longer running */
+		if (errno != EADDRINUSE)
+			goto out;
+		if ((other = mandel_daemon_connect(path)) >= 0) {
+			close(other);
+			errno = EADDRINUSE;
+			goto out;
+		}
+		if (unlink(path) < 0 ||
+		    bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+			goto out;
+	}
+	if (listen(sock, DAEMON_CLIENTS) < 0)
+		goto out;
+	return sock;
+
+out:
+	other = errno;
+	close(sock);
+	errno = other;
+	return -1;
+}
+
+void render_mandel_daemon(struct pool *pool, struct mandel_ctx *ctx,
+	struct mandel_cache *cache, const char *path)
+{
+	struct pollfd fds[DAEMON_CLIENTS + 1];
+	struct daemon_client *slot[DAEMON_CLIENTS + 1];
+	struct sigaction sa;
+	struct daemon d;
+	double deadline = 0, wait;
+	int sock, fd, i, n, ready;
+
+	memset(&d, 0, sizeof(d));
+	d.pool = pool;
+	d.ctx = ctx;
+	d.cache = cache;
+	for (i = 0; i < DAEMON_CLIENTS; i++)
+		d.client[i].fd = -1;
+
+	/* Stop at the next poll on a signal; a client gone is no reason */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = daemon_signal;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGINT, &sa, NULL) < 0 ||
+	    sigaction(SIGTERM, &sa, NULL) < 0) {
+		perror("render_mandel_daemon: sigaction");
+		exit(1);
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	if ((sock = daemon_listen(path)) < 0) {
+		perror(path);
+		exit(1);
+	}
+	fprintf(stderr, "Daemon: listening on %s\n", path);
+
+	while (!daemon_stop) {
+		/*
+		 * Clients with a request waiting are not read from, and
+		 * those with a reply to write out are only written to.
+		 */
+		fds[0].fd = sock;
+		fds[0].events = POLLIN;
+		for (i = 0, n = 1, ready = 0; i < DAEMON_CLIENTS; i++) {
+			if (d.client[i].fd < 0)
+				continue;
+			if (d.client[i].got == sizeof(d.client[i].req)) {
+				ready++;
+				continue;
+			}
+			fds[n].fd = d.client[i].fd;
+			fds[n].events = d.client[i].size ? POLLOUT : POLLIN;
+			slot[n++] = &d.client[i];
+		}
+
+		wait = ready ? deadline - wall_time() : DAEMON_IDLE_WAIT;
+		if (ready && (wait <= 0 || n == 1)) {
+			daemon_serve(&d);
+			continue;
+		}
+		if (poll(fds, n, (int)(wait * 1000) + 1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("render_mandel_daemon: poll");
+			exit(1);
+		}
+
+		for (i = 1; i < n; i++) {
+			if (!fds[i].revents)
+				continue;
+			if (slot[i]->size) {
+				daemon_flush(slot[i]);
+				continue;
+			}
+			daemon_read(slot[i]);
+			if (slot[i]->got == sizeof(slot[i]->req) && !ready++)
+				deadline = wall_time() + DAEMON_BATCH_WAIT;
+		}
+		if (fds[0].revents & POLLIN) {
+			if ((fd = accept(sock, NULL, NULL)) < 0) {
+				if (errno != EINTR && errno != ECONNABORTED) {
+					perror("render_mandel_daemon: accept");
+					exit(1);
+				}
+				continue;
+			}
+			for (i = 0; i < DAEMON_CLIENTS; i++)
+				if (d.client[i].fd < 0)
+					break;
+			if (i == DAEMON_CLIENTS ||
+			    fcntl(fd, F_SETFL, O_NONBLOCK) < 0)
+				close(fd);
+			else
+				d.client[i].fd = fd;
+		}
+	}
+
+	for (i = 0; i < DAEMON_CLIENTS; i++)
+		if (d.client[i].fd >= 0)
+			daemon_close(&d.client[i]);
+	close(sock);
+	unlink(path);
+	free(d.tile);
+	free(d.iter);
+
+	fprintf(stderr, "Daemon: %lu requests in %lu batches, %lu tiles, "
+		"%lu more shared within a batch\n",
+		d.requests, d.batches, d.tiles, d.shared);
+}
+
+int mandel_daemon_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int sock, err;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		err = errno;
+		close(sock);
+		errno = err;
+		return -1;
+	}
+	return sock;
+}
+
+/* Read exactly count bytes, failing with EPIPE if the daemon is gone */
+static int daemon_read_all(int fd, char *buf, size_t count)
+{
+	ssize_t ret;
+
+	while (count > 0) {
+		ret = read(fd, buf, count);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			if (ret == 0)
+				errno = EPIPE;
+			return -1;
+		}
+		buf += ret;
+		count -= ret;
+	}
+	return 0;
+}
+
+int mandel_daemon_query(int sock, const struct mandel_daemon_request *req,
+	int out[])
+{
+	struct mandel_daemon_reply reply;
+
+	if (insist_write(sock, (const char *)req, sizeof(*req)) < 0 ||
+	    daemon_read_all(sock, (char *)&reply, sizeof(reply)) < 0)
+		return -1;
+	if (reply.status) {
+		errno = reply.status;
+		return -1;
+	}
+	if (reply.width != req->width || reply.height != req->height) {
+		errno = EPROTO;
+		return -1;
+	}
+	return daemon_read_all(sock, (char *)out,
+		(size_t)reply.width * reply.height * sizeof(int));
+}
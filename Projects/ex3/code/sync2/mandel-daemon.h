@@ -0,0 +1,70 @@
+/*
+ * mandel-daemon.h
+ *
+ * A render daemon: a long running process serving frames of the
+ * tile grid (see mandel-render.h) to clients over a Unix domain
+ * socket. All clients share one pool of threads and one tile cache,
+ * and requests waiting at the same time are served as a batch, in
+ * which every tile any of them needs is computed only once.
+ *
+ * A client writes a struct mandel_daemon_request at a time, and
+ * reads back a struct mandel_daemon_reply, followed, if its status
+ * is 0, by width x height values, line by line: escape times, or
+ * xterm colors if the request asked for MANDEL_DAEMON_COLORS.
+ *
+ */
+
+#ifndef MANDEL_DAEMON_H__
+#define MANDEL_DAEMON_H__
+
+#include <stdint.h>
+
+#include "mandel-pool.h"
+#include "mandel-cache.h"
+
+/* What a request asks for */
+#define MANDEL_DAEMON_ITERATIONS 0
+#define MANDEL_DAEMON_COLORS 1
+
+/* The largest frame served, in pixels, and in tiles it covers */
+#define MANDEL_DAEMON_MAX_PIXELS (1 << 24)
+#define MANDEL_DAEMON_MAX_TILES (1 << 16)
+
+/* The pixel coordinates px and py of a frame are within +/- this */
+#define MANDEL_DAEMON_MAX_COORD ((int64_t)1 << 52)
+
+struct mandel_daemon_request {
+	int32_t what;
+	int32_t zoom;
+	int64_t px, py;
+	int32_t width, height;
+	int32_t max_iteration;
+	int32_t reserved;	/* 0 */
+};
+
+struct mandel_daemon_reply {
+	int32_t status;		/* 0, or the errno value of the failure */
+	int32_t width, height;
+};
+
+/*
+ * Serve requests on a socket bound to path, running every tile to
+ * compute as a task on pool, until SIGINT or SIGTERM. Tiles are
+ * taken from cache, and added to it; ctx tells their precision, and
+ * the palette of colors.
+ */
+void render_mandel_daemon(struct pool *pool, struct mandel_ctx *ctx,
+	struct mandel_cache *cache, const char *path);
+
+/* Connect to the daemon at path; returns the socket, or -1 */
+int mandel_daemon_connect(const char *path);
+
+/*
+ * Send req to the daemon over sock, and read the frame it answers
+ * with into out[]. Returns -1 with errno set on failure, to the
+ * status of the reply if the daemon refused req.
+ */
+int mandel_daemon_query(int sock, const struct mandel_daemon_request *req,
+	int out[]);
+
+#endif /* MANDEL_DAEMON_H__ */
@@ -0,0 +1,198 @@
+/*
+ * mandel-dist.c
+ *
+ * Distance estimation rendering of the Mandelbrot Set:
+ * a pixel far enough from the set has a disk of exterior pixels
+ * around it, which are filled in instead of being computed.
+ *
+ * The escape time n of a point is where |z_n(c)| first exceeds 2,
+ * and z_n is a polynomial in c whose roots all lie in the set. So
+ * inside a disk clear of the set, no region where |z_n| <= 2 can be
+ * cut off from the edge of a rectangle, nor can a region where it is
+ * larger: if the escape time is n all around the edge, it is n
+ * inside as well. The edges of a rectangle in the disk are computed,
+ * pixel by pixel, and it is only filled if they all agree.
+ *
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "mandel-lib.h"
+#include "mandel.h"
+#include "mandel-dist.h"
+
+/* Lines per task */
+#define DIST_BAND 8
+
+/*
+ * Pixels are first iterated with distance estimation up to this many
+ * iterations. Points far from the set escape long before; the ones
+ * that have not are left to the batch kernel.
+ */
+#define DIST_MAX_ITERATION 256
+
+/*
+ * A rectangle around a computed pixel is tried if the disk it lies in
+ * has a radius of at least this many pixels. The disk is the smaller
+ * of a quarter of the distance estimate, within which every point is
+ * certainly outside the set, and the radius within which points are
+ * estimated to have the same escape time, which saves computing the
+ * edges of rectangles unlikely to be filled.
+ */
+#define DIST_MIN_RADIUS 3
+
+/*
+ * The same escape time radius assumes |z| squares with every
+ * iteration, which is rough just past the escape radius, where c
+ * still matters. Only this much of it is used.
+ */
+#define DIST_SAME_TRUST 0.5
+
+/* Frame value of a pixel not computed or filled yet */
+#define DIST_UNKNOWN -1
+
+/* Frame value of a pixel of the line waiting for the batch kernel */
+#define DIST_PENDING -2
+
+struct dist_band {
+	int *frame;
+	int first, last;
+};
+
+static unsigned long dist_computed;
+static unsigned long dist_filled;
+
+void mandel_dist_stats(unsigned long *computed, unsigned long *filled)
+{
+	*computed = __sync_fetch_and_add(&dist_computed, 0);
+	*filled = __sync_fetch_and_add(&dist_filled, 0);
+}
+
+/*
+ * Fill the unknown pixels inside the rectangle of lines top to bottom
+ * and columns left to right with val, if every pixel on its edges has
+ * escape time val, computing the ones not known yet. Returns how many
+ * were filled; those computed are added to *computed. A rectangle
+ * with no pixels inside its edges is left alone.
+ */
+static unsigned long dist_fill_rect(int frame[], int top, int bottom,
+	int left, int right, int val, unsigned long *computed)
+{
+	int cap = 2 * (right - left + bottom - top + 2);
+	double xs[cap], ys[cap];
+	int idx[cap], iter[cap];
+	unsigned long filled = 0;
+	int l, c, dc, n = 0, v;
+
+	/* Also keeps the stride along the sides at 2 or more */
+	if (bottom - top < 2 || right - left < 2)
+		return 0;
+
+	for (l = top; l <= bottom; l++) {
+		dc = l == top || l == bottom ? 1 : right - left;
+		for (c = left; c <= right; c += dc) {
+			v = frame[l * x_chars + c];
+			if (v == DIST_UNKNOWN) {
+				xs[n] = xcoord[c];
+				ys[n] = ymax - ystep * l;
+				idx[n++] = l * x_chars + c;
+			} else if (v != val) {
+				return 0;
+			}
+		}
+	}
+
+	mandel_iterations_batch(xs, ys, n, max_iteration, iter);
+	*computed += n;
+	for (c = 0, v = 1; c < n; c++) {
+		frame[idx[c]] = iter[c];
+		if (iter[c] != val)
+			v = 0;
+	}
+	if (!v)
+		return 0;
+
+	for (l = top + 1; l < bottom; l++)
+		for (c = left + 1; c < right; c++)
+			if (frame[l * x_chars + c] == DIST_UNKNOWN) {
+				frame[l * x_chars + c] = val;
+				filled++;
+			}
+	return filled;
+}
+
+static void dist_band_task(void *arg)
+{
+	struct dist_band *b = arg;
+	int *row, line, col, n, dl, dc;
+	double xs[x_chars], ys[x_chars], dist, same;
+	double step = xstep < ystep ? xstep : ystep;
+	int idx[x_chars], iter[x_chars];
+	unsigned long computed = 0, filled = 0;
+
+	for (line = b->first; line <= b->last; line++) {
+		row = &b->frame[line * x_chars];
+		for (col = 0, n = 0; col < x_chars; col++) {
+			if (row[col] != DIST_UNKNOWN)
+				continue;
+			computed++;
+			row[col] = mandel_distance_at_point(xcoord[col],
+				ymax - ystep * line, max_iteration <
+				DIST_MAX_ITERATION ? max_iteration :
+				DIST_MAX_ITERATION, &dist, &same);
+			if (dist == 0) {
+				/* Needs more iterations, or is inside */
+				xs[n] = xcoord[col];
+				ys[n] = ymax - ystep * line;
+				idx[n++] = col;
+				row[col] = DIST_PENDING;
+				continue;
+			}
+			same *= DIST_SAME_TRUST;
+			if (same > dist / 4)
+				same = dist / 4;
+			if (same < DIST_MIN_RADIUS * step)
+				continue;
+
+			/* The biggest rectangle in the disk, within the band */
+			dl = same / M_SQRT2 / ystep;
+			dc = same / M_SQRT2 / xstep;
+			if (dl < 1 || dc < 1)
+				continue;
+			filled += dist_fill_rect(b->frame,
+				line - dl > b->first ? line - dl : b->first,
+				line + dl < b->last ? line + dl : b->last,
+				col - dc > 0 ? col - dc : 0,
+				col + dc < x_chars - 1 ? col + dc : x_chars - 1,
+				row[col], &computed);
+		}
+
+		mandel_iterations_batch(xs, ys, n, max_iteration, iter);
+		while (n--)
+			row[idx[n]] = iter[n];
+	}
+
+	__sync_fetch_and_add(&dist_computed, computed);
+	__sync_fetch_and_add(&dist_filled, filled);
+	free(b);
+}
+
+void render_mandel_dist(struct pool *pool, int frame[], int first, int last)
+{
+	struct dist_band *b;
+	int line, col;
+
+	for (line = first; line <= last; line++)
+		for (col = 0; col < x_chars; col++)
+			frame[line * x_chars + col] = DIST_UNKNOWN;
+
+	for (line = first; line <= last; line += DIST_BAND) {
+		b = safe_malloc(sizeof(*b));
+		b->frame = frame;
+		b->first = line;
+		b->last = line + DIST_BAND - 1 < last ? line + DIST_BAND - 1 : last;
+		pool_submit(pool, dist_band_task, b);
+	}
+	pool_wait(pool);
+}
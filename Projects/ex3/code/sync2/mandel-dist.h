@@ -0,0 +1,28 @@
+/*
+ * mandel-dist.h
+ *
+ * Distance estimation rendering of the Mandelbrot Set:
+ * a pixel far enough from the set has a disk of exterior pixels
+ * around it, which are filled in instead of being computed.
+ *
+ */
+
+#ifndef MANDEL_DIST_H__
+#define MANDEL_DIST_H__
+
+#include "mandel-pool.h"
+
+/*
+ * Render lines first to last (inclusive) of the y_chars x x_chars
+ * frame of iteration counts in frame[], in bands of lines, each one
+ * a task on pool. Returns when these lines are complete.
+ *
+ * Pixels are only filled inside rectangles clear of the set whose
+ * edges all have the same iteration count, which is then theirs too.
+ */
+void render_mandel_dist(struct pool *pool, int frame[], int first, int last);
+
+/* Number of pixels computed and filled without computing them */
+void mandel_dist_stats(unsigned long *computed, unsigned long *filled);
+
+#endif /* MANDEL_DIST_H__ */
@@ -0,0 +1,99 @@
+/*
+ * mandel-field.c
+ *
+ * An iteration field: the escape time of every pixel of the frame
+ * together with where its iteration stopped, so that the frame can
+ * be refined to a higher iteration limit without starting over.
+ *
+ */
+
+#include <stdlib.h>
+
+#include "mandel-lib.h"
+#include "mandel.h"
+#include "mandel-field.h"
+#include "mandel-sym.h"
+
+struct mandel_field {
+	struct mandel_state *state;	/* y_chars x x_chars */
+};
+
+/* One line to refine, as a pool task */
+struct field_line {
+	struct mandel_field *field;
+	int *frame;
+	int line;
+	int max;
+	unsigned long *resumed;
+};
+
+struct mandel_field *field_create(void)
+{
+	struct mandel_field *field;
+	double ys[x_chars];
+	int line, n;
+
+	field = safe_malloc(sizeof(*field));
+	field->state = safe_malloc(x_chars * y_chars *
+		sizeof(struct mandel_state));
+	for (line = 0; line < y_chars; line++) {
+		for (n = 0; n < x_chars; n++)
+			ys[n] = ymax - ystep * line;
+		mandel_state_init(&field->state[line * x_chars], xcoord, ys,
+			x_chars);
+	}
+
+	return field;
+}
+
+static void field_line_task(void *arg)
+{
+	struct field_line *fl = arg;
+	struct mandel_state *st = &fl->field->state[fl->line * x_chars];
+	double ys[x_chars];
+	unsigned long resumed = 0;
+	int n;
+
+	for (n = 0; n < x_chars; n++) {
+		ys[n] = ymax - ystep * fl->line;
+		if (!st[n].inside && st[n].iter < fl->max &&
+		    st[n].zx * st[n].zx + st[n].zy * st[n].zy <= 4)
+			resumed++;
+	}
+	mandel_iterations_resume(xcoord, ys, st, x_chars, fl->max,
+		&fl->frame[fl->line * x_chars]);
+	__sync_fetch_and_add(fl->resumed, resumed);
+	free(fl);
+}
+
+unsigned long field_refine(struct pool *pool, struct mandel_field *field,
+	int max, int frame[], const int mirror[])
+{
+	struct field_line *fl;
+	unsigned long resumed = 0;
+	int line;
+
+	for (line = 0; line < y_chars; line++) {
+		if (mirror && mirror[line] >= 0)
+			continue;
+		fl = safe_malloc(sizeof(*fl));
+		fl->field = field;
+		fl->frame = frame;
+		fl->line = line;
+		fl->max = max;
+		fl->resumed = &resumed;
+		pool_submit(pool, field_line_task, fl);
+	}
+	pool_wait(pool);
+
+	if (mirror)
+		mirror_mandel_frame(frame, mirror);
+
+	return resumed;
+}
+
+void field_destroy(struct mandel_field *field)
+{
+	free(field->state);
+	free(field);
+}
@@ -0,0 +1,32 @@
+/*
+ * mandel-field.h
+ *
+ * An iteration field: the escape time of every pixel of the frame
+ * together with where its iteration stopped, so that the frame can
+ * be refined to a higher iteration limit without starting over.
+ *
+ */
+
+#ifndef MANDEL_FIELD_H__
+#define MANDEL_FIELD_H__
+
+#include "mandel-pool.h"
+
+struct mandel_field;
+
+/* Create the field of the current viewport, with no iterations done */
+struct mandel_field *field_create(void);
+
+/*
+ * Bring every pixel of the field up to max iterations, running every
+ * line as a task on pool, and store the y_chars x x_chars iteration
+ * counts in frame[]. Lines mirrored according to mirror[] (if not NULL)
+ * are copied instead. max must not be lower than on the previous call.
+ * Returns the number of pixels that had to be iterated further.
+ */
+unsigned long field_refine(struct pool *pool, struct mandel_field *field,
+	int max, int frame[], const int mirror[]);
+
+void field_destroy(struct mandel_field *field);
+
+#endif /* MANDEL_FIELD_H__ */
@@ -0,0 +1,112 @@
+/*
+ * mandel-image.c
+ *
+ * Image export: the frame is rendered straight into a PPM or PGM
+ * file, sized up front and mapped into memory, every line written
+ * at its final place by whichever thread computed it.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "mandel-lib.h"
+#include "mandel.h"
+#include "mandel-image.h"
+
+/*
+ * Line i of the image starts at pixels + i * x_chars * channels.
+ * Lines are taken off next one at a time; since every one has a
+ * place of its own in the file, nothing else is shared.
+ */
+struct image {
+	unsigned char *pixels;
+	int channels;		/* 3 for PPM, 1 for PGM */
+	const struct mandel_palette *palette;
+	int next;
+};
+
+static void image_task(void *arg)
+{
+	struct image *img = arg;
+	int iter[x_chars];
+	unsigned char *row;
+	int line, col;
+
+	while ((line = __sync_fetch_and_add(&img->next, 1)) < y_chars) {
+		compute_mandel_run(line, 0, 0, 1, x_chars, iter);
+		row = img->pixels + (size_t)line * x_chars * img->channels;
+		if (img->channels == 1)
+			for (col = 0; col < x_chars; col++)
+				row[col] = iter[col] > 255 ? 255 : iter[col];
+		else
+			for (col = 0; col < x_chars; col++)
+				mandel_palette_rgb(img->palette, iter[col],
+					&row[3 * col]);
+	}
+}
+
+/*
+ * Size the file to size bytes, allocating its blocks if the file
+ * system can, so that running out of space shows here and not as a
+ * SIGBUS halfway through.
+ */
+static void image_size_file(int fd, const char *path, off_t size)
+{
+	int ret;
+
+	if (ftruncate(fd, size) < 0) {
+		perror(path);
+		exit(1);
+	}
+	ret = posix_fallocate(fd, 0, size);
+	if (ret && ret != EOPNOTSUPP && ret != EINVAL) {
+		errno = ret;
+		perror(path);
+		exit(1);
+	}
+}
+
+void render_mandel_image(struct pool *pool, const char *path)
+{
+	struct image img;
+	char header[64];
+	size_t len = strlen(path), size;
+	int fd, hlen, i;
+	void *map;
+
+	img.channels = len >= 4 && !strcmp(path + len - 4, ".pgm") ? 1 : 3;
+	img.palette = mandel_palette_current();
+	img.next = 0;
+	hlen = snprintf(header, sizeof(header), "P%c\n%d %d\n255\n",
+		img.channels == 1 ? '5' : '6', x_chars, y_chars);
+	size = hlen + (size_t)x_chars * y_chars * img.channels;
+
+	if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+		perror(path);
+		exit(1);
+	}
+	image_size_file(fd, path, size);
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("render_mandel_image: mmap");
+		exit(1);
+	}
+	memcpy(map, header, hlen);
+	img.pixels = (unsigned char *)map + hlen;
+
+	for (i = 0; i < num_threads; i++)
+		pool_submit(pool, image_task, &img);
+	pool_wait(pool);
+
+	if (munmap(map, size) < 0)
+		perror("render_mandel_image: munmap");
+	if (close(fd) < 0) {
+		perror(path);
+		exit(1);
+	}
+}
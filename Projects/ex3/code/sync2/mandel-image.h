@@ -0,0 +1,24 @@
+/*
+ * mandel-image.h
+ *
+ * Image export: the frame is rendered straight into a PPM or PGM
+ * file, sized up front and mapped into memory, every line written
+ * at its final place by whichever thread computed it.
+ *
+ */
+
+#ifndef MANDEL_IMAGE_H__
+#define MANDEL_IMAGE_H__
+
+#include "mandel-pool.h"
+
+/*
+ * Render the y_chars x x_chars frame into the file at path, with
+ * num_threads tasks on pool taking lines in turn: in color as a
+ * binary PPM, or as a binary PGM of the color values if path ends in
+ * ".pgm". Color values are the iteration counts, capped at 255, and
+ * colors come from the palette in use.
+ */
+void render_mandel_image(struct pool *pool, const char *path);
+
+#endif /* MANDEL_IMAGE_H__ */
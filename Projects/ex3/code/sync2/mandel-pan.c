@@ -0,0 +1,104 @@
+/*
+ * mandel-pan.c
+ *
+ * Animated pan across the tile grid (see mandel-render.h): every
+ * frame moves the view by a whole number of pixels, so only the
+ * tiles coming into view are computed, and the rest are taken
+ * from a tile cache.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mandel-lib.h"
+#include "mandel-render.h"
+#include "mandel-cache.h"
+#include "mandel.h"
+#include "mandel-pan.h"
+
+#define TILE_PIXELS (MANDEL_TILE_SIZE * MANDEL_TILE_SIZE)
+
+/*
+ * A tile of the grid, and the frame it is partly in view of: every
+ * tile is a task of its own, and the tasks of a frame fill in
+ * disjoint parts of it.
+ */
+struct pan_tile {
+	struct mandel_ctx *ctx;
+	struct mandel_cache *cache;
+	const struct mandel_grid_view *frame;
+	long tx, ty;
+	int *out;		/* The escape times of the frame */
+};
+
+/* Fill in the part of the frame in the tile, from the cache if it is there */
+static void pan_tile_task(void *arg)
+{
+	struct pan_tile *t = arg;
+	const struct mandel_grid_view *f = t->frame;
+	long x0 = t->tx * MANDEL_TILE_SIZE, y0 = t->ty * MANDEL_TILE_SIZE;
+	struct mandel_grid_view v = { f->zoom, x0, y0, MANDEL_TILE_SIZE,
+		MANDEL_TILE_SIZE, f->max_iteration };
+	int tile[TILE_PIXELS];
+
+	if (mandel_render_cached(t->ctx, t->cache, &v, tile) < 0) {
+		perror("render_mandel_pan: mandel_render_cached");
+		exit(1);
+	}
+	mandel_tile_blit(tile, t->tx, t->ty, f, t->out, f->width);
+	free(t);
+}
+
+static void pan_write(int fd, const char *s)
+{
+	if (insist_write(fd, s, strlen(s)) < 0) {
+		perror("render_mandel_pan: write");
+		exit(1);
+	}
+}
+
+void render_mandel_pan(struct pool *pool, struct mandel_ctx *ctx,
+	struct mandel_cache *cache, int fd, int dx, int dy, int frames)
+{
+	struct mandel_viewport vp = { xmin, xmax, ymin, ymax,
+		x_chars, y_chars, max_iteration };
+	struct mandel_grid_view view;
+	struct pan_tile *t;
+	char buf[64];
+	int *iter;
+	int frame;
+	long tx, ty;
+
+	mandel_grid_snap(&vp, &view);
+	iter = safe_malloc(x_chars * y_chars * sizeof(int));
+
+	/* Clear the screen, then draw every frame from the top left */
+	pan_write(fd, "\033[2J");
+	for (frame = 0; frame < frames; frame++) {
+		for (ty = mandel_floor_div(view.py, MANDEL_TILE_SIZE);
+		     ty * MANDEL_TILE_SIZE < view.py + y_chars; ty++)
+			for (tx = mandel_floor_div(view.px, MANDEL_TILE_SIZE);
+			     tx * MANDEL_TILE_SIZE < view.px + x_chars; tx++) {
+				t = safe_malloc(sizeof(*t));
+				t->ctx = ctx;
+				t->cache = cache;
+				t->frame = &view;
+				t->tx = tx;
+				t->ty = ty;
+				t->out = iter;
+				pool_submit(pool, pan_tile_task, t);
+			}
+		pool_wait(pool);
+		pan_write(fd, "\033[H");
+		output_mandel_frame(fd, iter);
+
+		view.px += dx;
+		view.py += dy;
+	}
+	snprintf(buf, sizeof(buf), "\033[%d;1H", y_chars + 1);
+	pan_write(fd, buf);
+
+	free(iter);
+}
@@ -0,0 +1,26 @@
+/*
+ * mandel-pan.h
+ *
+ * Animated pan across the tile grid (see mandel-render.h): every
+ * frame moves the view by a whole number of pixels, so only the
+ * tiles coming into view are computed, and the rest are taken
+ * from a tile cache.
+ *
+ */
+
+#ifndef MANDEL_PAN_H__
+#define MANDEL_PAN_H__
+
+#include "mandel-pool.h"
+#include "mandel-cache.h"
+
+/*
+ * Play frames frames of a pan to fd, moving by (dx, dy) pixels from
+ * one frame to the next, starting from the viewport snapped to the
+ * grid, and running every tile in view as a task on pool. The screen
+ * is cleared first, and the cursor left below the frame at the end.
+ */
+void render_mandel_pan(struct pool *pool, struct mandel_ctx *ctx,
+	struct mandel_cache *cache, int fd, int dx, int dy, int frames);
+
+#endif /* MANDEL_PAN_H__ */
@@ -0,0 +1,157 @@
+/*
+ * mandel-plan.c
+ *
+ * Cost-aware static partitioning: a coarse preview of the frame
+ * estimates what every line costs, and the lines are then cut into
+ * one contiguous chunk of equal estimated cost per thread.
+ *
+ */
+
+#include <stdlib.h>
+
+#include "mandel-lib.h"
+#include "mandel.h"
+#include "mandel-plan.h"
+
+/*
+ * The preview computes every PLAN_STRIDE-th pixel of every line,
+ * straight into the frame: the chunks only compute the others.
+ */
+#define PLAN_STRIDE 8
+
+/* Preview lines first + i, first + i + n, ... of the band, timing each */
+struct plan_preview {
+	int *frame;
+	double *cost;
+	int first, last;
+	int i, n;
+};
+
+struct plan_chunk {
+	int *frame;
+	int first, last;
+	double start, finish;
+	int thread;		/* Pool thread that ran it */
+};
+
+static unsigned long plan_previewed;
+
+void mandel_plan_stats(unsigned long *previewed)
+{
+	*previewed = __sync_fetch_and_add(&plan_previewed, 0);
+}
+
+/*
+ * Compute columns col, col + PLAN_STRIDE, ... of line,
+ * and store them into their places in row[].
+ */
+static int plan_columns(int line, int col, int row[])
+{
+	int n = (x_chars - col + PLAN_STRIDE - 1) / PLAN_STRIDE;
+	int iter[n], i;
+
+	compute_mandel_run(line, col, 0, PLAN_STRIDE, n, iter);
+	for (i = 0; i < n; i++)
+		row[col + i * PLAN_STRIDE] = iter[i];
+	return n;
+}
+
+/*
+ * The cost of a line is how long its preview took: this follows
+ * the iterations actually run, which the counts do not tell apart
+ * from the ones skipped for points known to be inside the set.
+ */
+static void plan_preview_task(void *arg)
+{
+	struct plan_preview *pv = arg;
+	unsigned long previewed = 0;
+	double start;
+	int line;
+
+	for (line = pv->first + pv->i; line <= pv->last; line += pv->n) {
+		start = wall_time();
+		previewed += plan_columns(line, 0, &pv->frame[line * x_chars]);
+		pv->cost[line - pv->first] = wall_time() - start;
+	}
+	__sync_fetch_and_add(&plan_previewed, previewed);
+}
+
+static void plan_chunk_task(void *arg)
+{
+	struct plan_chunk *chunk = arg;
+	int line, col;
+
+	chunk->thread = pool_self();
+	chunk->start = wall_time();
+	for (line = chunk->first; line <= chunk->last; line++)
+		for (col = 1; col < PLAN_STRIDE && col < x_chars; col++)
+			plan_columns(line, col, &chunk->frame[line * x_chars]);
+	chunk->finish = wall_time();
+}
+
+void render_mandel_plan(struct pool *pool, int frame[], int first, int last)
+{
+	int nlines = last - first + 1;
+	struct plan_preview preview[num_threads];
+	struct plan_chunk chunk[num_threads];
+	double cost[nlines], total = 0, sum = 0, start, end;
+	double busy[num_threads];
+	int i, line;
+
+	/* The preview itself is split statically, line i to thread i */
+	for (i = 0; i < num_threads; i++) {
+		preview[i].frame = frame;
+		preview[i].cost = cost;
+		preview[i].first = first;
+		preview[i].last = last;
+		preview[i].i = i;
+		preview[i].n = num_threads;
+		pool_submit(pool, plan_preview_task, &preview[i]);
+	}
+	pool_wait(pool);
+	for (line = 0; line < nlines; line++)
+		total += cost[line];
+
+	/*
+	 * Chunk i ends at the first line where the running cost reaches
+	 * (i + 1) / num_threads of the total, or later if that would
+	 * leave it empty; trailing chunks may be empty on short bands.
+	 */
+	start = wall_time();
+	line = first;
+	for (i = 0; i < num_threads; i++) {
+		chunk[i].frame = frame;
+		chunk[i].first = line;
+		while (line <= last &&
+		       (line == chunk[i].first ||
+			sum + cost[line - first] / 2 <
+			total * (i + 1) / num_threads)) {
+			sum += cost[line - first];
+			line++;
+		}
+		if (i == num_threads - 1)
+			line = last + 1;
+		chunk[i].last = line - 1;
+		chunk[i].start = chunk[i].finish = start;
+		chunk[i].thread = -1;
+		if (chunk[i].last >= chunk[i].first)
+			pool_submit(pool, plan_chunk_task, &chunk[i]);
+	}
+	pool_wait(pool);
+	end = wall_time();
+
+	/* Chunks go to whichever pool thread is free, maybe several to one */
+	for (i = 0; i < num_threads; i++)
+		busy[i] = 0;
+	for (i = 0; i < num_threads; i++) {
+		if (chunk[i].thread < 0)
+			continue;
+		busy[chunk[i].thread] += chunk[i].finish - chunk[i].start;
+		thread_stats[chunk[i].thread].lines +=
+			chunk[i].last - chunk[i].first + 1;
+	}
+	for (i = 0; i < num_threads; i++) {
+		thread_stats[i].busy += busy[i];
+		thread_stats[i].idle += (end - start) - busy[i];
+	}
+}
@@ -0,0 +1,26 @@
+/*
+ * mandel-plan.h
+ *
+ * Cost-aware static partitioning: a coarse preview of the frame
+ * estimates what every line costs, and the lines are then cut into
+ * one contiguous chunk of equal estimated cost per thread.
+ *
+ */
+
+#ifndef MANDEL_PLAN_H__
+#define MANDEL_PLAN_H__
+
+#include "mandel-pool.h"
+
+/*
+ * Render lines first to last (inclusive) of the y_chars x x_chars
+ * frame of iteration counts in frame[], as num_threads chunks of
+ * lines, each one a task on pool. Returns when these lines are
+ * complete. Chunk i adds what it did to thread_stats[i].
+ */
+void render_mandel_plan(struct pool *pool, int frame[], int first, int last);
+
+/* Number of pixels computed by the preview, and kept in the frame */
+void mandel_plan_stats(unsigned long *previewed);
+
+#endif /* MANDEL_PLAN_H__ */
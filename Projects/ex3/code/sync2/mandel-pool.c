@@ -0,0 +1,147 @@
+/*
+ * mandel-pool.c
+ *
+ * A fixed-size pool of POSIX threads, running tasks
+ * from a shared FIFO queue.
+ *
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "mandel.h"
+#include "mandel-pool.h"
+
+struct pool_task {
+	pool_fn *fn;
+	void *arg;
+	struct pool_task *next;
+};
+
+struct pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work;	/* A task was queued, or the pool is stopping */
+	pthread_cond_t idle;	/* pending dropped to zero */
+	struct pool_task *head, *tail;
+	int pending;		/* Tasks queued or running */
+	int stopping;
+	int nthreads;
+	int started;		/* Threads that have picked their number */
+	pthread_t *thread;
+};
+
+/* The number of the pool thread we are, see pool_self() */
+static __thread int pool_index = -1;
+
+static void *pool_thread(void *arg)
+{
+	struct pool *pool = arg;
+	struct pool_task *task;
+
+	pool_index = __sync_fetch_and_add(&pool->started, 1);
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->head && !pool->stopping)
+			pthread_cond_wait(&pool->work, &pool->lock);
+		if (!pool->head)
+			break;
+
+		task = pool->head;
+		pool->head = task->next;
+		if (!pool->head)
+			pool->tail = NULL;
+
+		pthread_mutex_unlock(&pool->lock);
+		task->fn(task->arg);
+		free(task);
+		pthread_mutex_lock(&pool->lock);
+
+		if (--pool->pending == 0)
+			pthread_cond_broadcast(&pool->idle);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+struct pool *pool_create(int nthreads)
+{
+	struct pool *pool;
+	int i, ret;
+
+	pool = safe_malloc(sizeof(*pool));
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->idle, NULL);
+	pool->head = pool->tail = NULL;
+	pool->pending = 0;
+	pool->stopping = 0;
+	pool->nthreads = nthreads;
+	pool->started = 0;
+	pool->thread = safe_malloc(nthreads * sizeof(pthread_t));
+
+	for (i = 0; i < nthreads; i++) {
+		ret = pthread_create(&pool->thread[i], NULL, pool_thread, pool);
+		if (ret) {
+			perror_pthread(ret, "pool_create: pthread_create");
+			exit(1);
+		}
+	}
+
+	return pool;
+}
+
+void pool_submit(struct pool *pool, pool_fn *fn, void *arg)
+{
+	struct pool_task *task;
+
+	task = safe_malloc(sizeof(*task));
+	task->fn = fn;
+	task->arg = arg;
+	task->next = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->tail)
+		pool->tail->next = task;
+	else
+		pool->head = task;
+	pool->tail = task;
+	pool->pending++;
+	pthread_cond_signal(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_wait(struct pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	while (pool->pending > 0)
+		pthread_cond_wait(&pool->idle, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+int pool_self(void)
+{
+	return pool_index;
+}
+
+void pool_destroy(struct pool *pool)
+{
+	int i, ret;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nthreads; i++) {
+		ret = pthread_join(pool->thread[i], NULL);
+		if (ret)
+			perror_pthread(ret, "pool_destroy: pthread_join");
+	}
+
+	pthread_cond_destroy(&pool->idle);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->thread);
+	free(pool);
+}
@@ -0,0 +1,37 @@
+/*
+ * mandel-pool.h
+ *
+ * A fixed-size pool of POSIX threads, running tasks
+ * from a shared FIFO queue.
+ *
+ */
+
+#ifndef MANDEL_POOL_H__
+#define MANDEL_POOL_H__
+
+typedef void pool_fn(void *arg);
+
+struct pool;
+
+/* Create a pool of nthreads threads, waiting for tasks */
+struct pool *pool_create(int nthreads);
+
+/*
+ * Queue fn(arg) to run on one of the threads.
+ * Tasks may submit further tasks.
+ */
+void pool_submit(struct pool *pool, pool_fn *fn, void *arg);
+
+/* Wait until the queue is empty and no task is running */
+void pool_wait(struct pool *pool);
+
+/*
+ * Returns the number of the pool thread running the calling task,
+ * from 0 to nthreads - 1, or -1 if called from outside a pool.
+ */
+int pool_self(void);
+
+/* Stop all threads and free the pool; pending tasks are run first */
+void pool_destroy(struct pool *pool);
+
+#endif /* MANDEL_POOL_H__ */
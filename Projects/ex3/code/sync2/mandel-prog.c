@@ -0,0 +1,173 @@
+/*
+ * mandel-prog.c
+ *
+ * Progressive rendering: the frame is drawn at 1/8, 1/4, 1/2 and
+ * full resolution in turn, every pass only computing the pixels the
+ * coarser ones have not, until it is complete or time runs out.
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mandel-lib.h"
+#include "mandel.h"
+#include "mandel-prog.h"
+
+/*
+ * The pass of step s computes the pixels whose line and column are
+ * both multiples of s, except those the pass of step 2s did. Steps
+ * go from PROG_COARSEST down to 1, halving every time.
+ */
+#define PROG_COARSEST 8
+#define PROG_PASSES 4
+
+/*
+ * done[pass * y_chars + line] is set once pass has computed its
+ * pixels of line; every line of a pass is computed whole or not at all.
+ */
+struct prog {
+	int *frame;
+	char *done;
+	double deadline;
+	unsigned long computed;
+};
+
+struct prog_line {
+	struct prog *prog;
+	int pass, step, line;
+};
+
+/* The pass computing (line, col), that of the largest step dividing both */
+static int prog_pass_of(int line, int col)
+{
+	int pass, step = PROG_COARSEST;
+
+	for (pass = 0; pass < PROG_PASSES - 1; pass++, step /= 2)
+		if (line % step == 0 && col % step == 0)
+			break;
+	return pass;
+}
+
+static void prog_line_task(void *arg)
+{
+	struct prog_line *pl = arg;
+	struct prog *prog = pl->prog;
+	int step = pl->step, line = pl->line;
+	int col, dcol, n, i;
+
+	if (pl->pass > 0 && wall_time() >= prog->deadline) {
+		free(pl);
+		return;
+	}
+
+	/* Lines of the coarser pass already have every other pixel */
+	if (pl->pass > 0 && line % (2 * step) == 0) {
+		col = step;
+		dcol = 2 * step;
+	} else {
+		col = 0;
+		dcol = step;
+	}
+	n = (x_chars - col + dcol - 1) / dcol;
+	if (n > 0) {
+		int iter[n];
+
+		compute_mandel_run(line, col, 0, dcol, n, iter);
+		for (i = 0; i < n; i++)
+			prog->frame[line * x_chars + col + i * dcol] = iter[i];
+		__sync_fetch_and_add(&prog->computed, n);
+	}
+	prog->done[pl->pass * y_chars + line] = 1;
+	free(pl);
+}
+
+static void prog_write(const char *s)
+{
+	if (insist_write(1, s, strlen(s)) < 0) {
+		perror("render_mandel_prog: write");
+		exit(1);
+	}
+}
+
+/*
+ * Fill in shown[] with the best value computed so far for every
+ * pixel: its own, or else that of the corner of the smallest block
+ * around it, of 2, 4 or 8 pixels a side, that has been computed.
+ */
+static void prog_show(struct prog *prog, int shown[])
+{
+	int line, col, step, l, c, pass;
+
+	for (line = 0; line < y_chars; line++)
+		for (col = 0; col < x_chars; col++)
+			for (step = 1; step <= PROG_COARSEST; step *= 2) {
+				l = line - line % step;
+				c = col - col % step;
+				pass = prog_pass_of(l, c);
+				if (prog->done[pass * y_chars + l]) {
+					shown[line * x_chars + col] =
+						prog->frame[l * x_chars + c];
+					break;
+				}
+			}
+}
+
+int render_mandel_prog(struct pool *pool, double budget)
+{
+	struct prog prog;
+	struct prog_line *pl;
+	int *shown, pass, step, line, lines, passes = 0;
+	double start = wall_time();
+	char buf[64];
+
+	prog.frame = safe_malloc(x_chars * y_chars * sizeof(int));
+	prog.done = safe_malloc(PROG_PASSES * y_chars);
+	memset(prog.done, 0, PROG_PASSES * y_chars);
+	prog.deadline = HUGE_VAL;	/* Until the first pass is done */
+	prog.computed = 0;
+	shown = safe_malloc(x_chars * y_chars * sizeof(int));
+
+	/* Clear the screen, then redraw the frame from the top left */
+	prog_write("\033[2J");
+	for (pass = 0, step = PROG_COARSEST; pass < PROG_PASSES;
+	     pass++, step /= 2) {
+		for (line = 0; line < y_chars; line += step) {
+			pl = safe_malloc(sizeof(*pl));
+			pl->prog = &prog;
+			pl->pass = pass;
+			pl->step = step;
+			pl->line = line;
+			pool_submit(pool, prog_line_task, pl);
+		}
+		pool_wait(pool);
+
+		prog_show(&prog, shown);
+		prog_write("\033[H");
+		output_mandel_frame(1, shown);
+		if (pass == 0)
+			prog.deadline = wall_time() + budget;
+
+		for (line = 0, lines = 0; line < y_chars; line++)
+			lines += prog.done[pass * y_chars + line];
+		fprintf(stderr, "Progressive: 1/%d pass, %d of %d lines, "
+			"%lu pixels computed in all, %.3f s\n", step, lines,
+			(y_chars + step - 1) / step, prog.computed,
+			wall_time() - start);
+
+		if (lines < (y_chars + step - 1) / step)
+			break;
+		passes++;
+		if (wall_time() >= prog.deadline)
+			break;
+	}
+	snprintf(buf, sizeof(buf), "\033[%d;1H", y_chars + 1);
+	prog_write(buf);
+
+	free(shown);
+	free(prog.done);
+	free(prog.frame);
+	return passes;
+}
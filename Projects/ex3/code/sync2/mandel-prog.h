@@ -0,0 +1,28 @@
+/*
+ * mandel-prog.h
+ *
+ * Progressive rendering: the frame is drawn at 1/8, 1/4, 1/2 and
+ * full resolution in turn, every pass only computing the pixels the
+ * coarser ones have not, until it is complete or time runs out.
+ *
+ */
+
+#ifndef MANDEL_PROG_H__
+#define MANDEL_PROG_H__
+
+#include "mandel-pool.h"
+
+/*
+ * Render the y_chars x x_chars frame in passes, running every line
+ * of a pass as a task on pool, and redraw it in place on the terminal
+ * with output_mandel_frame() after each one; pixels not computed yet
+ * show the nearest one above and to their left that is. The first
+ * pass always completes; once budget seconds have gone by since it
+ * was drawn, lines not started are dropped and the frame is output
+ * for the last time.
+ *
+ * Returns the number of passes completed, 4 for the whole frame.
+ */
+int render_mandel_prog(struct pool *pool, double budget);
+
+#endif /* MANDEL_PROG_H__ */
@@ -0,0 +1,152 @@
+/*
+ * mandel-rect.c
+ *
+ * Mariani-Silver rendering of the Mandelbrot Set:
+ * rectangles with a border of a single iteration count are filled,
+ * all others are split in two and rendered recursively.
+ *
+ */
+
+#include <stdlib.h>
+
+#include "mandel.h"
+#include "mandel-rect.h"
+
+/*
+ * Rectangles with fewer than this many interior pixels
+ * on either side are computed pixel by pixel.
+ */
+#define RECT_MIN_SIDE 4
+
+/*
+ * A rectangle of the frame, with inclusive corners (x0, y0), (x1, y1).
+ * The border (rows y0, y1 and columns x0, x1) has already been computed
+ * by whoever created the rectangle; the task only handles the interior.
+ */
+struct rect {
+	struct pool *pool;
+	int *frame;
+	int x0, y0;
+	int x1, y1;
+};
+
+static unsigned long rect_computed;
+static unsigned long rect_filled;
+
+void mandel_rect_stats(unsigned long *computed, unsigned long *filled)
+{
+	*computed = __sync_fetch_and_add(&rect_computed, 0);
+	*filled = __sync_fetch_and_add(&rect_filled, 0);
+}
+
+/*
+ * Compute n pixels from (line, col) in direction (dline, dcol)
+ * and store them straight into the frame.
+ */
+static void rect_compute(int frame[], int line, int col,
+	int dline, int dcol, int n)
+{
+	int i, iter[n];
+
+	if (n <= 0)
+		return;
+
+	compute_mandel_run(line, col, dline, dcol, n, iter);
+	for (i = 0; i < n; i++)
+		frame[(line + i * dline) * x_chars + col + i * dcol] = iter[i];
+	__sync_fetch_and_add(&rect_computed, n);
+}
+
+/*
+ * Returns nonzero if all border pixels of r have the same
+ * iteration count, and stores that count in *val.
+ */
+static int rect_border_uniform(const struct rect *r, int *val)
+{
+	const int *f = r->frame;
+	int x, y, v = f[r->y0 * x_chars + r->x0];
+
+	for (x = r->x0; x <= r->x1; x++)
+		if (f[r->y0 * x_chars + x] != v || f[r->y1 * x_chars + x] != v)
+			return 0;
+	for (y = r->y0 + 1; y < r->y1; y++)
+		if (f[y * x_chars + r->x0] != v || f[y * x_chars + r->x1] != v)
+			return 0;
+
+	*val = v;
+	return 1;
+}
+
+static void rect_task(void *arg)
+{
+	struct rect *r = arg, *a, *b;
+	int w = r->x1 - r->x0 - 1;	/* Interior width */
+	int h = r->y1 - r->y0 - 1;	/* Interior height */
+	int x, y, mid, val;
+
+	if (w <= 0 || h <= 0) {
+		free(r);
+		return;
+	}
+
+	if (rect_border_uniform(r, &val)) {
+		for (y = r->y0 + 1; y < r->y1; y++)
+			for (x = r->x0 + 1; x < r->x1; x++)
+				r->frame[y * x_chars + x] = val;
+		__sync_fetch_and_add(&rect_filled, (unsigned long)w * h);
+		free(r);
+		return;
+	}
+
+	if (w < RECT_MIN_SIDE || h < RECT_MIN_SIDE) {
+		for (y = r->y0 + 1; y < r->y1; y++)
+			rect_compute(r->frame, y, r->x0 + 1, 0, 1, w);
+		free(r);
+		return;
+	}
+
+	/*
+	 * Split across the longer side. The dividing line becomes
+	 * part of the border of both halves, so compute it here.
+	 */
+	a = safe_malloc(sizeof(*a));
+	b = safe_malloc(sizeof(*b));
+	*a = *b = *r;
+	if (w >= h) {
+		mid = (r->x0 + r->x1) / 2;
+		rect_compute(r->frame, r->y0 + 1, mid, 1, 0, h);
+		a->x1 = b->x0 = mid;
+	} else {
+		mid = (r->y0 + r->y1) / 2;
+		rect_compute(r->frame, mid, r->x0 + 1, 0, 1, w);
+		a->y1 = b->y0 = mid;
+	}
+	pool_submit(r->pool, rect_task, a);
+	pool_submit(r->pool, rect_task, b);
+	free(r);
+}
+
+void render_mandel_rect(struct pool *pool, int frame[], int first, int last)
+{
+	struct rect *r;
+	int h = last - first + 1;
+
+	r = safe_malloc(sizeof(*r));
+	r->pool = pool;
+	r->frame = frame;
+	r->x0 = 0;
+	r->y0 = first;
+	r->x1 = x_chars - 1;
+	r->y1 = last;
+
+	/* The border of the whole band */
+	rect_compute(frame, r->y0, r->x0, 0, 1, x_chars);
+	if (r->y1 > r->y0)
+		rect_compute(frame, r->y1, r->x0, 0, 1, x_chars);
+	rect_compute(frame, r->y0 + 1, r->x0, 1, 0, h - 2);
+	if (r->x1 > r->x0)
+		rect_compute(frame, r->y0 + 1, r->x1, 1, 0, h - 2);
+
+	pool_submit(pool, rect_task, r);
+	pool_wait(pool);
+}
@@ -0,0 +1,25 @@
+/*
+ * mandel-rect.h
+ *
+ * Mariani-Silver rendering of the Mandelbrot Set:
+ * rectangles with a border of a single iteration count are filled,
+ * all others are split in two and rendered recursively.
+ *
+ */
+
+#ifndef MANDEL_RECT_H__
+#define MANDEL_RECT_H__
+
+#include "mandel-pool.h"
+
+/*
+ * Render lines first to last (inclusive) of the y_chars x x_chars
+ * frame of iteration counts in frame[], running every subrectangle
+ * as a task on pool. Returns when these lines are complete.
+ */
+void render_mandel_rect(struct pool *pool, int frame[], int first, int last);
+
+/* Number of pixels computed and filled without computing them */
+void mandel_rect_stats(unsigned long *computed, unsigned long *filled);
+
+#endif /* MANDEL_RECT_H__ */
@@ -0,0 +1,166 @@
+/*
+ * mandel-steal.c
+ *
+ * A work-stealing scheduler for ranges of lines: every thread works
+ * through a deque of its own, and steals from the others when it
+ * runs out.
+ *
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "mandel.h"
+#include "mandel-steal.h"
+
+/*
+ * The deque of a thread. Its lines always form a single range
+ * [front, back): the owner takes lines from the front, thieves take
+ * them from the back, so both ends only ever move towards each other.
+ */
+struct steal_deque {
+	pthread_mutex_t lock;
+	int front, back;
+};
+
+struct steal {
+	int nthreads;
+	int grain;
+	steal_fn *fn;
+	void *arg;
+	struct steal_deque *deque;
+	struct thread_stats *stats;
+};
+
+struct steal_thread {
+	struct steal *s;
+	int self;
+};
+
+/* Take up to grain lines from the front of our own deque */
+static int steal_take(struct steal *s, int self, int *first, int *last)
+{
+	struct steal_deque *d = &s->deque[self];
+	int ok = 0;
+
+	pthread_mutex_lock(&d->lock);
+	if (d->front < d->back) {
+		*first = d->front;
+		d->front += s->grain;
+		if (d->front > d->back)
+			d->front = d->back;
+		*last = d->front - 1;
+		ok = 1;
+	}
+	pthread_mutex_unlock(&d->lock);
+
+	return ok;
+}
+
+/*
+ * Move the back half of the fullest other deque into our own.
+ * Returns 0 if there was nothing left anywhere.
+ */
+static int steal_from_others(struct steal *s, int self)
+{
+	struct steal_deque *d;
+	int i, victim, most, left, half, first = 0;
+
+	for (;;) {
+		/* A racy look is fine for picking a victim */
+		victim = -1;
+		most = 0;
+		for (i = 0; i < s->nthreads; i++) {
+			d = &s->deque[i];
+			left = d->back - d->front;
+			if (i != self && left > most) {
+				most = left;
+				victim = i;
+			}
+		}
+		if (victim < 0)
+			return 0;
+
+		d = &s->deque[victim];
+		pthread_mutex_lock(&d->lock);
+		left = d->back - d->front;
+		half = (left + 1) / 2;
+		if (half > 0)
+			first = d->back -= half;
+		pthread_mutex_unlock(&d->lock);
+		if (half <= 0)
+			continue;	/* Emptied meanwhile; look again */
+
+		d = &s->deque[self];
+		pthread_mutex_lock(&d->lock);
+		d->front = first;
+		d->back = first + half;
+		pthread_mutex_unlock(&d->lock);
+		s->stats[self].steals++;
+		return 1;
+	}
+}
+
+static void *steal_thread(void *arg)
+{
+	struct steal_thread *t = arg;
+	struct steal *s = t->s;
+	struct thread_stats *st = &s->stats[t->self];
+	double start = wall_time();
+	int first, last;
+
+	for (;;) {
+		if (!steal_take(s, t->self, &first, &last)) {
+			if (!steal_from_others(s, t->self))
+				break;
+			continue;
+		}
+		st->busy += s->fn(s->arg, t->self, first, last);
+		st->lines += last - first + 1;
+	}
+	st->idle = wall_time() - start - st->busy;
+
+	return NULL;
+}
+
+void steal_run(int nthreads, int n, int grain, steal_fn *fn, void *arg,
+	struct thread_stats stats[])
+{
+	struct steal s;
+	struct steal_thread t[nthreads];
+	pthread_t thread[nthreads];
+	int i, ret;
+
+	s.nthreads = nthreads;
+	s.grain = grain;
+	s.fn = fn;
+	s.arg = arg;
+	s.stats = stats;
+	s.deque = safe_malloc(nthreads * sizeof(struct steal_deque));
+	for (i = 0; i < nthreads; i++) {
+		pthread_mutex_init(&s.deque[i].lock, NULL);
+		s.deque[i].front = (long)n * i / nthreads;
+		s.deque[i].back = (long)n * (i + 1) / nthreads;
+		stats[i].busy = stats[i].idle = 0;
+		stats[i].lines = stats[i].steals = 0;
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		t[i].s = &s;
+		t[i].self = i;
+		ret = pthread_create(&thread[i], NULL, steal_thread, &t[i]);
+		if (ret) {
+			perror_pthread(ret, "steal_run: pthread_create");
+			exit(1);
+		}
+	}
+	for (i = 0; i < nthreads; i++) {
+		ret = pthread_join(thread[i], NULL);
+		if (ret)
+			perror_pthread(ret, "steal_run: pthread_join");
+	}
+
+	for (i = 0; i < nthreads; i++)
+		pthread_mutex_destroy(&s.deque[i].lock);
+	free(s.deque);
+}
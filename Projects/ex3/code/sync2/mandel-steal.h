@@ -0,0 +1,32 @@
+/*
+ * mandel-steal.h
+ *
+ * A work-stealing scheduler for ranges of lines: every thread works
+ * through a deque of its own, and steals from the others when it
+ * runs out.
+ *
+ */
+
+#ifndef MANDEL_STEAL_H__
+#define MANDEL_STEAL_H__
+
+#include "mandel.h"
+
+/*
+ * Compute lines first to last (inclusive), on thread number thread.
+ * Returns the seconds spent computing them, as opposed to waiting,
+ * e.g. for their turn to be output.
+ */
+typedef double steal_fn(void *arg, int thread, int first, int last);
+
+/*
+ * Run fn over every line of [0, n) on nthreads threads, at most grain
+ * lines per call. Every thread starts with an equal share of the lines
+ * in its deque; once it is empty, the thread steals the back half of
+ * the fullest deque. Returns when all lines are done, with the time
+ * every thread spent computing and the rest of its time in stats[].
+ */
+void steal_run(int nthreads, int n, int grain, steal_fn *fn, void *arg,
+	struct thread_stats stats[]);
+
+#endif /* MANDEL_STEAL_H__ */
@@ -0,0 +1,77 @@
+/*
+ * mandel-sym.c
+ *
+ * Conjugate symmetry of the Mandelbrot Set: the point (x, -y)
+ * escapes exactly when (x, y) does, so lines mirrored across
+ * the real axis need to be computed only once.
+ *
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "mandel.h"
+#include "mandel-sym.h"
+
+/*
+ * How far from a whole number of lines the real axis may be
+ * for lines on either side to still count as mirror images.
+ */
+#define SYM_TOLERANCE 1e-6
+
+int *plan_mandel_symmetry(void)
+{
+	int *mirror;
+	int line, other, k;
+	double axis;
+
+	mirror = safe_malloc(y_chars * sizeof(int));
+	for (line = 0; line < y_chars; line++)
+		mirror[line] = -1;
+
+	/*
+	 * Line l is at y = ymax - ystep * l, so lines l and l' are
+	 * mirror images when l + l' = 2 * ymax / ystep. This only
+	 * happens if the real axis falls on a line or halfway between two.
+	 */
+	if (ymin >= 0 || ymax <= 0)
+		return mirror;
+	axis = 2 * ymax / ystep;
+	k = (int)(axis + 0.5);
+	if (fabs(axis - k) > SYM_TOLERANCE)
+		return mirror;
+
+	/*
+	 * Lines above the axis are computed, lines below it are copied
+	 * from their mirror image if it falls within the viewport.
+	 */
+	for (line = 0; line < y_chars; line++) {
+		other = k - line;
+		if (other >= 0 && other < line)
+			mirror[line] = other;
+	}
+
+	return mirror;
+}
+
+int mandel_symmetry_lines(const int mirror[])
+{
+	int line, n = 0;
+
+	for (line = 0; line < y_chars; line++)
+		if (mirror[line] < 0)
+			n++;
+
+	return n;
+}
+
+void mirror_mandel_frame(int frame[], const int mirror[])
+{
+	int line;
+
+	for (line = 0; line < y_chars; line++)
+		if (mirror[line] >= 0)
+			memcpy(&frame[line * x_chars],
+				&frame[mirror[line] * x_chars],
+				x_chars * sizeof(int));
+}
@@ -0,0 +1,31 @@
+/*
+ * mandel-sym.h
+ *
+ * Conjugate symmetry of the Mandelbrot Set: the point (x, -y)
+ * escapes exactly when (x, y) does, so lines mirrored across
+ * the real axis need to be computed only once.
+ *
+ */
+
+#ifndef MANDEL_SYM_H__
+#define MANDEL_SYM_H__
+
+/*
+ * Plan which lines of the y_chars lines of output are mirror images
+ * of others. Returns a newly allocated array of y_chars entries:
+ * mirror[line] is the (smaller) line that line can be copied from,
+ * or -1 if line has to be computed. If the viewport is not aligned
+ * to the real axis every entry is -1.
+ */
+int *plan_mandel_symmetry(void);
+
+/* Number of lines that have to be computed according to mirror[] */
+int mandel_symmetry_lines(const int mirror[]);
+
+/*
+ * Copy every mirrored line of frame[] (y_chars lines of x_chars values)
+ * from its source line, which must already be there.
+ */
+void mirror_mandel_frame(int frame[], const int mirror[]);
+
+#endif /* MANDEL_SYM_H__ */
@@ -0,0 +1,129 @@
+/*
+ * mandel-tile.c
+ *
+ * Tiled rendering of the Mandelbrot Set: the frame is cut into
+ * square tiles, which threads take in Morton (Z) order, so that
+ * the tiles in flight at any time lie close together.
+ *
+ */
+
+#include <stdlib.h>
+
+#include "mandel-lib.h"
+#include "mandel.h"
+#include "mandel-tile.h"
+
+/*
+ * A tile is the top left corner of a tile_size x tile_size square,
+ * cut short at the right and bottom edges of the band.
+ */
+struct tile_pos {
+	int line, col;
+};
+
+/*
+ * order[] lists the tiles of the band in Morton order;
+ * every task takes the next one off it until none are left,
+ * and adds the time it spent computing to busy[task].
+ */
+struct tile_band {
+	int *frame;
+	int first, last;
+	int ntiles;
+	struct tile_pos *order;
+	int next;
+	double *busy;		/* Per pool thread */
+};
+
+/* Spread the low 16 bits of v out to the even bits */
+static unsigned int tile_spread(unsigned int v)
+{
+	v &= 0xffff;
+	v = (v | (v << 8)) & 0x00ff00ff;
+	v = (v | (v << 4)) & 0x0f0f0f0f;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+/* The Morton code of tile (tx, ty): their bits interleaved */
+static unsigned int tile_morton(int tx, int ty)
+{
+	return tile_spread(tx) | (tile_spread(ty) << 1);
+}
+
+static int tile_cmp(const void *a, const void *b)
+{
+	const struct tile_pos *p = a, *q = b;
+	unsigned int ma = tile_morton(p->col / tile_size, p->line / tile_size);
+	unsigned int mb = tile_morton(q->col / tile_size, q->line / tile_size);
+
+	return ma < mb ? -1 : ma > mb;
+}
+
+static void tile_task(void *arg)
+{
+	struct tile_band *band = arg;
+	struct tile_pos *tile;
+	double t0 = wall_time();
+	int i, line, last, width;
+
+	while ((i = __sync_fetch_and_add(&band->next, 1)) < band->ntiles) {
+		tile = &band->order[i];
+		last = tile->line + tile_size - 1;
+		if (last > band->last)
+			last = band->last;
+		width = x_chars - tile->col;
+		if (width > tile_size)
+			width = tile_size;
+		for (line = tile->line; line <= last; line++)
+			compute_mandel_run(line, tile->col, 0, 1, width,
+				&band->frame[line * x_chars + tile->col]);
+	}
+	band->busy[pool_self()] += wall_time() - t0;
+}
+
+void render_mandel_tiles(struct pool *pool, int frame[], int first, int last)
+{
+	struct tile_band band;
+	double start, end;
+	int i, line, col;
+
+	band.frame = frame;
+	band.first = first;
+	band.last = last;
+	band.ntiles = ((last - first + tile_size) / tile_size) *
+		((x_chars + tile_size - 1) / tile_size);
+	band.order = safe_malloc(band.ntiles * sizeof(struct tile_pos));
+	band.next = 0;
+	band.busy = safe_malloc(num_threads * sizeof(double));
+	for (i = 0; i < num_threads; i++)
+		band.busy[i] = 0;
+
+	/* Tile coordinates are relative to the band, for tile_cmp() */
+	i = 0;
+	for (line = 0; line <= last - first; line += tile_size)
+		for (col = 0; col < x_chars; col += tile_size) {
+			band.order[i].line = line;
+			band.order[i].col = col;
+			i++;
+		}
+	qsort(band.order, band.ntiles, sizeof(struct tile_pos), tile_cmp);
+	for (i = 0; i < band.ntiles; i++)
+		band.order[i].line += first;
+
+	start = wall_time();
+	for (i = 0; i < num_threads; i++)
+		pool_submit(pool, tile_task, &band);
+	pool_wait(pool);
+	end = wall_time();
+
+	/* A task runs on one thread from start to finish, not always its own */
+	for (i = 0; i < num_threads; i++) {
+		thread_stats[i].busy += band.busy[i];
+		thread_stats[i].idle += (end - start) - band.busy[i];
+	}
+
+	free(band.busy);
+	free(band.order);
+}
@@ -0,0 +1,26 @@
+/*
+ * mandel-tile.h
+ *
+ * Tiled rendering of the Mandelbrot Set: the frame is cut into
+ * square tiles, which threads take in Morton (Z) order, so that
+ * the tiles in flight at any time lie close together.
+ *
+ */
+
+#ifndef MANDEL_TILE_H__
+#define MANDEL_TILE_H__
+
+#include "mandel-pool.h"
+
+/* Tile width and height, in pixels; see mandel.c */
+extern int tile_size;
+
+/*
+ * Render lines first to last (inclusive) of the y_chars x x_chars
+ * frame of iteration counts in frame[], tile_size x tile_size
+ * pixels at a time, with num_threads tasks on pool taking tiles in
+ * Morton order. Returns when these lines are complete.
+ */
+void render_mandel_tiles(struct pool *pool, int frame[], int first, int last);
+
+#endif /* MANDEL_TILE_H__ */
@@ -0,0 +1,158 @@
+/*
+ * mandel-zoom.c
+ *
+ * Animated zoom toward a point: every frame halves the pixel
+ * spacing, reuses the pixels of the previous frame that land on the
+ * same points, and only repaints the cells whose color changed.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mandel-lib.h"
+#include "mandel.h"
+#include "mandel-zoom.h"
+
+/*
+ * Pixel (line, col) of a frame is at offsets (line - y_chars / 2,
+ * col - x_chars / 2) from the center, in pixels. Halving the spacing
+ * from one frame to the next puts the pixels at even offsets (dl, dc)
+ * exactly on pixel (dl / 2, dc / 2) of the previous frame, since
+ * halving a double is exact: a quarter of every frame is reused.
+ */
+struct zoom {
+	double cx, cy;
+	double sx, sy;		/* Pixel spacing of this frame */
+	int first;		/* Nothing to reuse, nor to repaint over */
+	int *iter, *prev_iter;
+	int *color, *prev_color;
+	struct xterm_frame *screen;
+};
+
+struct zoom_line {
+	struct zoom *zoom;
+	int line;
+};
+
+static unsigned long zoom_computed;
+static unsigned long zoom_reused;
+static unsigned long zoom_repainted;
+
+void mandel_zoom_stats(unsigned long *computed, unsigned long *reused,
+	unsigned long *repainted)
+{
+	*computed = __sync_fetch_and_add(&zoom_computed, 0);
+	*reused = __sync_fetch_and_add(&zoom_reused, 0);
+	*repainted = __sync_fetch_and_add(&zoom_repainted, 0);
+}
+
+/* Compute or reuse line of the frame, then color and encode it */
+static void zoom_line_task(void *arg)
+{
+	struct zoom_line *zl = arg;
+	struct zoom *zoom = zl->zoom;
+	int line = zl->line, dl = line - y_chars / 2, dc, col, n = 0, i;
+	int *iter = &zoom->iter[line * x_chars];
+	int *color = &zoom->color[line * x_chars];
+	int *prev_color = &zoom->prev_color[line * x_chars];
+	double xs[x_chars], ys[x_chars];
+	int at[x_chars], computed[x_chars];
+	unsigned long repainted = 0;
+
+	for (col = 0; col < x_chars; col++) {
+		dc = col - x_chars / 2;
+		if (!zoom->first && dl % 2 == 0 && dc % 2 == 0) {
+			iter[col] = zoom->prev_iter[(dl / 2 + y_chars / 2) *
+				x_chars + dc / 2 + x_chars / 2];
+			continue;
+		}
+		xs[n] = zoom->cx + dc * zoom->sx;
+		ys[n] = zoom->cy - dl * zoom->sy;
+		at[n++] = col;
+	}
+	if (n > 0) {
+		mandel_iterations_batch(xs, ys, n, max_iteration,
+			computed);
+		for (i = 0; i < n; i++)
+			iter[at[i]] = computed[i];
+	}
+
+	for (col = 0; col < x_chars; col++) {
+		color[col] = xterm_color(iter[col]);
+		repainted += zoom->first || color[col] != prev_color[col];
+	}
+	if (zoom->first)
+		xterm_frame_line(zoom->screen, line, color);
+	else
+		xterm_frame_line_diff(zoom->screen, line, color, prev_color);
+
+	__sync_fetch_and_add(&zoom_computed, n);
+	__sync_fetch_and_add(&zoom_reused, x_chars - n);
+	__sync_fetch_and_add(&zoom_repainted, repainted);
+	free(zl);
+}
+
+static void zoom_write(int fd, const char *s)
+{
+	if (insist_write(fd, s, strlen(s)) < 0) {
+		perror("render_mandel_zoom: write");
+		exit(1);
+	}
+}
+
+void render_mandel_zoom(struct pool *pool, int fd, double cx, double cy,
+	int frames)
+{
+	struct zoom zoom;
+	struct zoom_line *zl;
+	char buf[64];
+	int *swap;
+	int frame, line;
+
+	zoom.cx = cx;
+	zoom.cy = cy;
+	zoom.sx = xstep;
+	zoom.sy = ystep;
+	zoom.first = 1;
+	zoom.iter = safe_malloc(x_chars * y_chars * sizeof(int));
+	zoom.prev_iter = safe_malloc(x_chars * y_chars * sizeof(int));
+	zoom.color = safe_malloc(x_chars * y_chars * sizeof(int));
+	zoom.prev_color = safe_malloc(x_chars * y_chars * sizeof(int));
+	if ((zoom.screen = xterm_frame_create(x_chars, y_chars)) == NULL) {
+		fprintf(stderr, "Out of memory, failed to allocate a frame\n");
+		exit(1);
+	}
+
+	/* Clear the screen and draw from the top left */
+	zoom_write(fd, "\033[2J\033[H");
+	for (frame = 0; frame < frames; frame++) {
+		for (line = 0; line < y_chars; line++) {
+			zl = safe_malloc(sizeof(*zl));
+			zl->zoom = &zoom;
+			zl->line = line;
+			pool_submit(pool, zoom_line_task, zl);
+		}
+		pool_wait(pool);
+		xterm_frame_write(fd, zoom.screen, 0, y_chars);
+
+		swap = zoom.prev_iter;
+		zoom.prev_iter = zoom.iter;
+		zoom.iter = swap;
+		swap = zoom.prev_color;
+		zoom.prev_color = zoom.color;
+		zoom.color = swap;
+		zoom.sx /= 2;
+		zoom.sy /= 2;
+		zoom.first = 0;
+	}
+	snprintf(buf, sizeof(buf), "\033[%d;1H", y_chars + 1);
+	zoom_write(fd, buf);
+
+	xterm_frame_destroy(zoom.screen);
+	free(zoom.prev_color);
+	free(zoom.color);
+	free(zoom.prev_iter);
+	free(zoom.iter);
+}
@@ -0,0 +1,28 @@
+/*
+ * mandel-zoom.h
+ *
+ * Animated zoom toward a point: every frame halves the pixel
+ * spacing, reuses the pixels of the previous frame that land on the
+ * same points, and only repaints the cells whose color changed.
+ *
+ */
+
+#ifndef MANDEL_ZOOM_H__
+#define MANDEL_ZOOM_H__
+
+#include "mandel-pool.h"
+
+/*
+ * Play frames frames of a zoom centered on (cx, cy) to fd, the first
+ * one at the pixel spacing xstep, ystep, running every line as a task
+ * on pool. The screen is cleared first, and the cursor left below
+ * the frame at the end.
+ */
+void render_mandel_zoom(struct pool *pool, int fd, double cx, double cy,
+	int frames);
+
+/* Pixels computed and reused from the previous frame, cells repainted */
+void mandel_zoom_stats(unsigned long *computed, unsigned long *reused,
+	unsigned long *repainted);
+
+#endif /* MANDEL_ZOOM_H__ */
@@ -12,19 +12,35 @@
 #include <math.h>
 #include <stdlib.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <signal.h>
 #include <errno.h>
+#include <time.h>
 #include "mandel-lib.h"
-
-#define MANDEL_MAX_ITERATION 100000
+#include "mandel-render.h"
+#include "mandel-cache.h"
+#include "mandel-store.h"
+#include "mandel.h"
+#include "mandel-pool.h"
+#include "mandel-rect.h"
+#include "mandel-sym.h"
+#include "mandel-field.h"
+#include "mandel-dist.h"
+#include "mandel-plan.h"
+#include "mandel-tile.h"
+#include "mandel-prog.h"
+#include "mandel-zoom.h"
+#include "mandel-pan.h"
+#include "mandel-image.h"
+#include "mandel-daemon.h"
+#include "mandel-steal.h"
+#include "mandel-ring.h"
 
 /***************************
  * Compile-time parameters *
  ***************************/
 
 /*
- * Output at the terminal is is x_chars wide by y_chars long
+ * Output at the terminal is is x_chars wide by y_chars long (see -g)
 */
 int y_chars = 50;
 int x_chars = 90;
@@ -32,6 +48,7 @@ int x_chars = 90;
 /*
  * The part of the complex plane to be drawn:
  * upper left corner is (xmin, ymax), lower right corner is (xmax, ymin)
+ * (see -v)
 */
 double xmin = -1.8, xmax = 1.0;
 double ymin = -1.0, ymax = 1.0;
@@ -43,9 +60,48 @@ double ymin = -1.0, ymax = 1.0;
 double xstep;
 double ystep;
 
-sem_t *semaphore;
+/*
+ * The x coordinate of every column, precomputed once
+ * so that all render modes agree on where each pixel is.
+ */
+double *xcoord;
+
+/*
+ * In deep zoom mode (-d), the frame is centered on the point
+ * (deep_cx, deep_cy), known in double-double precision, and every
+ * pixel is computed as a perturbation of the reference orbit of
+ * that point. Otherwise deep_orbit is NULL.
+ */
+mandel_dd deep_cx, deep_cy;
+struct mandel_orbit *deep_orbit;
+int deep_zoom;
+
+/*
+ * With -p, the arithmetic to iterate in (see mandel_pick_precision()),
+ * in place of plain double or, with -d, perturbation. Otherwise -1.
+ */
+int precision = -1;
+
 int num_threads;
 
+/* Set with -i */
+int max_iteration = MANDEL_MAX_ITERATION;
+
+/*
+ * With -s, mirror[line] is the line that line is a mirror image of,
+ * or -1 if it has to be computed (see mandel-sym.h). Without -s it is NULL.
+ * In the lines modes, sym_colors[] keeps the color values of every line
+ * drawn so far, for its mirror image to copy.
+ */
+int *mirror;
+int *sym_colors;
+
+/* Tile width and height of the tile mode, see mandel-tile.h */
+int tile_size = 16;
+
+/* Per-thread busy and idle time of the lines, steal, plan and tile modes */
+struct thread_stats *thread_stats;
+
 /* case: usage of ctrl C*/
 void sigint_handler(int signum) {
 	reset_xterm_color(1);
@@ -74,106 +130,1267 @@ void *safe_malloc(size_t size)
 	return p;
 }
 
+double wall_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * This function computes the iteration counts of n pixels,
+ * starting at (line, col) and moving by (dline, dcol) each time.
+ */
+void compute_mandel_run(int line, int col, int dline, int dcol, int n,
+	int iter[])
+{
+	double xs[n], ys[n];
+	int i;
+
+	if (deep_zoom || precision == MANDEL_LONG_DOUBLE ||
+	    precision == MANDEL_DOUBLE_DOUBLE) {
+		/* Offsets from the center of the frame */
+		for (i = 0; i < n; i++) {
+			xs[i] = (col + i * dcol - x_chars / 2) * xstep;
+			ys[i] = (y_chars / 2 - line - i * dline) * ystep;
+		}
+		if (deep_orbit)
+			mandel_perturbed_batch(deep_orbit, xs, ys, n,
+				max_iteration, iter);
+		else
+			mandel_iterations_tiered(precision, deep_cx, deep_cy,
+				xs, ys, n, max_iteration, iter);
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		xs[i] = xcoord[col + i * dcol];
+		ys[i] = ymax - ystep * (line + i * dline);
+	}
+
+	if (precision == MANDEL_FLOAT)
+		mandel_iterations_batch_float(xs, ys, n, max_iteration,
+			iter);
+	else if (precision == MANDEL_FIXED)
+		mandel_iterations_batch_fixed(xs, ys, n, max_iteration,
+			iter);
+	else
+		mandel_iterations_batch(xs, ys, n, max_iteration, iter);
+}
+
+/*
+ * This function turns an array of x_char iteration counts
+ * into an array of x_char color values.
+ */
+void color_mandel_line(const int iter[], int color_val[])
+{
+	int n;
+	int val;
+
+	for (n = 0; n < x_chars; n++) {
+		val = iter[n];
+		if (val > 255)
+			val = 255;
+		color_val[n] = xterm_color(val);
+	}
+}
+
 /*
  * This function computes a line of output
  * as an array of x_char color values.
  */
 void compute_mandel_line(int line, int color_val[])
+{
+	compute_mandel_run(line, 0, 0, 1, x_chars, color_val);
+	color_mandel_line(color_val, color_val);
+}
+
+struct xterm_frame *create_mandel_screen(void)
+{
+	struct xterm_frame *screen;
+
+	if ((screen = xterm_frame_create(x_chars, y_chars)) == NULL) {
+		fprintf(stderr, "Out of memory, failed to allocate a frame\n");
+		exit(1);
+	}
+	return screen;
+}
+
+/*
+ * This function outputs a whole frame of iteration counts,
+ * encoded into one buffer and written at once.
+ */
+void output_mandel_frame(int fd, const int frame[])
+{
+	struct xterm_frame *screen = create_mandel_screen();
+	int line;
+	int color_val[x_chars];
+
+	for (line = 0; line < y_chars; line++) {
+		color_mandel_line(&frame[line * x_chars], color_val);
+		xterm_frame_line(screen, line, color_val);
+	}
+	xterm_frame_write(fd, screen, 0, y_chars);
+	xterm_frame_destroy(screen);
+}
+
+/*
+ * Lines are output in order through a reorder ring (see mandel-ring.h):
+ * workers compute line i into line_buffer(i) and publish it, then
+ * move on right away, while a drain thread outputs the lines in the
+ * background. With -s, lines are computed into sym_colors[] instead,
+ * so that their mirror images can still copy them when output.
+ *
+ * The drain thread encodes lines into screen as they come, and only
+ * writes them out when it has caught up with the workers: every
+ * batch of lines ready by then goes out with a single writev().
+ *
+ * The ring has a slot for every line of the frame, which costs no
+ * more than the frame itself, so that no worker ever waits for the
+ * output to catch up, however far ahead of it its lines are.
+ */
+
+struct mandel_ring *ring;
+struct xterm_frame *screen;
+int screen_written;		/* Lines of screen written out so far */
+
+int *line_buffer(int i)
+{
+	return mirror ? &sym_colors[i * x_chars] : ring_slot(ring, i);
+}
+
+void emit_mandel_line(void *arg, int i, int buf[])
 {
 	/*
-	 * x and y traverse the complex plane.
+	 * A mirrored line comes after its source line,
+	 * which has been output, hence computed, by now.
 	 */
-	double x, y;
+	if (mirror)
+		buf = &sym_colors[(mirror[i] >= 0 ? mirror[i] : i) * x_chars];
+	xterm_frame_line(screen, i, buf);
+}
 
-	int n;
-	int val;
+void flush_mandel_lines(void *arg, int i)
+{
+	xterm_frame_write(1, screen, screen_written, i - screen_written);
+	screen_written = i;
+}
 
-	/* Find out the y value corresponding to this line */
-	y = ymax - ystep * line;
+void start_mandel_output(void)
+{
+	screen = create_mandel_screen();
+	screen_written = 0;
+	if (mirror) {
+		sym_colors = safe_malloc(x_chars * y_chars * sizeof(int));
+		/* Slots only carry the order; lines are in sym_colors */
+		ring = ring_create(y_chars, 0, y_chars,
+			emit_mandel_line, flush_mandel_lines, NULL);
+	} else {
+		ring = ring_create(y_chars, x_chars, y_chars,
+			emit_mandel_line, flush_mandel_lines, NULL);
+	}
+}
 
-	/* and iterate for all points on this line */
-	for (x = xmin, n = 0; n < x_chars; x+= xstep, n++) {
+void finish_mandel_output(void)
+{
+	ring_finish(ring);
+	xterm_frame_destroy(screen);
+	free(sym_colors);
+	sym_colors = NULL;
+}
 
-		/* Compute the point's color value */
-		val = mandel_iterations_at_point(x, y, MANDEL_MAX_ITERATION);
-		if (val > 255)
-			val = 255;
+void *compute_and_output_mandel_line(void *thr)
+{
+	int i;
+	
+	int *row;
+	struct thread_stats *st = &thread_stats[(int)(uintptr_t)thr];
+	double start = wall_time(), t0;
+	
+	for(i=(int)(uintptr_t)thr; i<y_chars; i+=num_threads) {
+		row = line_buffer(i);
+		if (!mirror || mirror[i] < 0) {
+			t0 = wall_time();
+			compute_mandel_line(i, row);
+			st->busy += wall_time() - t0;
+			st->lines++;
+		}
+		ring_publish(ring, i);
+	}
+	st->idle = wall_time() - start - st->busy;
+	return NULL;
+}
 
-		/* And store it in the color_val[] array */
-		val = xterm_color(val);
-		color_val[n] = val;
+/*
+ * In stream mode, every thread feeds the pixels of its lines to
+ * mandel_iterations_stream() one after the other, instead of one line
+ * at a time, so SIMD lanes freed by escaping pixels are refilled from
+ * the next line on. Pixels finish out of order; stream_pending[i]
+ * counts those of line i still being iterated, and a thread publishes
+ * its lines as they complete, in order.
+ */
+int *stream_frame;
+int *stream_pending;
+
+struct line_stream {
+	int line, col;		/* Next pixel to hand out */
+	int out;		/* Next line to publish */
+};
+
+int next_mandel_pixel(void *arg, double *x, double *y)
+{
+	struct line_stream *ls = arg;
+
+	while (ls->line < y_chars) {
+		if (ls->col < x_chars && (!mirror || mirror[ls->line] < 0)) {
+			*x = xcoord[ls->col];
+			*y = ymax - ystep * ls->line;
+			return ls->line * x_chars + ls->col++;
+		}
+		ls->line += num_threads;
+		ls->col = 0;
 	}
+	return -1;
 }
 
 /*
- * This function outputs an array of x_char color values
- * to a 256-color xterm.
+ * Publish every complete line of this thread, up to the first one
+ * still being iterated.
  */
-void output_mandel_line(int fd, int color_val[])
+void flush_mandel_stream(struct line_stream *ls)
 {
-	int i;
-	
-	char point ='@';
-	char newline='\n';
-
-	for (i = 0; i < x_chars; i++) {
-		/* Set the current color, then output the point */
-		set_xterm_color(fd, color_val[i]);
-		if (write(fd, &point, 1) != 1) {
-			perror("compute_and_output_mandel_line: write point");
+	for (; ls->out < y_chars && !stream_pending[ls->out];
+	     ls->out += num_threads) {
+		if (!mirror || mirror[ls->out] < 0)
+			color_mandel_line(&stream_frame[ls->out * x_chars],
+				line_buffer(ls->out));
+		ring_publish(ring, ls->out);
+	}
+}
+
+void done_mandel_pixel(void *arg, int id, int iter)
+{
+	stream_frame[id] = iter;
+	if (--stream_pending[id / x_chars] == 0)
+		flush_mandel_stream(arg);
+}
+
+void *stream_and_output_mandel_lines(void *thr)
+{
+	struct line_stream ls;
+
+	ls.line = ls.out = (int)(uintptr_t)thr;
+	ls.col = 0;
+	mandel_iterations_stream(next_mandel_pixel, done_mandel_pixel, &ls,
+		max_iteration);
+	/* Lines that were all mirrored may be left */
+	flush_mandel_stream(&ls);
+	return NULL;
+}
+
+/*
+ * Render the frame one line at a time, line i on thread i % num_threads,
+ * with thread_fn on every thread.
+ */
+void render_mandel_lines(void *(*thread_fn)(void *))
+{
+	int i, ret;
+
+	start_mandel_output();
+
+	pthread_t thread[num_threads];
+	for (i = 0; i < num_threads; i++) {
+		ret = pthread_create(&thread[i], NULL, thread_fn, (void*)(uintptr_t)i);
+		if (ret) {
+			perror("pthread_create error");
 			exit(1);
 		}
 	}
 
-	/* Now that the line is done, output a newline character */
-	if (write(fd, &newline, 1) != 1) {
-		perror("compute_and_output_mandel_line: write newline");
-		exit(1);
+	for (i = 0; i < num_threads; i++) {
+		ret = pthread_join(thread[i], NULL);
+		if (ret) {
+			perror("pthread_join error");
+		}
 	}
+
+	finish_mandel_output();
 }
 
-void *compute_and_output_mandel_line(void *thr)
+/*
+ * In steal mode, lines are computed in any order, by whichever thread
+ * gets to them (see mandel-steal.h).
+ */
+double steal_mandel_lines(void *arg, int thread, int first, int last)
+{
+	double busy = 0, t0;
+	int line, *row;
+
+	for (line = first; line <= last; line++) {
+		if (!mirror || mirror[line] < 0) {
+			row = line_buffer(line);
+			t0 = wall_time();
+			compute_mandel_line(line, row);
+			busy += wall_time() - t0;
+		}
+		ring_publish(ring, line);
+	}
+	return busy;
+}
+
+/* Render the frame with work stealing, one line at a time */
+void render_mandel_steal(void)
+{
+	start_mandel_output();
+	steal_run(num_threads, y_chars, 1, steal_mandel_lines, NULL,
+		thread_stats);
+	finish_mandel_output();
+}
+
+/*
+ * Report the busy and idle time of every thread. A frame only scales
+ * with the number of threads if none of them is idle for long.
+ */
+void report_thread_stats(void)
 {
-	/*
-	 * A temporary array, used to hold color values for the line being drawn
-	 */
-	int color_val[x_chars];
 	int i;
-	
-	for(i=(int)thr; i<y_chars; i+=num_threads) {
-		//printf("%d %d\n", (int)thr, i);
-		compute_mandel_line(i, color_val);
-		if (sem_wait(&semaphore[i%num_threads]) < 0) {
-			perror("sem_wait error");
+
+	for (i = 0; i < num_threads; i++)
+		fprintf(stderr, "Thread %d: busy %.3f s, idle %.3f s, "
+			"%lu lines, %lu steals\n", i, thread_stats[i].busy,
+			thread_stats[i].idle, thread_stats[i].lines,
+			thread_stats[i].steals);
+}
+
+/*
+ * Render the frame in stream mode (see stream_frame above),
+ * and report how busy the SIMD lanes were kept.
+ */
+void render_mandel_stream(void)
+{
+	unsigned long long busy, slots;
+	int i;
+
+	stream_frame = safe_malloc(x_chars * y_chars * sizeof(int));
+	stream_pending = safe_malloc(y_chars * sizeof(int));
+	for (i = 0; i < y_chars; i++)
+		stream_pending[i] = mirror && mirror[i] >= 0 ? 0 : x_chars;
+
+	render_mandel_lines(stream_and_output_mandel_lines);
+
+	free(stream_pending);
+	free(stream_frame);
+
+	mandel_stream_stats(&busy, &slots);
+	fprintf(stderr, "Stream: %llu of %llu lane iterations busy (%.1f%%, SIMD: %s)\n",
+		busy, slots, slots ? 100.0 * busy / slots : 100.0,
+		mandel_simd_name());
+}
+
+/*
+ * Render the whole frame with render_band() on a pool of
+ * num_threads threads, one band of lines at a time, then output it.
+ */
+void render_mandel_bands(void (*render_band)(struct pool *pool,
+	int frame[], int first, int last))
+{
+	struct pool *pool;
+	int *frame;
+	int first, last;
+
+	frame = safe_malloc(x_chars * y_chars * sizeof(int));
+	pool = pool_create(num_threads);
+	if (!mirror) {
+		render_band(pool, frame, 0, y_chars - 1);
+	} else {
+		/* Render every band of lines that is not mirrored */
+		for (first = 0; first < y_chars; first = last + 1) {
+			last = first;
+			if (mirror[first] >= 0)
+				continue;
+			while (last + 1 < y_chars && mirror[last + 1] < 0)
+				last++;
+			render_band(pool, frame, first, last);
+		}
+		mirror_mandel_frame(frame, mirror);
+	}
+	pool_destroy(pool);
+
+	output_mandel_frame(1, frame);
+	free(frame);
+}
+
+/* Render the whole frame with Mariani-Silver subdivision */
+void render_mandel_rects(void)
+{
+	unsigned long computed, filled;
+
+	render_mandel_bands(render_mandel_rect);
+
+	mandel_rect_stats(&computed, &filled);
+	fprintf(stderr, "Computed %lu pixels, filled %lu pixels\n",
+		computed, filled);
+}
+
+/*
+ * Render the whole frame in chunks of contiguous lines, cut
+ * to equal cost by a coarse preview, one per thread.
+ */
+void render_mandel_planned(void)
+{
+	unsigned long previewed;
+
+	render_mandel_bands(render_mandel_plan);
+
+	mandel_plan_stats(&previewed);
+	fprintf(stderr, "Previewed %lu pixels to plan the chunks\n",
+		previewed);
+	report_thread_stats();
+}
+
+/* Render the whole frame in tiles, taken in Morton order */
+void render_mandel_tiled(void)
+{
+	render_mandel_bands(render_mandel_tiles);
+	report_thread_stats();
+}
+
+/*
+ * Render the frame progressively, coarse to fine (see mandel-prog.h),
+ * refining it for at most budget seconds after the first pass.
+ */
+void render_mandel_progressive(double budget)
+{
+	struct pool *pool;
+	int passes;
+
+	pool = pool_create(num_threads);
+	passes = render_mandel_prog(pool, budget);
+	pool_destroy(pool);
+
+	if (passes < 4)
+		fprintf(stderr, "Progressive: out of time after %d passes\n",
+			passes);
+}
+
+/* Play a zoom toward (cx, cy), see mandel-zoom.h */
+void render_mandel_zooming(double cx, double cy, int frames)
+{
+	unsigned long computed, reused, repainted;
+	struct pool *pool;
+	double start = wall_time(), t;
+
+	pool = pool_create(num_threads);
+	render_mandel_zoom(pool, 1, cx, cy, frames);
+	pool_destroy(pool);
+	t = wall_time() - start;
+
+	mandel_zoom_stats(&computed, &reused, &repainted);
+	fprintf(stderr, "Zoom: %d frames in %.3f s, %.1f frames/s\n"
+		"  computed %lu pixels, reused %lu, repainted %lu cells of %lu\n",
+		frames, t, frames / t, computed, reused, repainted,
+		(unsigned long)frames * x_chars * y_chars);
+}
+
+/*
+ * Play a pan by (dx, dy) pixels a frame, see mandel-pan.h,
+ * with a tile cache of budget bytes, backed by the tile store
+ * in file path unless it is NULL.
+ */
+void render_mandel_panning(int dx, int dy, int frames, size_t budget,
+	const char *path)
+{
+	struct mandel_cache_stats st;
+	struct mandel_store_stats sst;
+	struct mandel_cache *cache;
+	struct mandel_store *store = NULL;
+	struct mandel_ctx *ctx;
+	struct pool *pool;
+	double start, t;
+
+	if ((ctx = mandel_ctx_create(MANDEL_DOUBLE, NULL)) == NULL ||
+	    (cache = mandel_cache_create(budget)) == NULL) {
+		fprintf(stderr, "Out of memory, failed to allocate a cache\n");
+		exit(1);
+	}
+	if (path) {
+		if ((store = mandel_store_open(path)) == NULL) {
+			perror(path);
 			exit(1);
 		}
-		output_mandel_line(1, color_val);
-		if (sem_post(&semaphore[(i+1)%num_threads]) < 0) {
-			perror("sem_post error");
+		mandel_cache_set_store(cache, store);
+	}
+	start = wall_time();
+	pool = pool_create(num_threads);
+	render_mandel_pan(pool, ctx, cache, 1, dx, dy, frames);
+	pool_destroy(pool);
+	t = wall_time() - start;
+
+	mandel_cache_stats(cache, &st);
+	fprintf(stderr, "Pan: %d frames in %.3f s, %.1f frames/s\n"
+		"  cache: %llu hits, %llu misses, %llu evictions, "
+		"%zu tiles in %zu bytes\n",
+		frames, t, frames / t, st.hits, st.misses, st.evictions,
+		st.tiles, st.bytes);
+	mandel_cache_destroy(cache);
+	mandel_ctx_destroy(ctx);
+
+	if (store) {
+		mandel_store_stats(store, &sst);
+		fprintf(stderr, "  store: %llu hits, %llu misses, "
+			"%llu inserts, %zu tiles in %zu bytes\n",
+			sst.hits, sst.misses, sst.inserts, sst.tiles,
+			sst.bytes);
+		if (mandel_store_close(store) < 0) {
+			perror(path);
 			exit(1);
 		}
 	}
-	return NULL;
+}
+
+/*
+ * Serve frames to clients on the socket at path, see mandel-daemon.h,
+ * with a tile cache of budget bytes, backed by the tile store in file
+ * store_path unless it is NULL.
+ */
+void render_mandel_serving(const char *path, size_t budget,
+	const char *store_path)
+{
+	struct mandel_cache_stats st;
+	struct mandel_cache *cache;
+	struct mandel_store *store = NULL;
+	struct mandel_ctx *ctx;
+	struct pool *pool;
+
+	if ((ctx = mandel_ctx_create(MANDEL_DOUBLE, NULL)) == NULL ||
+	    (cache = mandel_cache_create(budget)) == NULL) {
+		fprintf(stderr, "Out of memory, failed to allocate a cache\n");
+		exit(1);
+	}
+	if (store_path) {
+		if ((store = mandel_store_open(store_path)) == NULL) {
+			perror(store_path);
+			exit(1);
+		}
+		mandel_cache_set_store(cache, store);
+	}
+	pool = pool_create(num_threads);
+	render_mandel_daemon(pool, ctx, cache, path);
+	pool_destroy(pool);
+
+	mandel_cache_stats(cache, &st);
+	fprintf(stderr, "  cache: %llu hits, %llu misses, %llu evictions, "
+		"%zu tiles in %zu bytes\n", st.hits, st.misses, st.evictions,
+		st.tiles, st.bytes);
+	mandel_cache_destroy(cache);
+	mandel_ctx_destroy(ctx);
+	if (store && mandel_store_close(store) < 0) {
+		perror(store_path);
+		exit(1);
+	}
+}
+
+/*
+ * Ask the daemon on the socket at path for the frame, snapped to
+ * the tile grid, and draw it.
+ */
+void render_mandel_query(const char *path)
+{
+	struct mandel_viewport vp = { xmin, xmax, ymin, ymax,
+		x_chars, y_chars, max_iteration };
+	struct mandel_daemon_request req;
+	struct mandel_grid_view view;
+	double start = wall_time();
+	int *iter;
+	int sock;
+
+	mandel_grid_snap(&vp, &view);
+	memset(&req, 0, sizeof(req));
+	req.what = MANDEL_DAEMON_ITERATIONS;
+	req.zoom = view.zoom;
+	req.px = view.px;
+	req.py = view.py;
+	req.width = view.width;
+	req.height = view.height;
+	req.max_iteration = view.max_iteration;
+
+	iter = safe_malloc(x_chars * y_chars * sizeof(int));
+	if ((sock = mandel_daemon_connect(path)) < 0 ||
+	    mandel_daemon_query(sock, &req, iter) < 0) {
+		perror(path);
+		exit(1);
+	}
+	close(sock);
+	fprintf(stderr, "Query: %dx%d frame in %.3f s\n",
+		x_chars, y_chars, wall_time() - start);
+
+	output_mandel_frame(1, iter);
+	free(iter);
+}
+
+/* Render the frame into an image file, see mandel-image.h */
+void render_mandel_image_file(const char *path)
+{
+	struct pool *pool;
+	double start = wall_time(), t;
+
+	pool = pool_create(num_threads);
+	render_mandel_image(pool, path);
+	pool_destroy(pool);
+	t = wall_time() - start;
+
+	fprintf(stderr, "Image: %dx%d pixels to %s in %.3f s, "
+		"%.2f Mpixels/s\n", x_chars, y_chars, path, t,
+		(double)x_chars * y_chars / t / 1e6);
+}
+
+/*
+ * Parse the argument of -v, XMIN,XMAX,YMIN,YMAX, into the viewport.
+ * Returns -1 if it is invalid.
+ */
+int parse_viewport(const char *s)
+{
+	double x0, x1, y0, y1;
+	char c;
+
+	if (sscanf(s, "%lf,%lf,%lf,%lf%c", &x0, &x1, &y0, &y1, &c) != 4 ||
+	    !(x0 < x1) || !(y0 < y1))
+		return -1;
+	xmin = x0;
+	xmax = x1;
+	ymin = y0;
+	ymax = y1;
+	return 0;
+}
+
+/*
+ * Parse the argument of -z, RE,IM[,FRAMES], into
+ * *cx, *cy and *frames. Returns -1 if it is invalid.
+ */
+int parse_zoom(const char *s, double *cx, double *cy, int *frames)
+{
+	char c;
+	int n;
+
+	n = sscanf(s, "%lf,%lf,%d%c", cx, cy, frames, &c);
+	if (n < 2 || n > 3 || (n == 3 && *frames <= 0))
+		return -1;
+	return 0;
+}
+
+/*
+ * Parse the argument of -a, DX,DY[,FRAMES], into
+ * *dx, *dy and *frames. Returns -1 if it is invalid.
+ */
+int parse_pan(const char *s, int *dx, int *dy, int *frames)
+{
+	char c;
+	int n;
+
+	n = sscanf(s, "%d,%d,%d%c", dx, dy, frames, &c);
+	if (n < 2 || n > 3 || (n == 3 && *frames <= 0))
+		return -1;
+	return 0;
+}
+
+/*
+ * Row interleaving without output, for the benchmark: task i
+ * computes lines first + i, first + i + num_threads, ...
+ */
+struct interleave_task {
+	int *frame;
+	int first, last;
+	int i;
+};
+
+void interleave_lines_task(void *arg)
+{
+	struct interleave_task *it = arg;
+	int line;
+
+	for (line = it->first + it->i; line <= it->last; line += num_threads)
+		compute_mandel_run(line, 0, 0, 1, x_chars,
+			&it->frame[line * x_chars]);
+}
+
+void render_mandel_interleaved(struct pool *pool, int frame[],
+	int first, int last)
+{
+	struct interleave_task it[num_threads];
+	int i;
+
+	for (i = 0; i < num_threads; i++) {
+		it[i].frame = frame;
+		it[i].first = first;
+		it[i].last = last;
+		it[i].i = i;
+		pool_submit(pool, interleave_lines_task, &it[i]);
+	}
+	pool_wait(pool);
+}
+
+/*
+ * Time tiles of several sizes against row interleaving on the
+ * x_chars x y_chars frame, without drawing it, and check that
+ * they compute the same frame.
+ */
+void benchmark_mandel_layouts(void)
+{
+	static const int sizes[] = { 8, 16, 32, 64, 128, 256 };
+	int nsizes = sizeof(sizes) / sizeof(sizes[0]);
+	double npixels = (double)x_chars * y_chars;
+	double t_rows, t;
+	int *rows, *tiles, i, diff;
+	long n;
+	struct pool *pool;
+
+	rows = safe_malloc(npixels * sizeof(int));
+	tiles = safe_malloc(npixels * sizeof(int));
+	pool = pool_create(num_threads);
+
+	t = wall_time();
+	render_mandel_interleaved(pool, rows, 0, y_chars - 1);
+	t_rows = wall_time() - t;
+	fprintf(stderr, "Benchmark on %dx%d pixels, %d threads (SIMD: %s):\n"
+		"  rows interleaved: %8.3f s, %8.2f Mpixels/s\n",
+		x_chars, y_chars, num_threads, mandel_simd_name(),
+		t_rows, npixels / t_rows / 1e6);
+
+	for (i = 0; i < nsizes; i++) {
+		tile_size = sizes[i];
+		t = wall_time();
+		render_mandel_tiles(pool, tiles, 0, y_chars - 1);
+		t = wall_time() - t;
+		for (n = 0, diff = 0; n < npixels; n++)
+			diff += tiles[n] != rows[n];
+		fprintf(stderr, "  tiles %3dx%-3d:    %8.3f s, %8.2f Mpixels/s, "
+			"%.2fx rows%s\n", tile_size, tile_size, t,
+			npixels / t / 1e6, t_rows / t,
+			diff ? ", PIXELS DIFFER" : "");
+	}
+
+	pool_destroy(pool);
+	free(tiles);
+	free(rows);
+}
+
+/* Parse WIDTHxHEIGHT, returns -1 if it is not one */
+int parse_geometry(const char *s, int *width, int *height)
+{
+	char c;
+
+	if (sscanf(s, "%dx%d%c", width, height, &c) != 2 ||
+	    *width <= 0 || *height <= 0)
+		return -1;
+	return 0;
+}
+
+/* Render the whole frame, filling disks of exterior pixels */
+void render_mandel_distance(void)
+{
+	unsigned long computed, filled;
+
+	render_mandel_bands(render_mandel_dist);
+
+	mandel_dist_stats(&computed, &filled);
+	fprintf(stderr, "Computed %lu pixels, filled %lu exterior pixels\n",
+		computed, filled);
+}
+
+/*
+ * Render the frame at each of the n increasing iteration limits in
+ * limit[], outputting every one, then at max_iteration. Every
+ * pass carries on from where the previous one left each pixel.
+ */
+void render_mandel_refine(const int limit[], int n)
+{
+	struct mandel_field *field;
+	struct pool *pool;
+	unsigned long long busy, slots, done = 0;
+	unsigned long resumed;
+	int *frame, i, max;
+
+	frame = safe_malloc(x_chars * y_chars * sizeof(int));
+	pool = pool_create(num_threads);
+	field = field_create();
+
+	for (i = 0; i <= n; i++) {
+		max = i < n ? limit[i] : max_iteration;
+		resumed = field_refine(pool, field, max, frame, mirror);
+		output_mandel_frame(1, frame);
+
+		mandel_stream_stats(&busy, &slots);
+		fprintf(stderr, "Refine: max %d, iterated %lu of %d pixels, "
+			"%llu iterations\n", max, resumed, x_chars * y_chars,
+			busy - done);
+		done = busy;
+	}
+
+	field_destroy(field);
+	pool_destroy(pool);
+	free(frame);
+}
+
+/*
+ * Parse the argument of -r, a comma-separated list of increasing
+ * iteration limits, into limit[]. Returns how many there are, or -1
+ * if the argument is invalid. They must also be below max_iteration,
+ * which is checked once all options are in.
+ */
+int parse_refine_limits(char *arg, int limit[], int size)
+{
+	char *tok;
+	int n = 0;
+
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if (n == size || safe_atoi(tok, &limit[n]) < 0 ||
+		    limit[n] <= (n ? limit[n - 1] : 0))
+			return -1;
+		n++;
+	}
+	return n;
+}
+
+/*
+ * Set up deep zoom mode from an argument of the form RE,IM,RADIUS:
+ * the frame is centered on RE + IM i and is 2 * RADIUS high, with the
+ * same aspect ratio as the default viewport. RE and IM may have as
+ * many digits as a double-double can hold.
+ */
+void setup_deep_zoom(char *arg)
+{
+	char *im, *radius;
+	mandel_dd r;
+	double aspect = (xmax - xmin) / (ymax - ymin);
+
+	if (!(im = strchr(arg, ',')) || !(radius = strchr(im + 1, ','))) {
+		fprintf(stderr, "Deep zoom needs RE,IM,RADIUS, not %s\n", arg);
+		exit(1);
+	}
+	*im++ = '\0';
+	*radius++ = '\0';
+	if (mandel_dd_parse(arg, &deep_cx) < 0 ||
+	    mandel_dd_parse(im, &deep_cy) < 0 ||
+	    mandel_dd_parse(radius, &r) < 0 || r.hi <= 0) {
+		fprintf(stderr, "Deep zoom: invalid center or radius\n");
+		exit(1);
+	}
+
+	ystep = 2 * r.hi / y_chars;
+	xstep = 2 * r.hi * aspect / x_chars;
+	xmin = deep_cx.hi - xstep * (x_chars / 2);
+	xmax = xmin + xstep * x_chars;
+	ymax = deep_cy.hi + ystep * (y_chars / 2);
+	ymin = ymax - ystep * y_chars;
+	deep_zoom = 1;
+
+	/* With an explicit precision, pixels are iterated directly */
+	if (precision == -2)
+		precision = mandel_pick_precision(xstep < ystep ? xstep : ystep,
+			max_iteration);
+	if (precision >= 0)
+		return;
+
+	deep_orbit = mandel_reference_orbit(deep_cx, deep_cy,
+		max_iteration);
+	if (!deep_orbit) {
+		fprintf(stderr, "Deep zoom: out of memory for the reference orbit\n");
+		exit(1);
+	}
+	fprintf(stderr, "Deep zoom: reference orbit of %d iterations\n",
+		deep_orbit->len);
+}
+
+/*
+ * Parse the argument of -p. Returns a precision,
+ * -2 for "auto", or -1 if the argument is invalid.
+ */
+int parse_precision(const char *arg)
+{
+	if (!strcmp(arg, "auto"))
+		return -2;
+	if (!strcmp(arg, "float"))
+		return MANDEL_FLOAT;
+	if (!strcmp(arg, "double"))
+		return MANDEL_DOUBLE;
+	if (!strcmp(arg, "long"))
+		return MANDEL_LONG_DOUBLE;
+	if (!strcmp(arg, "dd"))
+		return MANDEL_DOUBLE_DOUBLE;
+	if (!strcmp(arg, "fixed"))
+		return MANDEL_FIXED;
+	return -1;
+}
+
+/*
+ * Compute the whole frame in the calling thread,
+ * returning how long it took in seconds.
+ */
+double time_mandel_frame(int frame[])
+{
+	struct timespec start, end;
+	int line;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (line = 0; line < y_chars; line++)
+		compute_mandel_run(line, 0, 0, 1, x_chars, &frame[line * x_chars]);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/*
+ * Check the arithmetic selected with -p or -d against a reference:
+ * plain double, or double-double for deep zoom views where double
+ * cannot tell pixels apart. Compute the frame both ways and report how
+ * many pixels differ, in iteration count and in color, and how fast
+ * each way was.
+ */
+void compare_mandel_kernels(void)
+{
+	struct mandel_orbit *orbit = deep_orbit;
+	int prec = precision;
+	int *test, *ref, i, npixels = x_chars * y_chars;
+	int iter_diff = 0, color_diff = 0, max_diff = 0, a, b;
+	double t_test, t_ref;
+
+	test = safe_malloc(npixels * sizeof(int));
+	ref = safe_malloc(npixels * sizeof(int));
+
+	t_test = time_mandel_frame(test);
+	deep_orbit = NULL;
+	precision = deep_zoom ? MANDEL_DOUBLE_DOUBLE : -1;
+	t_ref = time_mandel_frame(ref);
+	deep_orbit = orbit;
+	precision = prec;
+
+	for (i = 0; i < npixels; i++) {
+		if (test[i] == ref[i])
+			continue;
+		iter_diff++;
+		if (abs(test[i] - ref[i]) > max_diff)
+			max_diff = abs(test[i] - ref[i]);
+		a = test[i] > 255 ? 255 : test[i];
+		b = ref[i] > 255 ? 255 : ref[i];
+		if (xterm_color(a) != xterm_color(b))
+			color_diff++;
+	}
+
+	fprintf(stderr, "Kernel check on %d pixels (SIMD: %s):\n"
+		"  %d differ in iterations (by up to %d), %d in color\n"
+		"  tested:    %.3f s, %.2f Mpixels/s\n"
+		"  reference: %.3f s, %.2f Mpixels/s (%s)\n",
+		npixels, mandel_simd_name(), iter_diff, max_diff, color_diff,
+		t_test, npixels / t_test / 1e6,
+		t_ref, npixels / t_ref / 1e6,
+		deep_zoom ? "double-double" : "double");
+
+	free(ref);
+	free(test);
+}
+
+void usage(char *argv0)
+{
+	int i;
+
+	fprintf(stderr, "Usage: %s [-s]\n"
+		"       [-m lines|steal|rect|stream|dist|plan|tile|progressive]\n"
+		"       [-d RE,IM,RADIUS] [-p auto|float|double|long|dd|fixed]\n"
+		"       [-c] [-r MAX[,MAX...]] [-P PALETTE] [-t SIZE]\n"
+		"       [-b WIDTHxHEIGHT] [-T SECONDS] [-z RE,IM[,FRAMES]]\n"
+		"       [-g WIDTHxHEIGHT] [-v XMIN,XMAX,YMIN,YMAX] [-i MAX]\n"
+		"       [-o FILE] [-a DX,DY[,FRAMES]] [-C MBYTES] [-S FILE]\n"
+		"       [-D SOCKET] [-Q SOCKET] NTHREADS\n\n"
+		"  -m lines  compute every line on its own (default),\n"
+		"            line i on thread i mod NTHREADS\n"
+		"  -m steal  compute every line on its own, on whichever\n"
+		"            thread gets to it first, with work stealing\n"
+		"  -m rect   Mariani-Silver rectangle subdivision\n"
+		"  -m stream like lines, but streaming the pixels of every\n"
+		"            thread through the SIMD lanes, refilling each\n"
+		"            lane as soon as its pixel is done\n"
+		"  -m plan   compute every thread's share of the frame as\n"
+		"            one chunk of lines, of equal cost according\n"
+		"            to a coarse preview\n"
+		"  -m tile   compute the frame in square tiles (see -t),\n"
+		"            on whichever thread gets to each one first,\n"
+		"            taking them in Morton (Z) order\n"
+		"  -m progressive\n"
+		"            draw the frame at 1/8, 1/4, 1/2 and then full\n"
+		"            resolution, each pass only computing the\n"
+		"            pixels the previous ones did not (see -T)\n"
+		"  -m dist   fill disks of pixels far enough outside the\n"
+		"            set, by distance estimation, with the\n"
+		"            iteration count of their center\n"
+		"  -s        copy lines mirrored across the real axis\n"
+		"            instead of computing them\n"
+		"  -d RE,IM,RADIUS\n"
+		"            deep zoom centered on RE + IM i, RADIUS high,\n"
+		"            using perturbation around a double-double orbit\n"
+		"  -p PREC   iterate in float, double, long double or\n"
+		"            double-double; auto picks the cheapest one\n"
+		"            that resolves the pixel spacing after -i\n"
+		"            iterations; fixed is 32-bit fixed point,\n"
+		"            never picked by auto\n"
+		"  -c        instead of drawing, check the selected\n"
+		"            arithmetic against double and time both\n"
+		"  -r MAX,.. draw the frame at each of these iteration\n"
+		"            limits first, then at the final one, only\n"
+		"            iterating further the pixels still inside\n"
+		"  -t SIZE   tile width and height of -m tile, in pixels\n"
+		"  -g WIDTHxHEIGHT\n"
+		"            size of the frame, 90x50 by default\n"
+		"  -v XMIN,XMAX,YMIN,YMAX\n"
+		"            part of the complex plane to draw, by default\n"
+		"            -1.8,1.0,-1.0,1.0\n"
+		"  -i MAX    iteration limit, 100000 by default\n"
+		"  -o FILE   instead of drawing, write the frame to FILE,\n"
+		"            as a PGM if it ends in .pgm, else a PPM\n"
+		"  -z RE,IM[,FRAMES]\n"
+		"            instead of a single frame, play FRAMES (32 by\n"
+		"            default) frames of a zoom toward RE + IM i, at\n"
+		"            twice the magnification every frame\n"
+		"  -a DX,DY[,FRAMES]\n"
+		"            instead of a single frame, play FRAMES (32 by\n"
+		"            default) frames of a pan by DX, DY pixels a\n"
+		"            frame, over the viewport snapped to a grid of\n"
+		"            tiles, only computing the tiles not cached\n"
+		"  -C MBYTES size of the tile cache of -a, 64 by default\n"
+		"  -S FILE   keep the tiles of -a or -D in FILE as well,\n"
+		"            reusing the ones earlier runs have put there;\n"
+		"            on its own, draw the frame as -a 0,0,1 would\n"
+		"  -D SOCKET instead of drawing, serve frames of the tile\n"
+		"            grid to clients on the Unix socket SOCKET,\n"
+		"            with one tile cache (see -C) for all of them,\n"
+		"            until interrupted\n"
+		"  -Q SOCKET draw the frame, snapped to the tile grid, as\n"
+		"            served by the -D daemon on SOCKET\n"
+		"  -T SECONDS\n"
+		"            stop refining -m progressive after this long,\n"
+		"            past the first pass; no limit by default\n"
+		"  -b WIDTHxHEIGHT\n"
+		"            instead of drawing, time tiles of several\n"
+		"            sizes against row interleaving on a frame\n"
+		"            this big\n"
+		"  -P PALETTE\n"
+		"            color with a built-in palette (",
+		argv0);
+	for (i = 0; mandel_palette_builtin_name(i); i++)
+		fprintf(stderr, "%s%s", i ? ", " : "",
+			mandel_palette_builtin_name(i));
+	fprintf(stderr, "),\n"
+		"            or one loaded from a file of \"RED GREEN BLUE\"\n"
+		"            lines\n");
+	exit(1);
+}
+
+/* Switch to the built-in palette called name, or the one in file name */
+void select_palette(const char *name)
+{
+	const struct mandel_palette *palette;
+
+	if (!(palette = mandel_palette_builtin(name)) &&
+	    !(palette = mandel_palette_load(name))) {
+		perror(name);
+		exit(1);
+	}
+	mandel_palette_use(palette);
 }
 
 int main(int argc, char **argv)
 {
-	int i, ret;
+	int n, opt;
 	sigset_t sigset;
+	double x;
+	char *mode = "lines";
+	int symmetry = 0;
+	char *deep = NULL;
+	int compare = 0;
+	int benchmark = 0;
+	double budget = HUGE_VAL;
+	double zoom_cx, zoom_cy;
+	int zoom_frames = 32;
+	int pan_dx, pan_dy, pan_frames = 32;
+	int cache_mbytes = 64;
+	char *store = NULL;
+	char *socket_path = NULL;
+	char *image = NULL;
+	char c;
+	int limit[16], nlimits = -1;
+
+	while ((opt = getopt(argc, argv, "m:sd:p:cr:P:t:b:T:z:g:v:i:o:a:C:S:D:Q:")) != -1) {
+		switch (opt) {
+		case 'm':
+			mode = optarg;
+			break;
+		case 's':
+			symmetry = 1;
+			break;
+		case 'd':
+			deep = optarg;
+			break;
+		case 'p':
+			if ((precision = parse_precision(optarg)) == -1)
+				usage(argv[0]);
+			break;
+		case 'c':
+			compare = 1;
+			break;
+		case 'r':
+			nlimits = parse_refine_limits(optarg, limit, 16);
+			if (nlimits < 0)
+				usage(argv[0]);
+			mode = "refine";
+			break;
+		case 'P':
+			select_palette(optarg);
+			break;
+		case 't':
+			if (safe_atoi(optarg, &tile_size) < 0 || tile_size <= 0)
+				usage(argv[0]);
+			break;
+		case 'T':
+			if (sscanf(optarg, "%lf%c", &budget, &c) != 1 ||
+			    !(budget >= 0))
+				usage(argv[0]);
+			break;
+		case 'z':
+			if (parse_zoom(optarg, &zoom_cx, &zoom_cy,
+			    &zoom_frames) < 0)
+				usage(argv[0]);
+			mode = "zoom";
+			break;
+		case 'a':
+			if (parse_pan(optarg, &pan_dx, &pan_dy,
+			    &pan_frames) < 0)
+				usage(argv[0]);
+			mode = "pan";
+			break;
+		case 'C':
+			if (safe_atoi(optarg, &cache_mbytes) < 0 ||
+			    cache_mbytes < 0)
+				usage(argv[0]);
+			break;
+		case 'S':
+			store = optarg;
+			break;
+		case 'D':
+			socket_path = optarg;
+			mode = "daemon";
+			break;
+		case 'Q':
+			socket_path = optarg;
+			mode = "query";
+			break;
+		case 'g':
+			if (parse_geometry(optarg, &x_chars, &y_chars) < 0)
+				usage(argv[0]);
+			break;
+		case 'v':
+			if (parse_viewport(optarg) < 0)
+				usage(argv[0]);
+			break;
+		case 'i':
+			if (safe_atoi(optarg, &max_iteration) < 0 ||
+			    max_iteration <= 0)
+				usage(argv[0]);
+			break;
+		case 'o':
+			image = optarg;
+			mode = "image";
+			break;
+		case 'b':
+			if (parse_geometry(optarg, &x_chars, &y_chars) < 0)
+				usage(argv[0]);
+			benchmark = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+	if (nlimits > 0 && limit[nlimits - 1] >= max_iteration)
+		usage(argv[0]);
+	if (safe_atoi(argv[optind], &num_threads) < 0 || num_threads <= 0) {
+		perror("input error");
+		exit(1);
+	}
+
+	/* A single frame only goes through the tile store as a pan of one */
+	if (store && !strcmp(mode, "lines")) {
+		mode = "pan";
+		pan_dx = pan_dy = 0;
+		pan_frames = 1;
+	} else if (store && strcmp(mode, "pan") && strcmp(mode, "daemon")) {
+		fprintf(stderr, "Mode %s does not use the tile store\n", mode);
+		exit(1);
+	}
 
 	xstep = (xmax - xmin) / x_chars;
 	ystep = (ymax - ymin) / y_chars;
-	if (argc != 2) {
-		perror("Incorrect input, please insert only the number of threadsto create");
+
+	/*
+	 * Deep zoom frames are only symmetric when centered on the real
+	 * axis; anywhere else the double viewport is too coarse to tell.
+	 */
+	if (deep) {
+		setup_deep_zoom(deep);
+		if (deep_cy.hi != 0 || deep_cy.lo != 0)
+			symmetry = 0;
+	} else {
+		deep_cx.hi = xmin + xstep * (x_chars / 2);
+		deep_cy.hi = ymax - ystep * (y_chars / 2);
+	}
+
+	if (precision == -2)
+		precision = mandel_pick_precision(xstep < ystep ? xstep : ystep,
+			max_iteration);
+	if (precision >= 0)
+		fprintf(stderr, "Precision: %s\n", mandel_precision_name(precision));
+
+	xcoord = safe_malloc(x_chars * sizeof(double));
+	for (x = xmin, n = 0; n < x_chars; x += xstep, n++)
+		xcoord[n] = x;
+
+	if ((!strcmp(mode, "stream") || !strcmp(mode, "refine") ||
+	     !strcmp(mode, "dist") || !strcmp(mode, "zoom") ||
+	     !strcmp(mode, "pan") || !strcmp(mode, "daemon") ||
+	     !strcmp(mode, "query")) &&
+	    (deep_zoom || (precision >= 0 && precision != MANDEL_DOUBLE))) {
+		fprintf(stderr, "Mode %s only iterates in double\n", mode);
 		exit(1);
 	}
-	if (safe_atoi(argv[1], &num_threads) < 0 || num_threads <= 0) {
-		perror("input error");
+
+	if (symmetry && (!strcmp(mode, "progressive") ||
+	    !strcmp(mode, "zoom") || !strcmp(mode, "pan") ||
+	    !strcmp(mode, "image") || !strcmp(mode, "daemon") ||
+	    !strcmp(mode, "query"))) {
+		fprintf(stderr, "Mode %s does not mirror lines\n", mode);
 		exit(1);
 	}
 
+	thread_stats = safe_malloc(num_threads * sizeof(struct thread_stats));
+	memset(thread_stats, 0, num_threads * sizeof(struct thread_stats));
+
+	if (compare) {
+		compare_mandel_kernels();
+		exit(0);
+	}
+	if (benchmark) {
+		benchmark_mandel_layouts();
+		exit(0);
+	}
+
+	if (symmetry) {
+		mirror = plan_mandel_symmetry();
+		fprintf(stderr, "Symmetry: computing %d of %d lines\n",
+			mandel_symmetry_lines(mirror), y_chars);
+	}
+
 	/*
-	 * draw the Mandelbrot Set, one line at a time.
+	 * draw the Mandelbrot Set.
 	 * Output is sent to file descriptor '1', i.e., standard output.
 	 */
 	
@@ -186,41 +1403,58 @@ int main(int argc, char **argv)
 		perror("sigaction");
 		exit(1);
 	}
-	semaphore= (sem_t*)safe_malloc(num_threads*sizeof(sem_t));
-	if (sem_init(&semaphore[0], 0, 1) < 0) {
-		perror("sem_init error");
-		exit(1);
-	}
-	for (i = 1; i < num_threads; i++) {
-		if (sem_init(&semaphore[i], 0, 0) < 0) {
-			perror("sem_init error");
-			exit(1);
-		}
-	}
 
-	pthread_t thread[num_threads];
-	for (i = 0; i < num_threads; i++) {
-		ret = pthread_create(&thread[i], NULL, compute_and_output_mandel_line, (void*)(uintptr_t)i);
-		if (ret) {
-			perror("pthread_create error");
-			exit(1);
-		}
+	if (!strcmp(mode, "lines")) {
+		render_mandel_lines(compute_and_output_mandel_line);
+		report_thread_stats();
+	} else if (!strcmp(mode, "steal")) {
+		render_mandel_steal();
+		report_thread_stats();
+	} else if (!strcmp(mode, "rect")) {
+		render_mandel_rects();
+	} else if (!strcmp(mode, "stream")) {
+		render_mandel_stream();
+	} else if (!strcmp(mode, "refine")) {
+		render_mandel_refine(limit, nlimits);
+	} else if (!strcmp(mode, "dist")) {
+		render_mandel_distance();
+	} else if (!strcmp(mode, "plan")) {
+		render_mandel_planned();
+	} else if (!strcmp(mode, "tile")) {
+		render_mandel_tiled();
+	} else if (!strcmp(mode, "progressive")) {
+		render_mandel_progressive(budget);
+	} else if (!strcmp(mode, "zoom")) {
+		render_mandel_zooming(zoom_cx, zoom_cy, zoom_frames);
+	} else if (!strcmp(mode, "pan")) {
+		render_mandel_panning(pan_dx, pan_dy, pan_frames,
+			(size_t)cache_mbytes << 20, store);
+	} else if (!strcmp(mode, "daemon")) {
+		render_mandel_serving(socket_path,
+			(size_t)cache_mbytes << 20, store);
+	} else if (!strcmp(mode, "query")) {
+		render_mandel_query(socket_path);
+	} else if (!strcmp(mode, "image")) {
+		render_mandel_image_file(image);
+	} else {
+		usage(argv[0]);
 	}
 
-	for (i = 0; i < num_threads; i++) {
-		ret = pthread_join(thread[i], NULL);
-		if (ret) {
-			perror("pthread_join error");
-		}
-	}
+	free(thread_stats);
+	free(mirror);
+	free(xcoord);
+	if (strcmp(mode, "image"))
+		reset_xterm_color(1);
+	if (deep_orbit) {
+		unsigned long long rebases, glitches;
 
-	for (i = 0; i < num_threads; i++) {
-		if (sem_destroy(&semaphore[i]) < 0) {
-			perror("sem_destroy error");
-			exit(1);
-		}
+		mandel_perturbation_stats(&rebases, &glitches);
+		fprintf(stderr, "Deep zoom: %llu rebases, %llu glitches detected\n",
+			rebases, glitches);
+		mandel_orbit_free(deep_orbit);
 	}
-	free(semaphore);
-	reset_xterm_color(1);
+	fprintf(stderr, "Ran %llu iterations\n", mandel_run_iterations());
+	fprintf(stderr, "Skipped %llu iterations (main bulbs, periodic orbits)\n",
+		mandel_skipped_iterations());
 	return 0;
 }
@@ -0,0 +1,71 @@
+/*
+ * mandel.h
+ *
+ * Parameters and helpers shared by the parts of the
+ * multi-threaded Mandelbrot Set renderer.
+ *
+ */
+
+#ifndef MANDEL_H__
+#define MANDEL_H__
+
+#include <errno.h>
+#include <stdio.h>
+#include <stddef.h>
+
+/* Default iteration limit, see max_iteration */
+#define MANDEL_MAX_ITERATION 100000
+
+/*
+ * POSIX thread functions do not return error numbers in errno,
+ * but in the actual return value of the function call instead.
+ * This macro helps with error reporting in this case.
+ */
+#define perror_pthread(ret, msg) \
+	do { errno = ret; perror(msg); } while (0)
+
+/* Output size, viewport and threads, see mandel.c */
+extern int y_chars;
+extern int x_chars;
+extern double xmin, xmax;
+extern double ymin, ymax;
+extern double xstep;
+extern double ystep;
+extern int num_threads;
+
+/* Iteration limit of every pixel, see mandel.c */
+extern int max_iteration;
+
+/* The x coordinate of every column */
+extern double *xcoord;
+
+/* What a rendering thread did, for reporting load balance */
+struct thread_stats {
+	double busy;		/* Seconds spent computing */
+	double idle;		/* Seconds spent waiting, or looking for work */
+	unsigned long lines;	/* Lines computed */
+	unsigned long steals;	/* Times work was stolen from another thread */
+};
+
+/* One per rendering thread, see mandel.c */
+extern struct thread_stats *thread_stats;
+
+void *safe_malloc(size_t size);
+
+/* Seconds since an arbitrary point, from a monotonic clock */
+double wall_time(void);
+
+/*
+ * Compute the iteration counts of n pixels, starting at
+ * (line, col) and moving by (dline, dcol) from one to the next.
+ */
+void compute_mandel_run(int line, int col, int dline, int dcol, int n,
+	int iter[]);
+
+/*
+ * Output a whole frame of iteration counts,
+ * y_chars lines of x_chars values each.
+ */
+void output_mandel_frame(int fd, const int frame[]);
+
+#endif /* MANDEL_H__ */
@@ -12,10 +12,12 @@
 #include <math.h>
 #include <stdlib.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <signal.h>
 #include <errno.h>
+#include <time.h>
 #include "mandel-lib.h"
+#include "mandel-render.h"
+#include "mandel-ring.h"
 
 #define MANDEL_MAX_ITERATION 100000
 
@@ -36,17 +38,14 @@ double xmin = -1.8, xmax = 1.0;
 double ymin = -1.0, ymax = 1.0;
 	
 /*
- * Every character in the final output is
- * xstep x ystep units wide on the complex plane.
+ * The same, as handed to libmandel, along with
+ * the context every line is rendered in.
  */
-double xstep;
-double ystep;
+struct mandel_viewport viewport;
+struct mandel_ctx *ctx;
 
 int num_threads;
 
-pthread_cond_t cond[7];
-
-
 /* case: usage of ctrl C*/
 void sigint_handler(int signum) {
 	reset_xterm_color(1);
@@ -81,112 +80,71 @@ void *safe_malloc(size_t size)
  */
 void compute_mandel_line(int line, int color_val[])
 {
-	/*
-	 * x and y traverse the complex plane.
-	 */
-	double x, y;
-
-	int n;
-	int val;
-
-	/* Find out the y value corresponding to this line */
-	y = ymax - ystep * line;
-
-	/* and iterate for all points on this line */
-	for (x = xmin, n = 0; n < x_chars; x+= xstep, n++) {
-
-		/* Compute the point's color value */
-		val = mandel_iterations_at_point(x, y, MANDEL_MAX_ITERATION);
-		if (val > 255)
-			val = 255;
-
-		/* And store it in the color_val[] array */
-		val = xterm_color(val);
-		color_val[n] = val;
+	if (mandel_render_lines(ctx, &viewport, line, 1, color_val) < 0) {
+		perror("mandel_render_lines");
+		exit(1);
 	}
+	mandel_render_colors(ctx, color_val, x_chars, color_val);
 }
 
 /*
- * This function outputs an array of x_char color values
- * to a 256-color xterm.
+ * Lines are output in order through a reorder ring (see mandel-ring.h):
+ * every thread computes its lines straight into their ring slots and
+ * publishes them without waiting for the other threads, while a drain
+ * thread outputs them in order in the background. It encodes them
+ * into screen as they come, and whenever it catches up with the
+ * threads, writes all the lines it has so far with one writev().
+ * With a slot for every line of the frame, no thread ever waits for
+ * the output to catch up.
  */
-void output_mandel_line(int fd, int color_val[])
-{
-	int i;
-	
-	char point ='@';
-	char newline='\n';
 
-	for (i = 0; i < x_chars; i++) {
-		/* Set the current color, then output the point */
-		set_xterm_color(fd, color_val[i]);
-		if (write(fd, &point, 1) != 1) {
-			perror("compute_and_output_mandel_line: write point");
-			exit(1);
-		}
-	}
+struct mandel_ring *ring;
+struct xterm_frame *screen;
+int screen_written;		/* Lines of screen written out so far */
 
-	/* Now that the line is done, output a newline character */
-	if (write(fd, &newline, 1) != 1) {
-		perror("compute_and_output_mandel_line: write newline");
-		exit(1);
-	}
+void emit_mandel_line(void *arg, int line, int color_val[])
+{
+	xterm_frame_line(screen, line, color_val);
 }
-pthread_mutex_t condition_mutex[7] = {
-PTHREAD_MUTEX_INITIALIZER,
-PTHREAD_MUTEX_INITIALIZER,
-PTHREAD_MUTEX_INITIALIZER,
-PTHREAD_MUTEX_INITIALIZER,
-PTHREAD_MUTEX_INITIALIZER,
-PTHREAD_MUTEX_INITIALIZER,
-PTHREAD_MUTEX_INITIALIZER
-};
 
-int first=1;
-void *compute_and_output_mandel_line(void *thr)
+void flush_mandel_lines(void *arg, int line)
 {
-	int color_val[x_chars];
-	int i = (int)thr;
-	//int ft=1;
-        while(1) {
-		//printf("1\n");
-		compute_mandel_line(i, color_val);
-		//pthread_cond_signal(&cond[i%num_threads]);
-		pthread_mutex_lock(&condition_mutex[i%num_threads]);
-	
-			printf("Waiting %d\n", (i)%num_threads);
-			printf("%d\n", i);
-			pthread_cond_wait(&cond[i%num_threads],&condition_mutex[i%num_threads]);
-		
-		pthread_mutex_unlock(&condition_mutex[i%num_threads]);
-		//printf("2\n");
-		//if (ft) {
-		//pthread_cond_wait(&cond[i%num_threads],&condition_mutex);
-		//ft=0;
-		//}
-		//printf("3\n");
-		//output_mandel_line(1, color_val);
+	xterm_frame_write(1, screen, screen_written, line - screen_written);
+	screen_written = line;
+}
+
+double wall_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-		printf("Output %d\n", (i)%num_threads);
-		output_mandel_line(1, color_val);
-		//pthread_mutex_lock(&count_mutex);
-		//output_mandel_line(1, color_val);
-		pthread_mutex_lock(&condition_mutex[(i+1)%num_threads]);
+/*
+ * Per-thread time spent computing lines, and time spent
+ * waiting for a ring slot or publishing into it.
+ */
+struct thread_stats {
+	double busy;
+	double idle;
+} *thread_stats;
 
-		printf("Waking %d\n", (i+1)%num_threads);
-		if (pthread_cond_signal(&cond[(i+1)%num_threads]) < 0) {
-			perror("sem_post error");
-			exit(1);
-		}
-		 pthread_mutex_unlock(&condition_mutex[(i+1)%num_threads]);
+void *compute_and_output_mandel_line(void *thr)
+{
+	struct thread_stats *st = &thread_stats[(int)(uintptr_t)thr];
+	double start = wall_time(), t0;
+	int *slot;
+	int i;
 
-		i += num_threads;
-		//if (first)
-		//	first=0;
-		//pthread_mutex_unlock(&count_mutex);
-		if (i >= y_chars) 
-			return NULL;
+	for (i = (int)(uintptr_t)thr; i < y_chars; i += num_threads) {
+		slot = ring_slot(ring, i);
+		t0 = wall_time();
+		compute_mandel_line(i, slot);
+		st->busy += wall_time() - t0;
+		ring_publish(ring, i);
 	}
+	st->idle = wall_time() - start - st->busy;
 	return NULL;
 }
 
@@ -195,8 +153,17 @@ int main(int argc, char **argv)
 	 int i, ret;
         sigset_t sigset;
 
-        xstep = (xmax - xmin) / x_chars;
-        ystep = (ymax - ymin) / y_chars;
+	viewport.xmin = xmin;
+	viewport.xmax = xmax;
+	viewport.ymin = ymin;
+	viewport.ymax = ymax;
+	viewport.width = x_chars;
+	viewport.height = y_chars;
+	viewport.max_iteration = MANDEL_MAX_ITERATION;
+	if ((ctx = mandel_ctx_create(MANDEL_DOUBLE, NULL)) == NULL) {
+		perror("mandel_ctx_create");
+		exit(1);
+	}
         if (argc != 2) {
                 perror("Incorrect input, please insert only the number of threadsto create");
                 exit(1);
@@ -210,7 +177,6 @@ int main(int argc, char **argv)
          * draw the Mandelbrot Set, one line at a time.
          * Output is sent to file descriptor '1', i.e., standard output.
          */
-	//pthread_cond_t cond[num_threads];
         struct sigaction sa;
         sa.sa_handler = sigint_handler;
         sa.sa_flags = 0;
@@ -221,30 +187,15 @@ int main(int argc, char **argv)
                 perror("sigaction");
                 exit(1);
         }
- 	
-	if (pthread_cond_init(&cond[0], NULL) < 0) {
-	         perror("pthread_cond_init error");
-		         exit(1);
-	}
-pthread_mutex_lock(&condition_mutex[0]);
-        pthread_cond_signal(&cond[0]);
-         pthread_mutex_unlock(&condition_mutex[0]);
-
-
-        //for (i = 0; i < num_threads; i++) {
-	//	printf(" m\n");
-	//	condition_mutex[i] = PTHREAD_MUTEX_INITIALIZER;
-	//}
-	//for(i=0; i<num_threads; i++) {
-	//	condition_mutex[i] = PTHREAD_MUTEX_INITIALIZER;
-	//}
 
-	for (i = 1; i < num_threads; i++) {
-    		if (pthread_cond_init(&cond[i], NULL) < 0) {
-        		perror("pthread_cond_init error");
-        		exit(1);
-    		}
-	}	
+	if ((screen = xterm_frame_create(x_chars, y_chars)) == NULL) {
+		fprintf(stderr, "Out of memory, failed to allocate a frame\n");
+		exit(1);
+	}
+	ring = ring_create(y_chars, x_chars, y_chars,
+		emit_mandel_line, flush_mandel_lines, NULL);
+	thread_stats = safe_malloc(num_threads * sizeof(*thread_stats));
+	memset(thread_stats, 0, num_threads * sizeof(*thread_stats));
 
         pthread_t thread[num_threads];
         for (i = 0; i < num_threads; i++) {
@@ -254,7 +205,6 @@ pthread_mutex_lock(&condition_mutex[0]);
                         exit(1);
                 }
         }
-	printf("wake up first\n");
 
         for (i = 0; i < num_threads; i++) {
                 ret = pthread_join(thread[i], NULL);
@@ -262,12 +212,16 @@ pthread_mutex_lock(&condition_mutex[0]);
                         perror("pthread_join error");
                 }
         }
-        for (i = 0; i < num_threads; i++) {
-                if (pthread_cond_destroy(&cond[i]) < 0) {
-                        perror("pthread_cond_destroy error");
-                        exit(1);
-                }
-        }
+	ring_finish(ring);
+	xterm_frame_destroy(screen);
+	mandel_ctx_destroy(ctx);
         reset_xterm_color(1);
+	for (i = 0; i < num_threads; i++)
+		fprintf(stderr, "Thread %d: busy %.3f s, idle %.3f s\n", i,
+			thread_stats[i].busy, thread_stats[i].idle);
+	free(thread_stats);
+	fprintf(stderr, "Ran %llu iterations\n", mandel_run_iterations());
+        fprintf(stderr, "Skipped %llu iterations (main bulbs, periodic orbits)\n",
+                mandel_skipped_iterations());
         return 0;
 }
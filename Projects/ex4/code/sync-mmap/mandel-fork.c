@@ -15,7 +15,10 @@
 #include <semaphore.h>
 #include <signal.h>
 #include <errno.h>
+#include <time.h>
 #include "mandel-lib.h"
+#include "mandel-render.h"
+#include "mandel-lease.h"
 #include <sys/mman.h>
 #include <sys/wait.h>
 #define MANDEL_MAX_ITERATION 100000
@@ -38,11 +41,11 @@ double xmin = -1.8, xmax = 1.0;
 double ymin = -1.0, ymax = 1.0;
 	
 /*
- * Every character in the final output is
- * xstep x ystep units wide on the complex plane.
+ * The same, as handed to libmandel, along with
+ * the context every line is rendered in.
  */
-double xstep;
-double ystep;
+struct mandel_viewport viewport;
+struct mandel_ctx *ctx;
 
 sem_t *semaphore;
 int num_threads;
@@ -81,56 +84,11 @@ void *safe_malloc(size_t size)
  */
 void compute_mandel_line(int line, int color_val[])
 {
-	/*
-	 * x and y traverse the complex plane.
-	 */
-	double x, y;
-
-	int n;
-	int val;
-
-	/* Find out the y value corresponding to this line */
-	y = ymax - ystep * line;
-
-	/* and iterate for all points on this line */
-	for (x = xmin, n = 0; n < x_chars; x+= xstep, n++) {
-
-		/* Compute the point's color value */
-		val = mandel_iterations_at_point(x, y, MANDEL_MAX_ITERATION);
-		if (val > 255)
-			val = 255;
-
-		/* And store it in the color_val[] array */
-		val = xterm_color(val);
-		color_val[n] = val;
-	}
-}
-
-/*
- * This function outputs an array of x_char color values
- * to a 256-color xterm.
- */
-void output_mandel_line(int fd, int color_val[])
-{
-	int i;
-	
-	char point ='@';
-	char newline='\n';
-
-	for (i = 0; i < x_chars; i++) {
-		/* Set the current color, then output the point */
-		set_xterm_color(fd, color_val[i]);
-		if (write(fd, &point, 1) != 1) {
-			perror("compute_and_output_mandel_line: write point");
-			exit(1);
-		}
-	}
-
-	/* Now that the line is done, output a newline character */
-	if (write(fd, &newline, 1) != 1) {
-		perror("compute_and_output_mandel_line: write newline");
+	if (mandel_render_lines(ctx, &viewport, line, 1, color_val) < 0) {
+		perror("mandel_render_lines");
 		exit(1);
 	}
+	mandel_render_colors(ctx, color_val, x_chars, color_val);
 }
 
 void *create_shared_memory_area(unsigned int numbytes)
@@ -171,21 +129,74 @@ void destroy_shared_memory_area(void *addr, unsigned int numbytes) {
 	}
 }
 
+void usage(char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-l] [-c LINES] [-e SECONDS] "
+		"[-p [ADDR:]PORT] NPROCS\n"
+		"       %s -w [HOST:]PORT\n\n"
+		"  -l        instead of NPROCS children in lockstep, lease\n"
+		"            chunks of lines to NPROCS forked workers, and to\n"
+		"            any connecting with -w, taking results in any\n"
+		"            order and leasing a chunk again if its worker\n"
+		"            dies or stalls\n"
+		"  -c LINES  lines in a chunk of -l, 4 by default\n"
+		"  -e SECONDS\n"
+		"            seconds before a lease of -l expires, 5 by\n"
+		"            default\n"
+		"  -p [ADDR:]PORT\n"
+		"            let workers connect to -l over TCP on PORT, of\n"
+		"            127.0.0.1 unless ADDR is given\n"
+		"  -w [HOST:]PORT\n"
+		"            work for the -l coordinator listening there\n",
+		argv0, argv0);
+	exit(1);
+}
+
+double wall_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 void fork_f(int x, int num_threads) {
 	int num;
 	int color_value[x_chars];
+	double start = wall_time(), busy = 0, t0;
+	/* Every line is encoded in full, then output with one writev() */
+	struct xterm_frame *line = xterm_frame_create(x_chars, 1);
+
+	if (!line) {
+		fprintf(stderr, "Out of memory, failed to allocate a line\n");
+		exit(1);
+	}
 	for (num=x; num<y_chars; num+=num_threads) {
+		t0 = wall_time();
 		compute_mandel_line(num, color_value);
+		busy += wall_time() - t0;
+		xterm_frame_line(line, 0, color_value);
 		if(sem_wait(&semaphore[x])<0) {
 			perror("semaphore wait error");
 			exit(1);
 		}
-		output_mandel_line(1, color_value);
+		xterm_frame_write(1, line, 0, 1);
 		 if(sem_post(&semaphore[(num+1) % num_threads])<0) {
 			 perror("sem_post");
 			 exit(1);
 		 }
 	}
+	xterm_frame_destroy(line);
+	/*
+	 * Every child has its own counters, so every child reports them.
+	 * Idle time is mostly spent waiting for its turn to output.
+	 */
+	fprintf(stderr, "Child %d: busy %.3f s, idle %.3f s\n", x,
+		busy, wall_time() - start - busy);
+	fprintf(stderr, "Child %d ran %llu iterations\n", x,
+		mandel_run_iterations());
+	fprintf(stderr, "Child %d skipped %llu iterations (main bulbs, periodic orbits)\n",
+		x, mandel_skipped_iterations());
 }
 
 int main(int argc, char **argv)
@@ -193,16 +204,82 @@ int main(int argc, char **argv)
 	int i, wait_status;
 	sigset_t sigset;
 	pid_t pid;
-	xstep = (xmax - xmin) / x_chars;
-	ystep = (ymax - ymin) / y_chars;
-	if (argc != 2) {
-		perror("Incorrect input, please insert only the number of threadsto create");
+	struct mandel_lease_params lease = { 4, 5.0, 0, NULL };
+	int leased = 0, lease_opts = 0;
+	char *worker = NULL;
+	long chunks;
+	char c;
+	int opt, sock;
+	viewport.xmin = xmin;
+	viewport.xmax = xmax;
+	viewport.ymin = ymin;
+	viewport.ymax = ymax;
+	viewport.width = x_chars;
+	viewport.height = y_chars;
+	viewport.max_iteration = MANDEL_MAX_ITERATION;
+	if ((ctx = mandel_ctx_create(MANDEL_DOUBLE, NULL)) == NULL) {
+		perror("mandel_ctx_create");
 		exit(1);
 	}
-	if (safe_atoi(argv[1], &num_threads) < 0 || num_threads <= 0) {
+	while ((opt = getopt(argc, argv, "lc:e:p:w:")) != -1) {
+		switch (opt) {
+		case 'l':
+			leased = 1;
+			break;
+		case 'c':
+			if (safe_atoi(optarg, &lease.chunk_lines) < 0 ||
+			    lease.chunk_lines <= 0)
+				usage(argv[0]);
+			lease_opts = 1;
+			break;
+		case 'e':
+			if (sscanf(optarg, "%lf%c", &lease.timeout, &c) != 1 ||
+			    !(lease.timeout > 0))
+				usage(argv[0]);
+			lease_opts = 1;
+			break;
+		case 'p':
+			lease.listen = optarg;
+			lease_opts = 1;
+			break;
+		case 'w':
+			worker = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	/* -c, -e and -p only mean something to a coordinator */
+	if (lease_opts && !leased)
+		usage(argv[0]);
+	if (worker) {
+		if (optind != argc || leased)
+			usage(argv[0]);
+		if ((sock = mandel_lease_connect(worker)) < 0) {
+			perror(worker);
+			exit(1);
+		}
+		if ((chunks = mandel_lease_worker(sock)) < 0) {
+			perror("mandel_lease_worker");
+			exit(1);
+		}
+		close(sock);
+		fprintf(stderr, "Worker: %ld chunks, ran %llu iterations\n",
+			chunks, mandel_run_iterations());
+		mandel_ctx_destroy(ctx);
+		return 0;
+	}
+
+	if (optind != argc - 1)
+		usage(argv[0]);
+	if (safe_atoi(argv[optind], &num_threads) < 0 || num_threads < 0) {
 		perror("input error");
 		exit(1);
 	}
+	/* Only a coordinator others may connect to can start without any */
+	if (num_threads == 0 && !(leased && lease.listen))
+		usage(argv[0]);
 
 	/*
 	 * draw the Mandelbrot Set, one line at a time.
@@ -220,6 +297,14 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
+	if (leased) {
+		lease.local = num_threads;
+		render_mandel_leased(&viewport, MANDEL_DOUBLE, &lease, 1);
+		mandel_ctx_destroy(ctx);
+		reset_xterm_color(1);
+		return 0;
+	}
+
 	semaphore= create_shared_memory_area(num_threads * sizeof(sem_t));
 
 	for (i = 0; i < num_threads; i++) {
@@ -266,6 +351,7 @@ int main(int argc, char **argv)
 	}
 	
 	destroy_shared_memory_area(semaphore, num_threads * sizeof(sem_t));	
+	mandel_ctx_destroy(ctx);
 	reset_xterm_color(1);
 	return 0;
 }
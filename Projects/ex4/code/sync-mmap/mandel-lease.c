@@ -0,0 +1,604 @@
+/*
+ * mandel-lease.c
+ *
+ * Rendering a frame over many processes, leasing chunks of lines
+ * to workers, see mandel-lease.h.
+ *
+ * The coordinator polls its workers, keeping LEASE_DEPTH leases out
+ * at every one of them, so a worker always has its next chunk
+ * waiting when it sends back the last. Chunks are leased lowest
+ * first, and output as soon as all those above them are in.
+ *
+ * A worker answers its leases in the order it got them, so only the
+ * oldest one it has not answered is being worked on: the timeout
+ * runs for that one alone, from when it was sent or the answer
+ * before it came in. When it expires, every chunk leased to the
+ * worker is free again. The worker keeps working, and what it sends
+ * back is still taken if nobody beat it to it, but it gets no more
+ * leases until it does send something, and then only enough to have
+ * LEASE_DEPTH out again, counting the ones it still has to answer.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "mandel-lib.h"
+#include "mandel-render.h"
+#include "mandel-lease.h"
+
+/* Leases a worker holds at once, at most */
+#define LEASE_DEPTH 2
+
+/* Workers connected at once, at most */
+#define LEASE_WORKERS 256
+
+enum lease_state { CHUNK_FREE, CHUNK_LEASED, CHUNK_DONE };
+
+struct lease_chunk {
+	enum lease_state state;
+	int worker;		/* Holding the lease, if CHUNK_LEASED */
+};
+
+struct lease_worker {
+	int fd;			/* -1 once gone */
+	pid_t pid;		/* If forked here, else 0 */
+	int lease[LEASE_DEPTH];	/* Chunks sent to it, oldest first... */
+	int first, sent;	/* ...from lease[first], sent of them */
+	double deadline;	/* When lease[first] expires */
+	int late;		/* A lease of it expired */
+	char *buf;		/* A result coming in */
+	size_t got;
+	unsigned long chunks;	/* Results taken */
+};
+
+struct lease_coord {
+	struct mandel_lease_job job;
+	struct lease_chunk *chunk;
+	int nchunks, done;
+	int next;		/* First chunk not output yet */
+	struct lease_worker worker[LEASE_WORKERS];
+	int nworkers;
+	int *iter;		/* The whole frame, as chunks come in */
+	double timeout;		/* Seconds before a lease expires */
+	unsigned long leases, expired;
+};
+
+static double lease_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Read exactly count bytes; returns 0 on end of file before any */
+static ssize_t lease_read_all(int fd, void *buf, size_t count)
+{
+	size_t got = 0;
+	ssize_t ret;
+
+	while (got < count) {
+		ret = read(fd, (char *)buf + got, count - got);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -1;
+		if (ret == 0) {
+			if (got == 0)
+				return 0;
+			errno = EPIPE;
+			return -1;
+		}
+		got += ret;
+	}
+	return got;
+}
+
+static int lease_chunk_count(const struct mandel_lease_job *job, int chunk)
+{
+	int first = chunk * job->chunk_lines;
+
+	return job->height - first < job->chunk_lines ?
+		job->height - first : job->chunk_lines;
+}
+
+/* Split [HOST:]PORT and look it up, for listening on if passive */
+static struct addrinfo *lease_addr(const char *addr, int passive)
+{
+	struct addrinfo hints, *ai;
+	char host[256];
+	const char *port = strrchr(addr, ':');
+	int ret;
+
+	if (port) {
+		if (port - addr >= (long)sizeof(host)) {
+			fprintf(stderr, "%s: host name too long\n", addr);
+			return NULL;
+		}
+		memcpy(host, addr, port - addr);
+		host[port - addr] = '\0';
+		port++;
+	} else {
+		strcpy(host, "127.0.0.1");
+		port = addr;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+	if ((ret = getaddrinfo(host, port, &hints, &ai)) != 0) {
+		fprintf(stderr, "%s: %s\n", addr, gai_strerror(ret));
+		return NULL;
+	}
+	return ai;
+}
+
+static int lease_listen(const char *addr)
+{
+	struct addrinfo *ai;
+	int sock, one = 1;
+
+	if ((ai = lease_addr(addr, 1)) == NULL)
+		exit(1);
+	if ((sock = socket(ai->ai_family, ai->ai_socktype,
+	    ai->ai_protocol)) < 0 ||
+	    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one,
+	    sizeof(one)) < 0 ||
+	    bind(sock, ai->ai_addr, ai->ai_addrlen) < 0 ||
+	    listen(sock, LEASE_WORKERS) < 0) {
+		perror(addr);
+		exit(1);
+	}
+	freeaddrinfo(ai);
+	return sock;
+}
+
+int mandel_lease_connect(const char *addr)
+{
+	struct addrinfo *ai;
+	int sock, err;
+
+	if ((ai = lease_addr(addr, 0)) == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((sock = socket(ai->ai_family, ai->ai_socktype,
+	    ai->ai_protocol)) < 0) {
+		freeaddrinfo(ai);
+		return -1;
+	}
+	if (connect(sock, ai->ai_addr, ai->ai_addrlen) < 0) {
+		err = errno;
+		close(sock);
+		freeaddrinfo(ai);
+		errno = err;
+		return -1;
+	}
+	freeaddrinfo(ai);
+	return sock;
+}
+
+long mandel_lease_worker(int sock)
+{
+	struct mandel_lease_job job;
+	struct mandel_viewport vp;
+	struct mandel_lease lease;
+	struct mandel_ctx *ctx;
+	int *iter;
+	long chunks = 0;
+	ssize_t ret;
+	int count;
+
+	/* A coordinator gone while being written to is noticed by write() */
+	signal(SIGPIPE, SIG_IGN);
+	if ((ret = lease_read_all(sock, &job, sizeof(job))) <= 0) {
+		if (ret == 0)
+			errno = EPIPE;
+		return -1;
+	}
+	vp.xmin = job.xmin;
+	vp.xmax = job.xmax;
+	vp.ymin = job.ymin;
+	vp.ymax = job.ymax;
+	vp.width = job.width;
+	vp.height = job.height;
+	vp.max_iteration = job.max_iteration;
+	if (mandel_viewport_check(&vp) < 0 || job.chunk_lines <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((ctx = mandel_ctx_create(job.prec, NULL)) == NULL)
+		return -1;
+	if ((iter = malloc((size_t)job.chunk_lines * job.width *
+	    sizeof(int))) == NULL) {
+		mandel_ctx_destroy(ctx);
+		return -1;
+	}
+
+	while ((ret = lease_read_all(sock, &lease, sizeof(lease))) > 0) {
+		if (lease.chunk < 0 ||
+		    lease.chunk * job.chunk_lines >= job.height) {
+			errno = EINVAL;
+			ret = -1;
+			break;
+		}
+		count = lease_chunk_count(&job, lease.chunk);
+		if (mandel_render_lines(ctx, &vp, lease.chunk * job.chunk_lines,
+		    count, iter) < 0 ||
+		    insist_write(sock, (char *)&lease, sizeof(lease)) < 0 ||
+		    insist_write(sock, (char *)iter,
+		    (size_t)count * job.width * sizeof(int)) < 0) {
+			ret = -1;
+			break;
+		}
+		chunks++;
+	}
+
+	/*
+	 * The coordinator hangs up once the frame is done, maybe while
+	 * we are still answering a lease that expired: that is no failure.
+	 */
+	if (ret < 0 && (errno == EPIPE || errno == ECONNRESET))
+		ret = 0;
+
+	free(iter);
+	mandel_ctx_destroy(ctx);
+	return ret < 0 ? -1 : chunks;
+}
+
+/* Start using a worker connected on fd */
+static void lease_add_worker(struct lease_coord *c, int fd, pid_t pid)
+{
+	struct lease_worker *w;
+
+	if (c->nworkers == LEASE_WORKERS) {
+		fprintf(stderr, "Too many workers, turning one away\n");
+		close(fd);
+		return;
+	}
+	w = &c->worker[c->nworkers];
+	w->fd = fd;
+	w->pid = pid;
+	w->first = w->sent = 0;
+	w->late = 0;
+	w->got = 0;
+	w->chunks = 0;
+	w->buf = malloc(sizeof(struct mandel_lease) +
+		(size_t)c->job.chunk_lines * c->job.width * sizeof(int));
+	if (!w->buf) {
+		fprintf(stderr, "Out of memory, failed to allocate a worker\n");
+		exit(1);
+	}
+	if (insist_write(fd, (char *)&c->job, sizeof(c->job)) < 0) {
+		close(fd);
+		free(w->buf);
+		return;
+	}
+	c->nworkers++;
+}
+
+/*
+ * Free every chunk still leased to worker w. The leases stay in
+ * w->lease[], since w still has to answer them.
+ */
+static int lease_drop(struct lease_coord *c, struct lease_worker *w)
+{
+	struct lease_chunk *ch;
+	int i, dropped = 0;
+
+	for (i = 0; i < w->sent; i++) {
+		ch = &c->chunk[w->lease[(w->first + i) % LEASE_DEPTH]];
+		if (ch->state == CHUNK_LEASED && ch->worker == w - c->worker) {
+			ch->state = CHUNK_FREE;
+			dropped++;
+		}
+	}
+	return dropped;
+}
+
+/* The worker is gone: every chunk it held is free again */
+static void lease_lost(struct lease_coord *c, struct lease_worker *w)
+{
+	lease_drop(c, w);
+	w->sent = 0;
+	close(w->fd);
+	w->fd = -1;
+	free(w->buf);
+	w->buf = NULL;
+}
+
+/* Hand out free chunks, lowest first, to workers with room for them */
+static void lease_hand_out(struct lease_coord *c)
+{
+	struct lease_worker *w;
+	struct mandel_lease lease;
+	int i, free_chunk = c->next;
+
+	for (i = 0; i < c->nworkers; i++) {
+		w = &c->worker[i];
+		if (w->fd < 0 || w->late)
+			continue;
+		while (w->sent < LEASE_DEPTH) {
+			while (free_chunk < c->nchunks &&
+			       c->chunk[free_chunk].state != CHUNK_FREE)
+				free_chunk++;
+			if (free_chunk == c->nchunks)
+				return;
+
+			lease.chunk = free_chunk;
+			if (insist_write(w->fd, (char *)&lease,
+			    sizeof(lease)) < 0) {
+				lease_lost(c, w);
+				break;
+			}
+			c->chunk[free_chunk].state = CHUNK_LEASED;
+			c->chunk[free_chunk].worker = i;
+			/* A lease queued behind another starts on its answer */
+			if (!w->sent)
+				w->deadline = lease_time() + c->timeout;
+			w->lease[(w->first + w->sent++) % LEASE_DEPTH] =
+				free_chunk;
+			c->leases++;
+		}
+	}
+}
+
+/* Read what has come in from worker w, and take its result if whole */
+static void lease_read(struct lease_coord *c, struct lease_worker *w)
+{
+	struct mandel_lease lease;
+	size_t need = sizeof(lease);
+	ssize_t ret;
+	int first, count;
+
+	if (w->got >= sizeof(lease)) {
+		memcpy(&lease, w->buf, sizeof(lease));
+		need += (size_t)lease_chunk_count(&c->job, lease.chunk) *
+			c->job.width * sizeof(int);
+	}
+	ret = read(w->fd, w->buf + w->got, need - w->got);
+	if (ret < 0 && errno == EINTR)
+		return;
+	if (ret <= 0) {
+		lease_lost(c, w);
+		return;
+	}
+	w->got += ret;
+	if (w->got < sizeof(lease))
+		return;
+	memcpy(&lease, w->buf, sizeof(lease));
+	if (w->got == sizeof(lease)) {
+		if (!w->sent || lease.chunk != w->lease[w->first]) {
+			fprintf(stderr, "Worker %d sent chunk %d, dropping it\n",
+				(int)(w - c->worker), lease.chunk);
+			lease_lost(c, w);
+		}
+		return;
+	}
+	if (w->got < need)
+		return;
+
+	/* A whole result: the next lease, if any, is worked on from now */
+	w->got = 0;
+	w->late = 0;
+	w->first = (w->first + 1) % LEASE_DEPTH;
+	w->sent--;
+	w->deadline = lease_time() + c->timeout;
+
+	/* The first result in for its chunk is taken */
+	if (c->chunk[lease.chunk].state == CHUNK_DONE)
+		return;
+	first = lease.chunk * c->job.chunk_lines;
+	count = lease_chunk_count(&c->job, lease.chunk);
+	memcpy(&c->iter[first * c->job.width], w->buf + sizeof(lease),
+		(size_t)count * c->job.width * sizeof(int));
+	c->chunk[lease.chunk].state = CHUNK_DONE;
+	c->done++;
+	w->chunks++;
+}
+
+/* Free the chunks of workers whose lease being worked on has expired */
+static void lease_expire(struct lease_coord *c)
+{
+	struct lease_worker *w;
+	double now = lease_time();
+	int i;
+
+	for (i = 0; i < c->nworkers; i++) {
+		w = &c->worker[i];
+		if (w->fd >= 0 && w->sent && !w->late && w->deadline <= now) {
+			c->expired += lease_drop(c, w);
+			w->late = 1;
+		}
+	}
+}
+
+/* Seconds until the first lease out expires, or the timeout if none is */
+static double lease_next_deadline(struct lease_coord *c)
+{
+	struct lease_worker *w;
+	double now = lease_time(), wait = c->timeout;
+	int i;
+
+	for (i = 0; i < c->nworkers; i++) {
+		w = &c->worker[i];
+		if (w->fd >= 0 && w->sent && !w->late &&
+		    w->deadline - now < wait)
+			wait = w->deadline - now;
+	}
+	return wait > 0 ? wait : 0;
+}
+
+/* Output the chunks next on, as far as they are all in */
+static void lease_output(struct lease_coord *c, struct mandel_ctx *ctx,
+	struct xterm_frame *frame, int fd)
+{
+	int first, line, count;
+
+	while (c->next < c->nchunks && c->chunk[c->next].state == CHUNK_DONE) {
+		first = c->next * c->job.chunk_lines;
+		count = lease_chunk_count(&c->job, c->next);
+		for (line = first; line < first + count; line++) {
+			int *iter = &c->iter[line * c->job.width];
+
+			mandel_render_colors(ctx, iter, c->job.width, iter);
+			xterm_frame_line(frame, line, iter);
+		}
+		xterm_frame_write(fd, frame, first, count);
+		c->next++;
+	}
+}
+
+/* Fork a worker, talking to it over a socket pair */
+static void lease_fork_worker(struct lease_coord *c, int listen_fd)
+{
+	int sv[2], i;
+	long chunks;
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		perror("socketpair");
+		exit(1);
+	}
+	if ((pid = fork()) < 0) {
+		perror("fork error");
+		exit(1);
+	}
+	if (pid == 0) {
+		close(sv[0]);
+		if (listen_fd >= 0)
+			close(listen_fd);
+		for (i = 0; i < c->nworkers; i++)
+			if (c->worker[i].fd >= 0)
+				close(c->worker[i].fd);
+		if ((chunks = mandel_lease_worker(sv[1])) < 0) {
+			perror("mandel_lease_worker");
+			exit(1);
+		}
+		fprintf(stderr, "Child %d: %ld chunks, ran %llu iterations\n",
+			c->nworkers, chunks, mandel_run_iterations());
+		exit(0);
+	}
+	close(sv[1]);
+	lease_add_worker(c, sv[0], pid);
+}
+
+void render_mandel_leased(const struct mandel_viewport *vp,
+	enum mandel_precision prec, const struct mandel_lease_params *p,
+	int fd)
+{
+	struct pollfd fds[LEASE_WORKERS + 1];
+	int slot[LEASE_WORKERS + 1];
+	struct lease_coord *c;
+	struct xterm_frame *frame;
+	struct mandel_ctx *ctx;
+	int listen_fd = -1, i, n, live, wfd;
+
+	if ((c = calloc(1, sizeof(*c))) == NULL ||
+	    (c->iter = malloc((size_t)vp->width * vp->height *
+	    sizeof(int))) == NULL ||
+	    (frame = xterm_frame_create(vp->width, vp->height)) == NULL ||
+	    (ctx = mandel_ctx_create(prec, NULL)) == NULL) {
+		fprintf(stderr, "Out of memory, failed to allocate a frame\n");
+		exit(1);
+	}
+	c->job.xmin = vp->xmin;
+	c->job.xmax = vp->xmax;
+	c->job.ymin = vp->ymin;
+	c->job.ymax = vp->ymax;
+	c->job.width = vp->width;
+	c->job.height = vp->height;
+	c->job.max_iteration = vp->max_iteration;
+	c->job.prec = prec;
+	c->job.chunk_lines = p->chunk_lines;
+	c->timeout = p->timeout;
+	c->nchunks = (vp->height + p->chunk_lines - 1) / p->chunk_lines;
+	if ((c->chunk = calloc(c->nchunks, sizeof(*c->chunk))) == NULL) {
+		fprintf(stderr, "Out of memory, failed to allocate chunks\n");
+		exit(1);
+	}
+
+	/* A worker gone while being written to is noticed by write() */
+	signal(SIGPIPE, SIG_IGN);
+	if (p->listen) {
+		listen_fd = lease_listen(p->listen);
+		fprintf(stderr, "Coordinator: workers may connect to %s\n",
+			p->listen);
+	}
+	for (i = 0; i < p->local; i++)
+		lease_fork_worker(c, listen_fd);
+
+	while (c->done < c->nchunks) {
+		lease_expire(c);
+		lease_hand_out(c);
+
+		fds[0].fd = listen_fd;
+		fds[0].events = POLLIN;
+		for (i = 0, n = 1, live = 0; i < c->nworkers; i++) {
+			if (c->worker[i].fd < 0)
+				continue;
+			live++;
+			fds[n].fd = c->worker[i].fd;
+			fds[n].events = POLLIN;
+			slot[n++] = i;
+		}
+		if (!live && listen_fd < 0) {
+			fprintf(stderr, "No workers left, %d of %d chunks "
+				"done\n", c->done, c->nchunks);
+			exit(1);
+		}
+
+		if (poll(fds, n, (int)(lease_next_deadline(c) * 1000) + 1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			exit(1);
+		}
+		for (i = 1; i < n; i++)
+			if (fds[i].revents)
+				lease_read(c, &c->worker[slot[i]]);
+		if (listen_fd >= 0 && (fds[0].revents & POLLIN)) {
+			if ((wfd = accept(listen_fd, NULL, NULL)) >= 0)
+				lease_add_worker(c, wfd, 0);
+			else if (errno != EINTR && errno != ECONNABORTED) {
+				perror("accept");
+				exit(1);
+			}
+		}
+		lease_output(c, ctx, frame, fd);
+	}
+
+	/* Hanging up tells the workers there is nothing more to do */
+	if (listen_fd >= 0)
+		close(listen_fd);
+	for (i = 0; i < c->nworkers; i++) {
+		if (c->worker[i].fd >= 0)
+			lease_lost(c, &c->worker[i]);
+		if (c->worker[i].pid > 0 &&
+		    waitpid(c->worker[i].pid, NULL, 0) < 0)
+			perror("wait error");
+	}
+	for (i = 0; i < c->nworkers; i++)
+		fprintf(stderr, "Worker %d: %lu chunks\n", i,
+			c->worker[i].chunks);
+	fprintf(stderr, "Leases: %lu handed out for %d chunks, %lu expired\n",
+		c->leases, c->nchunks, c->expired);
+
+	xterm_frame_destroy(frame);
+	mandel_ctx_destroy(ctx);
+	free(c->chunk);
+	free(c->iter);
+	free(c);
+}
@@ -0,0 +1,68 @@
+/*
+ * mandel-lease.h
+ *
+ * Rendering a frame over many processes: a coordinator splits the
+ * frame in chunks of lines and leases them to workers, forked
+ * locally or connected over TCP, which send back the escape times
+ * of each chunk as soon as they have them. A lease not answered in
+ * time, or held by a worker that goes away, expires, and the chunk
+ * is leased to another worker.
+ *
+ * Coordinator and workers talk in the structs below, as laid out in
+ * memory, so they must run on the same kind of machine.
+ *
+ */
+
+#ifndef MANDEL_LEASE_H__
+#define MANDEL_LEASE_H__
+
+#include <stdint.h>
+
+#include "mandel-render.h"
+
+/* Sent to a worker once, when it joins */
+struct mandel_lease_job {
+	double xmin, xmax, ymin, ymax;
+	int32_t width, height;
+	int32_t max_iteration;
+	int32_t prec;
+	int32_t chunk_lines;	/* Lines of every chunk but maybe the last */
+	int32_t reserved;	/* 0 */
+};
+
+/*
+ * A lease of chunk chunk, lines chunk * chunk_lines on. A worker
+ * answers it with the same struct, followed by the escape times
+ * of the lines of the chunk.
+ */
+struct mandel_lease {
+	int32_t chunk;
+};
+
+struct mandel_lease_params {
+	int chunk_lines;	/* Lines leased at a time */
+	double timeout;		/* Seconds before a lease expires */
+	int local;		/* Workers to fork */
+	const char *listen;	/* [ADDR:]PORT for workers, or NULL */
+};
+
+/*
+ * Render vp in precision prec with the workers of p, and output
+ * it to fd line by line, in order, as its chunks come in. Exits
+ * if left with no workers and none able to join.
+ */
+void render_mandel_leased(const struct mandel_viewport *vp,
+	enum mandel_precision prec, const struct mandel_lease_params *p,
+	int fd);
+
+/* Connect to the coordinator at [HOST:]PORT; returns the socket, or -1 */
+int mandel_lease_connect(const char *addr);
+
+/*
+ * Work for the coordinator on sock until it hangs up, even while a
+ * chunk is being sent back: returns the number of chunks rendered,
+ * or -1 with errno set on failure. SIGPIPE is ignored from then on.
+ */
+long mandel_lease_worker(int sock);
+
+#endif /* MANDEL_LEASE_H__ */
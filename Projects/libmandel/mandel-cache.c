@@ -0,0 +1,318 @@
+/*
+ * mandel-cache.c
+ *
+ * A cache of rendered tiles, kept in memory up to a byte budget
+ * and evicted least recently used first.
+ *
+ * Tiles are spread over MANDEL_CACHE_SHARDS shards by the hash of
+ * their key. Every shard has its own lock, hash table, LRU list and
+ * an equal share of the budget, so threads looking up different
+ * tiles rarely wait for each other.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "mandel-lib.h"
+#include "mandel-render.h"
+#include "mandel-cache.h"
+#include "mandel-store.h"
+
+#define MANDEL_CACHE_SHARDS 16
+
+#define TILE_PIXELS (MANDEL_TILE_SIZE * MANDEL_TILE_SIZE)
+
+struct cache_tile {
+	struct mandel_tile_key key;
+	struct cache_tile *chain;	/* Next in the same hash bucket */
+	struct cache_tile *newer, *older;
+	int iter[TILE_PIXELS];
+};
+
+/* newest and oldest are the ends of the LRU list */
+struct cache_shard {
+	pthread_mutex_t lock;
+	struct cache_tile **bucket;
+	unsigned nbuckets;		/* A power of two */
+	struct cache_tile *newest, *oldest;
+	size_t tiles, bytes, budget;
+};
+
+struct mandel_cache {
+	struct cache_shard shard[MANDEL_CACHE_SHARDS];
+	struct mandel_store *store;	/* Behind the cache, or NULL */
+	unsigned long long hits, misses, evictions;
+};
+
+static unsigned long long cache_mix(unsigned long long h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+unsigned long long mandel_tile_hash(const struct mandel_tile_key *key)
+{
+	unsigned long long h;
+
+	h = cache_mix((unsigned long long)key->tx);
+	h = cache_mix(h ^ (unsigned long long)key->ty);
+	h = cache_mix(h ^ ((unsigned long long)(unsigned)key->zoom << 32 |
+		(unsigned)key->max_iteration));
+	return cache_mix(h ^ key->prec);
+}
+
+void mandel_cache_set_store(struct mandel_cache *cache,
+	struct mandel_store *store)
+{
+	cache->store = store;
+}
+
+static int cache_key_eq(const struct mandel_tile_key *a,
+	const struct mandel_tile_key *b)
+{
+	return a->zoom == b->zoom && a->tx == b->tx && a->ty == b->ty &&
+		a->max_iteration == b->max_iteration && a->prec == b->prec;
+}
+
+struct mandel_cache *mandel_cache_create(size_t budget)
+{
+	struct mandel_cache *cache;
+	struct cache_shard *sh;
+	size_t share = budget / MANDEL_CACHE_SHARDS;
+	unsigned nbuckets = 16;
+	int i;
+
+	if ((cache = calloc(1, sizeof(*cache))) == NULL)
+		return NULL;
+
+	/* Enough buckets for a full shard, about one tile per bucket */
+	while (nbuckets < share / sizeof(struct cache_tile) &&
+	       nbuckets < 1u << 20)
+		nbuckets <<= 1;
+
+	for (i = 0; i < MANDEL_CACHE_SHARDS; i++) {
+		sh = &cache->shard[i];
+		sh->bucket = calloc(nbuckets, sizeof(struct cache_tile *));
+		if (!sh->bucket) {
+			while (i-- > 0) {
+				pthread_mutex_destroy(&cache->shard[i].lock);
+				free(cache->shard[i].bucket);
+			}
+			free(cache);
+			return NULL;
+		}
+		pthread_mutex_init(&sh->lock, NULL);
+		sh->nbuckets = nbuckets;
+		sh->budget = share;
+	}
+	return cache;
+}
+
+/* Find key in sh, with sh->lock held */
+static struct cache_tile **cache_find(struct cache_shard *sh,
+	const struct mandel_tile_key *key, unsigned long long h)
+{
+	struct cache_tile **pt = &sh->bucket[(h >> 4) & (sh->nbuckets - 1)];
+
+	while (*pt && !cache_key_eq(&(*pt)->key, key))
+		pt = &(*pt)->chain;
+	return pt;
+}
+
+static void cache_unlink_lru(struct cache_shard *sh, struct cache_tile *t)
+{
+	if (t->newer)
+		t->newer->older = t->older;
+	else
+		sh->newest = t->older;
+	if (t->older)
+		t->older->newer = t->newer;
+	else
+		sh->oldest = t->newer;
+}
+
+static void cache_push_lru(struct cache_shard *sh, struct cache_tile *t)
+{
+	t->newer = NULL;
+	t->older = sh->newest;
+	if (sh->newest)
+		sh->newest->newer = t;
+	else
+		sh->oldest = t;
+	sh->newest = t;
+}
+
+int mandel_cache_lookup(struct mandel_cache *cache,
+	const struct mandel_tile_key *key, int iter[])
+{
+	unsigned long long h = mandel_tile_hash(key);
+	struct cache_shard *sh = &cache->shard[h % MANDEL_CACHE_SHARDS];
+	struct cache_tile *t;
+
+	pthread_mutex_lock(&sh->lock);
+	t = *cache_find(sh, key, h);
+	if (t) {
+		memcpy(iter, t->iter, sizeof(t->iter));
+		if (sh->newest != t) {
+			cache_unlink_lru(sh, t);
+			cache_push_lru(sh, t);
+		}
+	}
+	pthread_mutex_unlock(&sh->lock);
+
+	__sync_fetch_and_add(t ? &cache->hits : &cache->misses, 1);
+	return t != NULL;
+}
+
+int mandel_cache_insert(struct mandel_cache *cache,
+	const struct mandel_tile_key *key, const int iter[])
+{
+	unsigned long long h = mandel_tile_hash(key);
+	struct cache_shard *sh = &cache->shard[h % MANDEL_CACHE_SHARDS];
+	struct cache_tile *t, *old, **pt;
+	unsigned long evicted = 0;
+
+	/* A shard that cannot hold even one tile caches nothing */
+	if (sh->budget < sizeof(*t))
+		return 0;
+	if ((t = malloc(sizeof(*t))) == NULL)
+		return -1;
+	t->key = *key;
+	memcpy(t->iter, iter, sizeof(t->iter));
+
+	pthread_mutex_lock(&sh->lock);
+	pt = cache_find(sh, key, h);
+	if (*pt) {
+		/* Another thread rendered it too, and got here first */
+		if (sh->newest != *pt) {
+			cache_unlink_lru(sh, *pt);
+			cache_push_lru(sh, *pt);
+		}
+		pthread_mutex_unlock(&sh->lock);
+		free(t);
+		return 0;
+	}
+
+	while (sh->bytes + sizeof(*t) > sh->budget) {
+		old = sh->oldest;
+		cache_unlink_lru(sh, old);
+		pt = cache_find(sh, &old->key, mandel_tile_hash(&old->key));
+		*pt = old->chain;
+		sh->tiles--;
+		sh->bytes -= sizeof(*old);
+		free(old);
+		evicted++;
+	}
+
+	/* Evicting may have unlinked the bucket pt points into */
+	pt = cache_find(sh, key, h);
+	t->chain = NULL;
+	*pt = t;
+	cache_push_lru(sh, t);
+	sh->tiles++;
+	sh->bytes += sizeof(*t);
+	pthread_mutex_unlock(&sh->lock);
+
+	if (evicted)
+		__sync_fetch_and_add(&cache->evictions, evicted);
+	return 0;
+}
+
+/*
+ * Take a tile missing from the cache out of store, if there is one,
+ * else render it, and add it to store.
+ */
+static int cache_get(struct mandel_ctx *ctx, struct mandel_store *store,
+	const struct mandel_tile_key *key, int tile[])
+{
+	if (store && mandel_store_lookup(store, key, tile))
+		return 0;
+	mandel_render_tile(ctx, key->zoom, key->tx, key->ty,
+		key->max_iteration, tile);
+	return store ? mandel_store_insert(store, key, tile) : 0;
+}
+
+int mandel_render_cached(struct mandel_ctx *ctx, struct mandel_cache *cache,
+	const struct mandel_grid_view *v, int out[])
+{
+	struct mandel_store *store = cache ? cache->store : NULL;
+	struct mandel_tile_key key;
+	int *tile;
+	long tx, ty, tx0, tx1, ty0, ty1;
+
+	if (v->width <= 0 || v->height <= 0 || v->max_iteration <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((tile = malloc(TILE_PIXELS * sizeof(int))) == NULL)
+		return -1;
+
+	key.zoom = v->zoom;
+	key.max_iteration = v->max_iteration;
+	key.prec = mandel_ctx_precision(ctx);
+
+	tx0 = mandel_floor_div(v->px, MANDEL_TILE_SIZE);
+	tx1 = mandel_floor_div(v->px + v->width - 1, MANDEL_TILE_SIZE);
+	ty0 = mandel_floor_div(v->py, MANDEL_TILE_SIZE);
+	ty1 = mandel_floor_div(v->py + v->height - 1, MANDEL_TILE_SIZE);
+
+	for (ty = ty0; ty <= ty1; ty++)
+		for (tx = tx0; tx <= tx1; tx++) {
+			key.tx = tx;
+			key.ty = ty;
+			if (!cache || !mandel_cache_lookup(cache, &key, tile)) {
+				if (cache_get(ctx, store, &key, tile) < 0 ||
+				    (cache && mandel_cache_insert(cache, &key,
+				     tile) < 0)) {
+					free(tile);
+					return -1;
+				}
+			}
+			mandel_tile_blit(tile, tx, ty, v, out, v->width);
+		}
+
+	free(tile);
+	return 0;
+}
+
+void mandel_cache_stats(struct mandel_cache *cache,
+	struct mandel_cache_stats *st)
+{
+	struct cache_shard *sh;
+	int i;
+
+	st->hits = __sync_fetch_and_add(&cache->hits, 0);
+	st->misses = __sync_fetch_and_add(&cache->misses, 0);
+	st->evictions = __sync_fetch_and_add(&cache->evictions, 0);
+	st->tiles = st->bytes = 0;
+	for (i = 0; i < MANDEL_CACHE_SHARDS; i++) {
+		sh = &cache->shard[i];
+		pthread_mutex_lock(&sh->lock);
+		st->tiles += sh->tiles;
+		st->bytes += sh->bytes;
+		pthread_mutex_unlock(&sh->lock);
+	}
+}
+
+void mandel_cache_destroy(struct mandel_cache *cache)
+{
+	struct cache_tile *t, *next;
+	int i;
+
+	for (i = 0; i < MANDEL_CACHE_SHARDS; i++) {
+		for (t = cache->shard[i].oldest; t; t = next) {
+			next = t->newer;
+			free(t);
+		}
+		pthread_mutex_destroy(&cache->shard[i].lock);
+		free(cache->shard[i].bucket);
+	}
+	free(cache);
+}
@@ -0,0 +1,84 @@
+/*
+ * mandel-cache.h
+ *
+ * A cache of rendered tiles of the grid (see mandel-render.h), kept
+ * in memory up to a byte budget and evicted least recently used first.
+ * Any number of threads may look tiles up and insert them at once.
+ *
+ */
+
+#ifndef MANDEL_CACHE_H__
+#define MANDEL_CACHE_H__
+
+#include <stddef.h>
+
+#include "mandel-lib.h"
+#include "mandel-render.h"
+
+/* Everything the escape times of a tile depend on */
+struct mandel_tile_key {
+	int zoom;
+	long tx, ty;
+	int max_iteration;
+	enum mandel_precision prec;
+};
+
+struct mandel_cache_stats {
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+	size_t tiles;		/* Tiles held right now */
+	size_t bytes;		/* Bytes they take, at most the budget */
+};
+
+struct mandel_cache;
+struct mandel_store;
+
+/* The hash of key, the same from one run to the next */
+unsigned long long mandel_tile_hash(const struct mandel_tile_key *key);
+
+/*
+ * Create an empty cache holding at most budget bytes of tiles.
+ * Returns NULL if out of memory.
+ */
+struct mandel_cache *mandel_cache_create(size_t budget);
+
+/*
+ * Copy the escape times of tile key into iter[], MANDEL_TILE_SIZE
+ * lines of MANDEL_TILE_SIZE values, and mark it most recently used.
+ * Returns 1 on a hit, 0 if the tile is not cached.
+ */
+int mandel_cache_lookup(struct mandel_cache *cache,
+	const struct mandel_tile_key *key, int iter[]);
+
+/*
+ * Add tile key, evicting the least recently used tiles to stay within
+ * budget. A tile already cached is only marked most recently used.
+ * Returns -1 if out of memory; the cache is left as it was.
+ */
+int mandel_cache_insert(struct mandel_cache *cache,
+	const struct mandel_tile_key *key, const int iter[]);
+
+/*
+ * Back cache with store (see mandel-store.h), or with nothing if
+ * store is NULL: tiles missing from the cache are then looked up in
+ * store before rendering them, and the ones rendered are added to it.
+ */
+void mandel_cache_set_store(struct mandel_cache *cache,
+	struct mandel_store *store);
+
+/*
+ * Store the escape times of every pixel of view v in out[], line by
+ * line, taking the tiles it covers from cache (or its store) and
+ * rendering only those missing. cache may be NULL, to render them all.
+ * Returns -1 if v is empty or out of memory.
+ */
+int mandel_render_cached(struct mandel_ctx *ctx, struct mandel_cache *cache,
+	const struct mandel_grid_view *v, int out[]);
+
+void mandel_cache_stats(struct mandel_cache *cache,
+	struct mandel_cache_stats *st);
+
+void mandel_cache_destroy(struct mandel_cache *cache);
+
+#endif /* MANDEL_CACHE_H__ */
@@ -0,0 +1,2816 @@
+/*
+ * mandel-lib.c
+ *
+ * A library with useful functions
+ * for computing the Mandelbrot Set and handling a 256-color xterm.
+ *
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <assert.h>
+#include <string.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <float.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define MANDEL_HAVE_X86 1
+#else
+# define MANDEL_HAVE_X86 0
+#endif
+
+#include "mandel-lib.h"
+
+/*****************************************
+ *                                       *
+ * Functions to manage a 256-color xterm *
+ *                                       *
+ *****************************************/
+
+/* 2 functions to convert between RGB colors and the corresponding xterm-256 values
+ * Wolfgang Frisch, xororand@frexx.de */
+
+
+// the 6 value iterations en the xterm color cube
+static const unsigned char valuerange[] = { 0x00, 0x5F, 0x87, 0xAF, 0xD7, 0xFF };
+
+// 16 basic colors
+static const unsigned char basic16[16][3] =
+{
+	{ 0x00, 0x00, 0x00 }, // 0
+	{ 0xCD, 0x00, 0x00 }, // 1
+	{ 0x00, 0xCD, 0x00 }, // 2
+	{ 0xCD, 0xCD, 0x00 }, // 3
+	{ 0x00, 0x00, 0xEE }, // 4
+	{ 0xCD, 0x00, 0xCD }, // 5
+	{ 0x00, 0xCD, 0xCD }, // 6
+	{ 0xE5, 0xE5, 0xE5 }, // 7
+	{ 0x7F, 0x7F, 0x7F }, // 8
+	{ 0xFF, 0x00, 0x00 }, // 9
+	{ 0x00, 0xFF, 0x00 }, // 10
+	{ 0xFF, 0xFF, 0x00 }, // 11
+	{ 0x5C, 0x5C, 0xFF }, // 12
+	{ 0xFF, 0x00, 0xFF }, // 13
+	{ 0x00, 0xFF, 0xFF }, // 14
+	{ 0xFF, 0xFF, 0xFF }  // 15
+};
+
+// convert an xterm color value (0-253) to 3 unsigned chars rgb
+static void xterm2rgb(unsigned char color, unsigned char* rgb)
+{
+	// 16 basic colors
+	if(color<16)
+	{
+		rgb[0] = basic16[color][0];
+		rgb[1] = basic16[color][1];
+		rgb[2] = basic16[color][2];
+	}
+	
+	// color cube color
+	if(color>=16 && color<=232)
+	{
+		color-=16;
+		rgb[0] = valuerange[(color/36)%6];
+		rgb[1] = valuerange[(color/6)%6];
+		rgb[2] = valuerange[color%6];
+	}
+	
+	// gray tone
+	if(color>=233 && color<=253)
+	{
+		rgb[0]=rgb[1]=rgb[2] = 8+(color-232)*0x0a;
+	}
+}
+
+// selects the nearest xterm color for a 3xBYTE rgb value
+static unsigned char rgb2xterm(const unsigned char* rgb)
+{
+	unsigned char c, best_match=0, xrgb[3];
+	int d, smallest_distance;
+
+	smallest_distance = 3 * 256 * 256;
+	
+	for(c=0;c<=253;c++)
+	{
+		xterm2rgb(c,xrgb);
+		d = (xrgb[0]-rgb[0])*(xrgb[0]-rgb[0]) + 
+			(xrgb[1]-rgb[1])*(xrgb[1]-rgb[1]) + 
+			(xrgb[2]-rgb[2])*(xrgb[2]-rgb[2]);
+		if(d<smallest_distance)
+		{
+			smallest_distance = d;
+			best_match=c;
+		}
+	}
+
+	return best_match;
+}
+
+
+/*******************************************
+ *                                         *
+ * A nice 256-color palette for drawing    *
+ * the Mandelbrot Set.                     *
+ *                                         *
+ *******************************************/
+
+static struct { double red; double green; double blue; } mandel256[] = {
+	{0.000,0.000,0.734},
+	{0.000,0.300,0.734},
+	{0.000,0.734,0.000},
+	{0.734,0.734,0.000},
+	{0.734,0.000,0.000},
+	{0.734,0.000,0.734},
+	{0.000,0.734,0.734},
+	{0.750,0.750,0.750},
+	{0.750,0.859,0.750},
+	{0.641,0.781,0.938},
+	{0.500,0.000,0.000},
+	{0.000,0.500,0.000},
+	{0.500,0.500,0.000},
+	{0.000,0.000,0.500},
+	{0.500,0.000,0.500},
+	{0.000,0.500,0.500},
+	{0.234,0.359,0.234},
+	{0.359,0.359,0.234},
+	{0.484,0.359,0.234},
+	{0.609,0.359,0.234},
+	{0.734,0.359,0.234},
+	{0.859,0.359,0.234},
+	{0.984,0.359,0.234},
+	{0.234,0.484,0.234},
+	{0.359,0.484,0.234},
+	{0.484,0.484,0.234},
+	{0.609,0.484,0.234},
+	{0.734,0.484,0.234},
+	{0.859,0.484,0.234},
+	{0.984,0.484,0.234},
+	{0.234,0.609,0.234},
+	{0.359,0.609,0.234},
+	{0.484,0.609,0.234},
+	{0.609,0.609,0.234},
+	{0.734,0.609,0.234},
+	{0.859,0.609,0.234},
+	{0.984,0.609,0.234},
+	{0.234,0.734,0.234},
+	{0.359,0.734,0.234},
+	{0.484,0.734,0.234},
+	{0.609,0.734,0.234},
+	{0.734,0.734,0.234},
+	{0.859,0.734,0.234},
+	{0.984,0.734,0.234},
+	{0.234,0.859,0.234},
+	{0.359,0.859,0.234},
+	{0.484,0.859,0.234},
+	{0.609,0.859,0.234},
+	{0.734,0.859,0.234},
+	{0.859,0.859,0.234},
+	{0.984,0.859,0.234},
+	{0.234,0.984,0.234},
+	{0.359,0.984,0.234},
+	{0.484,0.984,0.234},
+	{0.609,0.984,0.234},
+	{0.734,0.984,0.234},
+	{0.859,0.984,0.234},
+	{0.984,0.984,0.234},
+	{0.234,0.234,0.359},
+	{0.359,0.234,0.359},
+	{0.484,0.234,0.359},
+	{0.609,0.234,0.359},
+	{0.734,0.234,0.359},
+	{0.859,0.234,0.359},
+	{0.984,0.234,0.359},
+	{0.234,0.359,0.359},
+	{0.359,0.359,0.359},
+	{0.484,0.359,0.359},
+	{0.609,0.359,0.359},
+	{0.734,0.359,0.359},
+	{0.859,0.359,0.359},
+	{0.984,0.359,0.359},
+	{0.234,0.484,0.359},
+	{0.359,0.484,0.359},
+	{0.484,0.484,0.359},
+	{0.609,0.484,0.359},
+	{0.734,0.484,0.359},
+	{0.859,0.484,0.359},
+	{0.984,0.484,0.359},
+	{0.234,0.609,0.359},
+	{0.359,0.609,0.359},
+	{0.484,0.609,0.359},
+	{0.609,0.609,0.359},
+	{0.734,0.609,0.359},
+	{0.859,0.609,0.359},
+	{0.984,0.609,0.359},
+	{0.234,0.734,0.359},
+	{0.359,0.734,0.359},
+	{0.484,0.734,0.359},
+	{0.609,0.734,0.359},
+	{0.734,0.734,0.359},
+	{0.859,0.734,0.359},
+	{0.984,0.734,0.359},
+	{0.234,0.859,0.359},
+	{0.359,0.859,0.359},
+	{0.484,0.859,0.359},
+	{0.609,0.859,0.359},
+	{0.734,0.859,0.359},
+	{0.859,0.859,0.359},
+	{0.984,0.859,0.359},
+	{0.234,0.984,0.359},
+	{0.359,0.984,0.359},
+	{0.484,0.984,0.359},
+	{0.609,0.984,0.359},
+	{0.734,0.984,0.359},
+	{0.859,0.984,0.359},
+	{0.984,0.984,0.359},
+	{0.234,0.234,0.484},
+	{0.359,0.234,0.484},
+	{0.484,0.234,0.484},
+	{0.609,0.234,0.484},
+	{0.734,0.234,0.484},
+	{0.859,0.234,0.484},
+	{0.984,0.234,0.484},
+	{0.234,0.359,0.484},
+	{0.359,0.359,0.484},
+	{0.484,0.359,0.484},
+	{0.609,0.359,0.484},
+	{0.734,0.359,0.484},
+	{0.859,0.359,0.484},
+	{0.984,0.359,0.484},
+	{0.234,0.484,0.484},
+	{0.359,0.484,0.484},
+	{0.484,0.484,0.484},
+	{0.609,0.484,0.484},
+	{0.734,0.484,0.484},
+	{0.859,0.484,0.484},
+	{0.984,0.484,0.484},
+	{0.234,0.609,0.484},
+	{0.359,0.609,0.484},
+	{0.484,0.609,0.484},
+	{0.609,0.609,0.484},
+	{0.734,0.609,0.484},
+	{0.859,0.609,0.484},
+	{0.984,0.609,0.484},
+	{0.234,0.734,0.484},
+	{0.359,0.734,0.484},
+	{0.484,0.734,0.484},
+	{0.609,0.734,0.484},
+	{0.734,0.734,0.484},
+	{0.859,0.734,0.484},
+	{0.984,0.734,0.484},
+	{0.234,0.859,0.484},
+	{0.359,0.859,0.484},
+	{0.484,0.859,0.484},
+	{0.609,0.859,0.484},
+	{0.734,0.859,0.484},
+	{0.859,0.859,0.484},
+	{0.984,0.859,0.484},
+	{0.234,0.984,0.484},
+	{0.359,0.984,0.484},
+	{0.484,0.984,0.484},
+	{0.609,0.984,0.484},
+	{0.734,0.984,0.484},
+	{0.859,0.984,0.484},
+	{0.984,0.984,0.484},
+	{0.234,0.234,0.609},
+	{0.359,0.234,0.609},
+	{0.484,0.234,0.609},
+	{0.609,0.234,0.609},
+	{0.734,0.234,0.609},
+	{0.859,0.234,0.609},
+	{0.984,0.234,0.609},
+	{0.234,0.359,0.609},
+	{0.359,0.359,0.609},
+	{0.484,0.359,0.609},
+	{0.609,0.359,0.609},
+	{0.734,0.359,0.609},
+	{0.859,0.359,0.609},
+	{0.984,0.359,0.609},
+	{0.234,0.484,0.609},
+	{0.359,0.484,0.609},
+	{0.484,0.484,0.609},
+	{0.609,0.484,0.609},
+	{0.734,0.484,0.609},
+	{0.859,0.484,0.609},
+	{0.984,0.484,0.609},
+	{0.234,0.609,0.609},
+	{0.359,0.609,0.609},
+	{0.484,0.609,0.609},
+	{0.609,0.609,0.609},
+	{0.734,0.609,0.609},
+	{0.859,0.609,0.609},
+	{0.984,0.609,0.609},
+	{0.234,0.734,0.609},
+	{0.359,0.734,0.609},
+	{0.484,0.734,0.609},
+	{0.609,0.734,0.609},
+	{0.734,0.734,0.609},
+	{0.859,0.734,0.609},
+	{0.984,0.734,0.609},
+	{0.234,0.859,0.609},
+	{0.359,0.859,0.609},
+	{0.484,0.859,0.609},
+	{0.609,0.859,0.609},
+	{0.734,0.859,0.609},
+	{0.859,0.859,0.609},
+	{0.984,0.859,0.609},
+	{0.234,0.984,0.609},
+	{0.359,0.984,0.609},
+	{0.484,0.984,0.609},
+	{0.609,0.984,0.609},
+	{0.734,0.984,0.609},
+	{0.859,0.984,0.609},
+	{0.984,0.984,0.609},
+	{0.234,0.234,0.734},
+	{0.359,0.234,0.734},
+	{0.484,0.234,0.734},
+	{0.609,0.234,0.734},
+	{0.734,0.234,0.734},
+	{0.859,0.234,0.734},
+	{0.984,0.234,0.734},
+	{0.234,0.359,0.734},
+	{0.359,0.359,0.734},
+	{0.484,0.359,0.734},
+	{0.609,0.359,0.734},
+	{0.734,0.359,0.734},
+	{0.859,0.359,0.734},
+	{0.984,0.359,0.734},
+	{0.234,0.484,0.734},
+	{0.359,0.484,0.734},
+	{0.484,0.484,0.734},
+	{0.609,0.484,0.734},
+	{0.734,0.484,0.734},
+	{0.859,0.484,0.734},
+	{0.984,0.484,0.734},
+	{0.234,0.609,0.734},
+	{0.359,0.609,0.734},
+	{0.484,0.609,0.734},
+	{0.609,0.609,0.734},
+	{0.734,0.609,0.734},
+	{0.859,0.609,0.734},
+	{0.984,0.609,0.734},
+	{0.234,0.734,0.734},
+	{0.359,0.734,0.734},
+	{0.484,0.734,0.734},
+	{0.609,0.734,0.734},
+	{0.734,0.734,0.734},
+	{0.859,0.734,0.734},
+	{0.984,0.734,0.734},
+	{0.234,0.859,0.734},
+	{0.359,0.859,0.734},
+	{0.484,0.859,0.734},
+	{0.609,0.859,0.734},
+	{0.734,0.859,0.734},
+	{0.859,0.859,0.734},
+	{0.984,0.969,0.938},
+	{0.625,0.625,0.641},
+	{0.500,0.500,0.500},
+	{0.984,0.000,0.000},
+	{0.000,0.984,0.000},
+	{0.984,0.984,0.000},
+	{0.000,0.000,0.984},
+	{0.984,0.000,0.984},
+	{0.000,0.984,0.984},
+	{0.000,0.000,0.000}
+};
+
+/*
+ * A palette maps the color values 0-255 that mandelbrot_iterations()
+ * and friends return (iteration counts, capped at 255) to RGB colors.
+ * Finding the nearest xterm color for an RGB color means searching
+ * all of them, so this is done once, when a palette is created, and
+ * xterm_color() is then a single lookup in the palette in use.
+ *
+ * Besides the built-in palettes below, callers can create their own
+ * from any number of RGB colors, or load one from a file, and switch
+ * to it with mandel_palette_use(). Setting MANDEL_PALETTE in the
+ * environment to a built-in name or a file picks the default one.
+ */
+#define MANDEL_PALETTE_NAME 32
+
+struct mandel_palette {
+	char name[MANDEL_PALETTE_NAME];
+	unsigned char rgb[256][3];
+	unsigned char xterm[256];	/* Nearest xterm color of every rgb[] */
+};
+
+static void palette_mandel(int val, unsigned char rgb[3])
+{
+	rgb[0] = 255.0 * mandel256[val].red;
+	rgb[1] = 255.0 * mandel256[val].green;
+	rgb[2] = 255.0 * mandel256[val].blue;
+}
+
+static void palette_gray(int val, unsigned char rgb[3])
+{
+	rgb[0] = rgb[1] = rgb[2] = val;
+}
+
+/* Black through red and yellow to white */
+static void palette_fire(int val, unsigned char rgb[3])
+{
+	rgb[0] = val < 85 ? 3 * val : 255;
+	rgb[1] = val < 85 ? 0 : val < 170 ? 3 * (val - 85) : 255;
+	rgb[2] = val < 170 ? 0 : 3 * (val - 170);
+}
+
+static const struct {
+	const char *name;
+	void (*rgb)(int val, unsigned char rgb[3]);
+} palette_builtins[] = {
+	{ "mandel",	palette_mandel },
+	{ "gray",	palette_gray },
+	{ "fire",	palette_fire },
+};
+
+#define MANDEL_PALETTE_BUILTINS \
+	(sizeof(palette_builtins) / sizeof(palette_builtins[0]))
+
+/* Built-in palettes are created the first time they are asked for */
+static struct mandel_palette *palette_builtin_made[MANDEL_PALETTE_BUILTINS];
+static const struct mandel_palette *palette_in_use;
+
+static void palette_make_lut(struct mandel_palette *p)
+{
+	int val;
+
+	for (val = 0; val < 256; val++)
+		p->xterm[val] = rgb2xterm(p->rgb[val]);
+}
+
+/*
+ * Creates a palette out of n RGB colors, spread evenly over the
+ * color values 0-255, so that e.g. a palette of two colors gives the
+ * first one to values 0-127. Returns NULL if out of memory.
+ */
+struct mandel_palette *mandel_palette_create(const char *name,
+	const unsigned char rgb[][3], int n)
+{
+	struct mandel_palette *p;
+	int val;
+
+	assert(n > 0);
+	if ((p = malloc(sizeof(*p))) == NULL)
+		return NULL;
+	snprintf(p->name, MANDEL_PALETTE_NAME, "%s", name);
+	for (val = 0; val < 256; val++)
+		memcpy(p->rgb[val], rgb[val * n / 256], 3);
+	palette_make_lut(p);
+
+	return p;
+}
+
+/*
+ * Loads a palette from a file of up to 256 lines of "red green blue",
+ * each 0-255; empty lines and lines starting with '#' are skipped.
+ * Returns NULL, with errno set, if the file cannot be read or has no
+ * colors in it (EINVAL), or if out of memory.
+ */
+struct mandel_palette *mandel_palette_load(const char *path)
+{
+	unsigned char rgb[256][3];
+	char line[256];
+	int r, g, b, n = 0;
+	FILE *f;
+
+	if ((f = fopen(path, "r")) == NULL)
+		return NULL;
+	while (n < 256 && fgets(line, sizeof(line), f)) {
+		if (line[strspn(line, " \t")] == '#' ||
+		    sscanf(line, "%d %d %d", &r, &g, &b) != 3)
+			continue;
+		if (r < 0 || r > 255 || g < 0 || g > 255 || b < 0 || b > 255)
+			continue;
+		rgb[n][0] = r;
+		rgb[n][1] = g;
+		rgb[n][2] = b;
+		n++;
+	}
+	fclose(f);
+
+	if (n == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return mandel_palette_create(path, rgb, n);
+}
+
+/* Returns the name of built-in palette i, or NULL past the last one */
+const char *mandel_palette_builtin_name(int i)
+{
+	return i >= 0 && i < MANDEL_PALETTE_BUILTINS ?
+		palette_builtins[i].name : NULL;
+}
+
+/* Returns the built-in palette called name, or NULL if there is none */
+const struct mandel_palette *mandel_palette_builtin(const char *name)
+{
+	struct mandel_palette *p;
+	unsigned char rgb[256][3];
+	int i, val;
+
+	for (i = 0; i < MANDEL_PALETTE_BUILTINS; i++)
+		if (!strcmp(name, palette_builtins[i].name))
+			break;
+	if (i == MANDEL_PALETTE_BUILTINS)
+		return NULL;
+
+	if ((p = __atomic_load_n(&palette_builtin_made[i],
+	    __ATOMIC_ACQUIRE)) != NULL)
+		return p;
+
+	for (val = 0; val < 256; val++)
+		palette_builtins[i].rgb(val, rgb[val]);
+	if ((p = mandel_palette_create(name, rgb, 256)) == NULL) {
+		fprintf(stderr, "Out of memory, failed to allocate a palette\n");
+		exit(1);
+	}
+
+	/* If another thread got there first, use its copy */
+	if (!__sync_bool_compare_and_swap(&palette_builtin_made[i], NULL, p)) {
+		free(p);
+		p = palette_builtin_made[i];
+	}
+	return p;
+}
+
+/*
+ * The palette given by MANDEL_PALETTE in the environment, if any,
+ * else the built-in "mandel" one. If it had to be loaded from a file,
+ * it is also stored in *loaded, for the caller to free if it does not
+ * use it; if MANDEL_PALETTE could not be used, *err is set to why.
+ */
+static const struct mandel_palette *palette_default(
+	struct mandel_palette **loaded, int *err)
+{
+	const struct mandel_palette *p = NULL;
+	const char *want = getenv("MANDEL_PALETTE");
+
+	*loaded = NULL;
+	*err = 0;
+	if (want && !(p = mandel_palette_builtin(want)) &&
+	    !(p = *loaded = mandel_palette_load(want)))
+		*err = errno;
+	return p ? p : mandel_palette_builtin("mandel");
+}
+
+static void palette_default_warn(int err)
+{
+	fprintf(stderr, "MANDEL_PALETTE: %s: %s, using the default\n",
+		getenv("MANDEL_PALETTE"), strerror(err));
+}
+
+/*
+ * Makes xterm_color() use palette p from now on. The palette
+ * must stay around while it is in use; NULL goes back to the default.
+ */
+void mandel_palette_use(const struct mandel_palette *p)
+{
+	struct mandel_palette *loaded;
+	int err;
+
+	if (!p) {
+		p = palette_default(&loaded, &err);
+		if (err)
+			palette_default_warn(err);
+	}
+	__atomic_store_n(&palette_in_use, p, __ATOMIC_RELEASE);
+}
+
+/* Returns the palette xterm_color() uses */
+const struct mandel_palette *mandel_palette_current(void)
+{
+	const struct mandel_palette *p;
+	struct mandel_palette *loaded;
+	int err;
+
+	if ((p = __atomic_load_n(&palette_in_use, __ATOMIC_ACQUIRE)) != NULL)
+		return p;
+
+	/* If another thread got there first, use its palette */
+	p = palette_default(&loaded, &err);
+	if (!__sync_bool_compare_and_swap(&palette_in_use, NULL, p)) {
+		mandel_palette_free(loaded);
+		return __atomic_load_n(&palette_in_use, __ATOMIC_ACQUIRE);
+	}
+	if (err)
+		palette_default_warn(err);
+	return p;
+}
+
+/* Store the RGB color of color value val in palette p into rgb[] */
+void mandel_palette_rgb(const struct mandel_palette *p, int val,
+	unsigned char rgb[3])
+{
+	if (val > 255)
+		val = 255;
+	memcpy(rgb, p->rgb[val], 3);
+}
+
+/* Returns the xterm color of color value val in palette p */
+unsigned char mandel_palette_color(const struct mandel_palette *p, int val)
+{
+	if (val > 255)
+		val = 255;
+	return p->xterm[val];
+}
+
+void mandel_palette_free(struct mandel_palette *p)
+{
+	free(p);
+}
+
+/*******************************************
+ *                                         *
+ * Functions to compute the Mandelbrot set *
+ *                                         *
+ *******************************************/
+
+/*
+ * Total number of iterations that did not have to be run, because
+ * a point was known to be in the set before reaching max iterations.
+ * Updated atomically, since the kernels run in many threads at once.
+ */
+static unsigned long long mandel_skipped;
+
+/*
+ * Total number of iterations actually run by mandel_iterations_at_point(),
+ * the batch and the streaming functions.
+ */
+static unsigned long long mandel_run;
+
+/*
+ * Returns the number of iterations saved so far by
+ * cardioid/bulb rejection and periodicity detection.
+ */
+unsigned long long mandel_skipped_iterations(void)
+{
+	return __sync_fetch_and_add(&mandel_skipped, 0);
+}
+
+/*
+ * Returns the number of iterations run so far by
+ * mandel_iterations_at_point(), the batch and the streaming
+ * functions, not counting the ones skipped. Benchmarks
+ * divide it by the time taken.
+ */
+unsigned long long mandel_run_iterations(void)
+{
+	return __sync_fetch_and_add(&mandel_run, 0);
+}
+
+/*
+ * Returns nonzero if (x,y) lies inside the main cardioid
+ * or inside the period-2 bulb, i.e., it is certainly part of
+ * the Mandelbrot Set and will never escape.
+ */
+static int mandel_in_main_bulbs(double x, double y)
+{
+	double xq = x - 0.25;
+	double q = xq * xq + y * y;
+
+	if (q * (q + xq) <= 0.25 * y * y)
+		return 1;
+	if ((x + 1.0) * (x + 1.0) + y * y <= 0.0625)
+		return 1;
+	return 0;
+}
+
+/*
+ * The actual escape time loop.
+ *
+ * Besides rejecting the main cardioid and period-2 bulb up front,
+ * it uses Brent's algorithm to detect cycles: z is saved at every
+ * power-of-two iteration, and if the orbit ever returns exactly to
+ * the saved value it is periodic and can never escape. The iterations
+ * saved this way are added to *skipped.
+ */
+static int mandel_iterate(double x, double y, int max,
+	unsigned long long *skipped)
+{
+	double x0 = x;
+	double y0 = y;
+	double xs = x, ys = y;
+	int check = 8;
+	int iter = 0;
+
+	if (mandel_in_main_bulbs(x0, y0)) {
+		*skipped += max;
+		return max;
+	}
+
+	while ( (x * x + y * y <= 4) && iter < max) {
+		double xt = x * x - y * y + x0;
+		double yt = 2 * x * y + y0;
+
+		x = xt;
+		y = yt;
+
+		++iter;
+
+		if (x == xs && y == ys) {
+			*skipped += max - iter;
+			return max;
+		}
+		if (iter == check) {
+			xs = x;
+			ys = y;
+			check <<= 1;
+		}
+	}
+
+	return iter;
+}
+
+/*
+ * This function takes a (x,y) point on the complex plane
+ * and uses the escape time algorithm to return a color value
+ * used to draw the Mandelbrot Set.
+ */
+int mandel_iterations_at_point(double x, double y, int max)
+{
+	unsigned long long skipped = 0;
+	int iter;
+
+	iter = mandel_iterate(x, y, max, &skipped);
+	if (skipped)
+		__sync_fetch_and_add(&mandel_skipped, skipped);
+	__sync_fetch_and_add(&mandel_run, iter - skipped);
+
+	return iter;
+}
+
+/*
+ * Once a point has escaped, its distance estimate is computed from a
+ * few more iterations, until |z| reaches this radius: the estimate is
+ * only exact in the limit of large |z|, and these iterations are cheap.
+ */
+#define MANDEL_DISTANCE_RADIUS 1e3
+#define MANDEL_DISTANCE_EXTRA 16
+
+/*
+ * Same as mandel_iterations_at_point(), but also tracking the
+ * derivative dz/dc along the orbit. If the point escapes, *dist is set
+ * to the distance estimate 2 |z| log|z| / |dz|; the true distance from
+ * the point to the set is between *dist / 4 and *dist.
+ *
+ * *same is set to the radius of the disk around the point in which
+ * every point is estimated to escape after the same number of
+ * iterations. It comes from the fractional escape time n - log2(log|z|
+ * / log 2), which is continuous, and whose gradient has a magnitude of
+ * about 2 / (log 2 * *dist).
+ *
+ * If the point does not escape, both are set to 0. Only the iterations
+ * of a point that escapes are accounted for here; one that does not is
+ * left to be iterated again, and accounted for, by the batch kernel.
+ */
+int mandel_distance_at_point(double x, double y, int max, double *dist,
+	double *same)
+{
+	double x0 = x;
+	double y0 = y;
+	double xs = x, ys = y;
+	double dx = 1, dy = 0;
+	double r2;
+	int check = 8;
+	double frac;
+	int iter = 0, extra;
+
+	*dist = *same = 0;
+	if (mandel_in_main_bulbs(x0, y0))
+		return max;
+
+	for (extra = 0; extra < MANDEL_DISTANCE_EXTRA; ) {
+		double xt, yt;
+
+		r2 = x * x + y * y;
+		if (r2 > 4) {
+			/* Escaped; keep going only for the estimate */
+			if (r2 > MANDEL_DISTANCE_RADIUS * MANDEL_DISTANCE_RADIUS)
+				break;
+			extra++;
+		} else if (iter == max) {
+			return iter;
+		}
+
+		/* dz' = 2 z dz + 1 */
+		xt = 2 * (x * dx - y * dy) + 1;
+		yt = 2 * (x * dy + y * dx);
+		dx = xt;
+		dy = yt;
+
+		xt = x * x - y * y + x0;
+		yt = 2 * x * y + y0;
+		x = xt;
+		y = yt;
+
+		if (extra)
+			continue;
+
+		++iter;
+
+		if (x == xs && y == ys)
+			return max;
+		if (iter == check) {
+			xs = x;
+			ys = y;
+			check <<= 1;
+		}
+	}
+
+	__sync_fetch_and_add(&mandel_run, iter);
+	r2 = x * x + y * y;
+	*dist = sqrt(r2) * log(r2) / sqrt(dx * dx + dy * dy);
+
+	/* How far past the escape radius of 2 the point is, in iterations */
+	frac = iter - (iter + extra - log2(log(r2) / (2 * M_LN2)));
+	if (frac > 0.5)
+		frac = 1 - frac;
+	*same = frac > 0 ? frac * M_LN2 / 2 * *dist : 0;
+	return iter;
+}
+
+/*
+ * Batched versions of mandel_iterations_at_point().
+ *
+ * Every kernel below computes iter[i] for the points (x[i], y[i]),
+ * 0 <= i < n, and gives exactly the same results as calling
+ * mandel_iterations_at_point() once per point. The vector kernels
+ * keep a mask of the lanes that are still active; a lane drops out
+ * of the mask as soon as its point escapes or its orbit is found to
+ * be periodic, and the vector is done when the mask is empty or max
+ * iterations have been reached. Whatever is left over at the end of
+ * the batch is done in scalar.
+ *
+ * Every kernel returns the number of iterations it skipped.
+ */
+static unsigned long long mandel_batch_scalar(const double x[],
+	const double y[], int n, int max, int iter[])
+{
+	unsigned long long skipped = 0;
+	int i;
+
+	for (i = 0; i < n; i++)
+		iter[i] = mandel_iterate(x[i], y[i], max, &skipped);
+
+	return skipped;
+}
+
+/*
+ * Lanes found periodic stop counting early; they really run to max.
+ */
+static unsigned long long mandel_batch_fixup(int iter[], int lanes,
+	int periodic, int max)
+{
+	unsigned long long skipped = 0;
+	int j;
+
+	for (j = 0; j < lanes; j++)
+		if (periodic & (1 << j)) {
+			skipped += max - iter[j];
+			iter[j] = max;
+		}
+
+	return skipped;
+}
+
+#if MANDEL_HAVE_X86
+__attribute__((target("sse2")))
+static unsigned long long mandel_batch_sse2(const double x[],
+	const double y[], int n, int max, int iter[])
+{
+	unsigned long long skipped = 0;
+	int i, k, check;
+	int64_t cnt[2];
+
+	for (i = 0; i + 2 <= n; i += 2) {
+		__m128d cx = _mm_loadu_pd(&x[i]);
+		__m128d cy = _mm_loadu_pd(&y[i]);
+		__m128d zx = cx, zy = cy;
+		__m128d sx = cx, sy = cy;
+		__m128d four = _mm_set1_pd(4.0);
+		__m128d active = _mm_castsi128_pd(_mm_set1_epi64x(-1));
+		__m128d periodic = _mm_setzero_pd();
+		__m128i count = _mm_setzero_si128();
+
+		for (k = 0, check = 8; k < max; k++) {
+			__m128d x2 = _mm_mul_pd(zx, zx);
+			__m128d y2 = _mm_mul_pd(zy, zy);
+			__m128d cycle;
+
+			active = _mm_and_pd(active,
+				_mm_cmple_pd(_mm_add_pd(x2, y2), four));
+			if (_mm_movemask_pd(active) == 0)
+				break;
+			/* Active lanes are all ones, i.e. -1 */
+			count = _mm_sub_epi64(count, _mm_castpd_si128(active));
+
+			zy = _mm_add_pd(_mm_mul_pd(_mm_add_pd(zx, zx), zy), cy);
+			zx = _mm_add_pd(_mm_sub_pd(x2, y2), cx);
+
+			cycle = _mm_and_pd(active, _mm_and_pd(
+				_mm_cmpeq_pd(zx, sx), _mm_cmpeq_pd(zy, sy)));
+			periodic = _mm_or_pd(periodic, cycle);
+			active = _mm_andnot_pd(cycle, active);
+			if (k + 1 == check) {
+				sx = zx;
+				sy = zy;
+				check <<= 1;
+			}
+		}
+		_mm_storeu_si128((__m128i *)cnt, count);
+		iter[i] = cnt[0];
+		iter[i + 1] = cnt[1];
+		skipped += mandel_batch_fixup(&iter[i], 2,
+			_mm_movemask_pd(periodic), max);
+	}
+
+	return skipped + mandel_batch_scalar(&x[i], &y[i], n - i, max, &iter[i]);
+}
+
+__attribute__((target("avx2")))
+static unsigned long long mandel_batch_avx2(const double x[],
+	const double y[], int n, int max, int iter[])
+{
+	unsigned long long skipped = 0;
+	int i, k, check;
+	int64_t cnt[4];
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m256d cx = _mm256_loadu_pd(&x[i]);
+		__m256d cy = _mm256_loadu_pd(&y[i]);
+		__m256d zx = cx, zy = cy;
+		__m256d sx = cx, sy = cy;
+		__m256d four = _mm256_set1_pd(4.0);
+		__m256d active = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+		__m256d periodic = _mm256_setzero_pd();
+		__m256i count = _mm256_setzero_si256();
+
+		for (k = 0, check = 8; k < max; k++) {
+			__m256d x2 = _mm256_mul_pd(zx, zx);
+			__m256d y2 = _mm256_mul_pd(zy, zy);
+			__m256d cycle;
+
+			active = _mm256_and_pd(active, _mm256_cmp_pd(
+				_mm256_add_pd(x2, y2), four, _CMP_LE_OQ));
+			if (_mm256_movemask_pd(active) == 0)
+				break;
+			count = _mm256_sub_epi64(count,
+				_mm256_castpd_si256(active));
+
+			zy = _mm256_add_pd(_mm256_mul_pd(
+				_mm256_add_pd(zx, zx), zy), cy);
+			zx = _mm256_add_pd(_mm256_sub_pd(x2, y2), cx);
+
+			cycle = _mm256_and_pd(active, _mm256_and_pd(
+				_mm256_cmp_pd(zx, sx, _CMP_EQ_OQ),
+				_mm256_cmp_pd(zy, sy, _CMP_EQ_OQ)));
+			periodic = _mm256_or_pd(periodic, cycle);
+			active = _mm256_andnot_pd(cycle, active);
+			if (k + 1 == check) {
+				sx = zx;
+				sy = zy;
+				check <<= 1;
+			}
+		}
+		_mm256_storeu_si256((__m256i *)cnt, count);
+		iter[i] = cnt[0];
+		iter[i + 1] = cnt[1];
+		iter[i + 2] = cnt[2];
+		iter[i + 3] = cnt[3];
+		skipped += mandel_batch_fixup(&iter[i], 4,
+			_mm256_movemask_pd(periodic), max);
+	}
+
+	return skipped + mandel_batch_sse2(&x[i], &y[i], n - i, max, &iter[i]);
+}
+
+/*
+ * AVX-512F implies FMA, and GCC would happily fuse the multiply-adds
+ * below. Fused results are rounded differently from the scalar loop,
+ * so contraction is turned off to keep results identical.
+ */
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+static unsigned long long mandel_batch_avx512(const double x[],
+	const double y[], int n, int max, int iter[])
+{
+	unsigned long long skipped = 0;
+	int i, k, check;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m512d cx = _mm512_loadu_pd(&x[i]);
+		__m512d cy = _mm512_loadu_pd(&y[i]);
+		__m512d zx = cx, zy = cy;
+		__m512d sx = cx, sy = cy;
+		__m512d four = _mm512_set1_pd(4.0);
+		__m256i count = _mm256_setzero_si256();
+		__m256i one = _mm256_set1_epi32(1);
+		__mmask8 active = 0xff, periodic = 0, cycle;
+
+		for (k = 0, check = 8; k < max; k++) {
+			__m512d x2 = _mm512_mul_pd(zx, zx);
+			__m512d y2 = _mm512_mul_pd(zy, zy);
+
+			active = _mm512_mask_cmp_pd_mask(active,
+				_mm512_add_pd(x2, y2), four, _CMP_LE_OQ);
+			if (active == 0)
+				break;
+			count = _mm512_castsi512_si256(_mm512_mask_add_epi32(
+				_mm512_castsi256_si512(count), active,
+				_mm512_castsi256_si512(count),
+				_mm512_castsi256_si512(one)));
+
+			zy = _mm512_add_pd(_mm512_mul_pd(
+				_mm512_add_pd(zx, zx), zy), cy);
+			zx = _mm512_add_pd(_mm512_sub_pd(x2, y2), cx);
+
+			cycle = _mm512_mask_cmp_pd_mask(
+				_mm512_mask_cmp_pd_mask(active, zx, sx, _CMP_EQ_OQ),
+				zy, sy, _CMP_EQ_OQ);
+			periodic |= cycle;
+			active &= ~cycle;
+			if (k + 1 == check) {
+				sx = zx;
+				sy = zy;
+				check <<= 1;
+			}
+		}
+		_mm256_storeu_si256((__m256i *)&iter[i], count);
+		skipped += mandel_batch_fixup(&iter[i], 8, periodic, max);
+	}
+
+	return skipped + mandel_batch_avx2(&x[i], &y[i], n - i, max, &iter[i]);
+}
+#endif /* MANDEL_HAVE_X86 */
+
+/*
+ * Single precision versions of the kernels above. They fit twice as
+ * many points in a vector, but only hold 24 bits of mantissa, so they
+ * are only good for shallow views (see mandel_pick_precision()).
+ */
+static int mandel_iterate_float(float x, float y, int max,
+	unsigned long long *skipped)
+{
+	float x0 = x;
+	float y0 = y;
+	float xs = x, ys = y;
+	int check = 8;
+	int iter = 0;
+
+	while ( (x * x + y * y <= 4) && iter < max) {
+		float xt = x * x - y * y + x0;
+		float yt = 2 * x * y + y0;
+
+		x = xt;
+		y = yt;
+
+		++iter;
+
+		if (x == xs && y == ys) {
+			*skipped += max - iter;
+			return max;
+		}
+		if (iter == check) {
+			xs = x;
+			ys = y;
+			check <<= 1;
+		}
+	}
+
+	return iter;
+}
+
+static unsigned long long mandel_batch_scalar_float(const float x[],
+	const float y[], int n, int max, int iter[])
+{
+	unsigned long long skipped = 0;
+	int i;
+
+	for (i = 0; i < n; i++)
+		iter[i] = mandel_iterate_float(x[i], y[i], max, &skipped);
+
+	return skipped;
+}
+
+#if MANDEL_HAVE_X86
+__attribute__((target("sse2")))
+static unsigned long long mandel_batch_sse2_float(const float x[],
+	const float y[], int n, int max, int iter[])
+{
+	unsigned long long skipped = 0;
+	int i, k, check;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128 cx = _mm_loadu_ps(&x[i]);
+		__m128 cy = _mm_loadu_ps(&y[i]);
+		__m128 zx = cx, zy = cy;
+		__m128 sx = cx, sy = cy;
+		__m128 four = _mm_set1_ps(4.0f);
+		__m128 active = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		__m128 periodic = _mm_setzero_ps();
+		__m128i count = _mm_setzero_si128();
+
+		for (k = 0, check = 8; k < max; k++) {
+			__m128 x2 = _mm_mul_ps(zx, zx);
+			__m128 y2 = _mm_mul_ps(zy, zy);
+			__m128 cycle;
+
+			active = _mm_and_ps(active,
+				_mm_cmple_ps(_mm_add_ps(x2, y2), four));
+			if (_mm_movemask_ps(active) == 0)
+				break;
+			count = _mm_sub_epi32(count, _mm_castps_si128(active));
+
+			zy = _mm_add_ps(_mm_mul_ps(_mm_add_ps(zx, zx), zy), cy);
+			zx = _mm_add_ps(_mm_sub_ps(x2, y2), cx);
+
+			cycle = _mm_and_ps(active, _mm_and_ps(
+				_mm_cmpeq_ps(zx, sx), _mm_cmpeq_ps(zy, sy)));
+			periodic = _mm_or_ps(periodic, cycle);
+			active = _mm_andnot_ps(cycle, active);
+			if (k + 1 == check) {
+				sx = zx;
+				sy = zy;
+				check <<= 1;
+			}
+		}
+		_mm_storeu_si128((__m128i *)&iter[i], count);
+		skipped += mandel_batch_fixup(&iter[i], 4,
+			_mm_movemask_ps(periodic), max);
+	}
+
+	return skipped +
+		mandel_batch_scalar_float(&x[i], &y[i], n - i, max, &iter[i]);
+}
+
+__attribute__((target("avx2")))
+static unsigned long long mandel_batch_avx2_float(const float x[],
+	const float y[], int n, int max, int iter[])
+{
+	unsigned long long skipped = 0;
+	int i, k, check;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256 cx = _mm256_loadu_ps(&x[i]);
+		__m256 cy = _mm256_loadu_ps(&y[i]);
+		__m256 zx = cx, zy = cy;
+		__m256 sx = cx, sy = cy;
+		__m256 four = _mm256_set1_ps(4.0f);
+		__m256 active = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		__m256 periodic = _mm256_setzero_ps();
+		__m256i count = _mm256_setzero_si256();
+
+		for (k = 0, check = 8; k < max; k++) {
+			__m256 x2 = _mm256_mul_ps(zx, zx);
+			__m256 y2 = _mm256_mul_ps(zy, zy);
+			__m256 cycle;
+
+			active = _mm256_and_ps(active, _mm256_cmp_ps(
+				_mm256_add_ps(x2, y2), four, _CMP_LE_OQ));
+			if (_mm256_movemask_ps(active) == 0)
+				break;
+			count = _mm256_sub_epi32(count,
+				_mm256_castps_si256(active));
+
+			zy = _mm256_add_ps(_mm256_mul_ps(
+				_mm256_add_ps(zx, zx), zy), cy);
+			zx = _mm256_add_ps(_mm256_sub_ps(x2, y2), cx);
+
+			cycle = _mm256_and_ps(active, _mm256_and_ps(
+				_mm256_cmp_ps(zx, sx, _CMP_EQ_OQ),
+				_mm256_cmp_ps(zy, sy, _CMP_EQ_OQ)));
+			periodic = _mm256_or_ps(periodic, cycle);
+			active = _mm256_andnot_ps(cycle, active);
+			if (k + 1 == check) {
+				sx = zx;
+				sy = zy;
+				check <<= 1;
+			}
+		}
+		_mm256_storeu_si256((__m256i *)&iter[i], count);
+		skipped += mandel_batch_fixup(&iter[i], 8,
+			_mm256_movemask_ps(periodic), max);
+	}
+
+	return skipped +
+		mandel_batch_sse2_float(&x[i], &y[i], n - i, max, &iter[i]);
+}
+
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+static unsigned long long mandel_batch_avx512_float(const float x[],
+	const float y[], int n, int max, int iter[])
+{
+	unsigned long long skipped = 0;
+	int i, k, check;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m512 cx = _mm512_loadu_ps(&x[i]);
+		__m512 cy = _mm512_loadu_ps(&y[i]);
+		__m512 zx = cx, zy = cy;
+		__m512 sx = cx, sy = cy;
+		__m512 four = _mm512_set1_ps(4.0f);
+		__m512i count = _mm512_setzero_si512();
+		__m512i one = _mm512_set1_epi32(1);
+		__mmask16 active = 0xffff, periodic = 0, cycle;
+
+		for (k = 0, check = 8; k < max; k++) {
+			__m512 x2 = _mm512_mul_ps(zx, zx);
+			__m512 y2 = _mm512_mul_ps(zy, zy);
+
+			active = _mm512_mask_cmp_ps_mask(active,
+				_mm512_add_ps(x2, y2), four, _CMP_LE_OQ);
+			if (active == 0)
+				break;
+			count = _mm512_mask_add_epi32(count, active, count, one);
+
+			zy = _mm512_add_ps(_mm512_mul_ps(
+				_mm512_add_ps(zx, zx), zy), cy);
+			zx = _mm512_add_ps(_mm512_sub_ps(x2, y2), cx);
+
+			cycle = _mm512_mask_cmp_ps_mask(
+				_mm512_mask_cmp_ps_mask(active, zx, sx, _CMP_EQ_OQ),
+				zy, sy, _CMP_EQ_OQ);
+			periodic |= cycle;
+			active &= ~cycle;
+			if (k + 1 == check) {
+				sx = zx;
+				sy = zy;
+				check <<= 1;
+			}
+		}
+		_mm512_storeu_si512((void *)&iter[i], count);
+		skipped += mandel_batch_fixup(&iter[i], 16, periodic, max);
+	}
+
+	return skipped +
+		mandel_batch_avx2_float(&x[i], &y[i], n - i, max, &iter[i]);
+}
+#endif /* MANDEL_HAVE_X86 */
+
+/*
+ * Fixed-point versions of the kernels: every coordinate is a 32-bit
+ * integer with MANDEL_FIXED_SHIFT fractional bits. Orbits that have
+ * not escaped stay within |z| <= 2 + |c|, and their squares below 64,
+ * which is what the 6 integer bits (with the sign) are for. With 25
+ * fractional bits, they resolve about as much as float does.
+ *
+ * The scalar and vector versions compute exactly the same thing, and
+ * the products are truncated the same way in both.
+ */
+#define MANDEL_FIXED_SHIFT 25
+#define MANDEL_FIXED_FOUR (4 << MANDEL_FIXED_SHIFT)
+
+static int32_t mandel_to_fixed(double v)
+{
+	v *= 1 << MANDEL_FIXED_SHIFT;
+	return v >= 0 ? (int32_t)(v + 0.5) : (int32_t)(v - 0.5);
+}
+
+static int32_t mandel_fixed_mul(int32_t a, int32_t b)
+{
+	return (int32_t)(((int64_t)a * b) >> MANDEL_FIXED_SHIFT);
+}
+
+static int mandel_iterate_fixed(int32_t x, int32_t y, int max,
+	unsigned long long *skipped)
+{
+	int32_t x0 = x, y0 = y, xs = x, ys = y, x2, y2;
+	int check = 8;
+	int iter = 0;
+
+	for (;;) {
+		x2 = mandel_fixed_mul(x, x);
+		y2 = mandel_fixed_mul(y, y);
+		/* Only add the squares up when they cannot overflow */
+		if (x2 > MANDEL_FIXED_FOUR || y2 > MANDEL_FIXED_FOUR ||
+		    x2 + y2 > MANDEL_FIXED_FOUR || iter >= max)
+			break;
+
+		y = 2 * mandel_fixed_mul(x, y) + y0;
+		x = x2 - y2 + x0;
+
+		++iter;
+
+		if (x == xs && y == ys) {
+			*skipped += max - iter;
+			return max;
+		}
+		if (iter == check) {
+			xs = x;
+			ys = y;
+			check <<= 1;
+		}
+	}
+
+	return iter;
+}
+
+static unsigned long long mandel_batch_scalar_fixed(const int32_t x[],
+	const int32_t y[], int n, int max, int iter[])
+{
+	unsigned long long skipped = 0;
+	int i;
+
+	for (i = 0; i < n; i++)
+		iter[i] = mandel_iterate_fixed(x[i], y[i], max, &skipped);
+
+	return skipped;
+}
+
+#if MANDEL_HAVE_X86
+/*
+ * There is no 32x32->64 bit multiply for all lanes at once, only for
+ * the even ones, so multiply the even and the odd lanes separately and
+ * merge the middle 32 bits of the products back together.
+ */
+__attribute__((target("avx2")))
+static inline __m256i mandel_fixed_mul_avx2(__m256i a, __m256i b)
+{
+	__m256i even, odd;
+
+	even = _mm256_srli_epi64(_mm256_mul_epi32(a, b), MANDEL_FIXED_SHIFT);
+	odd = _mm256_mul_epi32(_mm256_srli_epi64(a, 32),
+		_mm256_srli_epi64(b, 32));
+	odd = _mm256_slli_epi64(_mm256_srli_epi64(odd, MANDEL_FIXED_SHIFT), 32);
+
+	return _mm256_blend_epi32(even, odd, 0xaa);
+}
+
+__attribute__((target("avx2")))
+static unsigned long long mandel_batch_avx2_fixed(const int32_t x[],
+	const int32_t y[], int n, int max, int iter[])
+{
+	unsigned long long skipped = 0;
+	int i, k, check;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i cx = _mm256_loadu_si256((const __m256i *)&x[i]);
+		__m256i cy = _mm256_loadu_si256((const __m256i *)&y[i]);
+		__m256i zx = cx, zy = cy;
+		__m256i sx = cx, sy = cy;
+		__m256i four = _mm256_set1_epi32(MANDEL_FIXED_FOUR);
+		__m256i active = _mm256_set1_epi32(-1);
+		__m256i periodic = _mm256_setzero_si256();
+		__m256i count = _mm256_setzero_si256();
+
+		for (k = 0, check = 8; k < max; k++) {
+			__m256i x2 = mandel_fixed_mul_avx2(zx, zx);
+			__m256i y2 = mandel_fixed_mul_avx2(zy, zy);
+			__m256i xy, cycle;
+
+			active = _mm256_andnot_si256(_mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpgt_epi32(x2, four),
+					_mm256_cmpgt_epi32(y2, four)),
+				_mm256_cmpgt_epi32(_mm256_add_epi32(x2, y2), four)),
+				active);
+			if (_mm256_testz_si256(active, active))
+				break;
+			count = _mm256_sub_epi32(count, active);
+
+			xy = mandel_fixed_mul_avx2(zx, zy);
+			zy = _mm256_add_epi32(_mm256_add_epi32(xy, xy), cy);
+			zx = _mm256_add_epi32(_mm256_sub_epi32(x2, y2), cx);
+
+			cycle = _mm256_and_si256(active, _mm256_and_si256(
+				_mm256_cmpeq_epi32(zx, sx),
+				_mm256_cmpeq_epi32(zy, sy)));
+			periodic = _mm256_or_si256(periodic, cycle);
+			active = _mm256_andnot_si256(cycle, active);
+			if (k + 1 == check) {
+				sx = zx;
+				sy = zy;
+				check <<= 1;
+			}
+		}
+		_mm256_storeu_si256((__m256i *)&iter[i], count);
+		skipped += mandel_batch_fixup(&iter[i], 8,
+			_mm256_movemask_ps(_mm256_castsi256_ps(periodic)), max);
+	}
+
+	return skipped +
+		mandel_batch_scalar_fixed(&x[i], &y[i], n - i, max, &iter[i]);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i mandel_fixed_mul_avx512(__m512i a, __m512i b)
+{
+	__m512i even, odd;
+
+	even = _mm512_srli_epi64(_mm512_mul_epi32(a, b), MANDEL_FIXED_SHIFT);
+	odd = _mm512_mul_epi32(_mm512_srli_epi64(a, 32),
+		_mm512_srli_epi64(b, 32));
+	odd = _mm512_slli_epi64(_mm512_srli_epi64(odd, MANDEL_FIXED_SHIFT), 32);
+
+	return _mm512_mask_blend_epi32(0xaaaa, even, odd);
+}
+
+__attribute__((target("avx512f")))
+static unsigned long long mandel_batch_avx512_fixed(const int32_t x[],
+	const int32_t y[], int n, int max, int iter[])
+{
+	unsigned long long skipped = 0;
+	int i, k, check;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m512i cx = _mm512_loadu_si512((const void *)&x[i]);
+		__m512i cy = _mm512_loadu_si512((const void *)&y[i]);
+		__m512i zx = cx, zy = cy;
+		__m512i sx = cx, sy = cy;
+		__m512i four = _mm512_set1_epi32(MANDEL_FIXED_FOUR);
+		__m512i count = _mm512_setzero_si512();
+		__m512i one = _mm512_set1_epi32(1);
+		__mmask16 active = 0xffff, periodic = 0, cycle;
+
+		for (k = 0, check = 8; k < max; k++) {
+			__m512i x2 = mandel_fixed_mul_avx512(zx, zx);
+			__m512i y2 = mandel_fixed_mul_avx512(zy, zy);
+			__m512i xy;
+
+			active = _mm512_mask_cmple_epi32_mask(
+				_mm512_mask_cmple_epi32_mask(
+					_mm512_mask_cmple_epi32_mask(active,
+						x2, four),
+					y2, four),
+				_mm512_add_epi32(x2, y2), four);
+			if (active == 0)
+				break;
+			count = _mm512_mask_add_epi32(count, active, count, one);
+
+			xy = mandel_fixed_mul_avx512(zx, zy);
+			zy = _mm512_add_epi32(_mm512_add_epi32(xy, xy), cy);
+			zx = _mm512_add_epi32(_mm512_sub_epi32(x2, y2), cx);
+
+			cycle = _mm512_mask_cmpeq_epi32_mask(
+				_mm512_mask_cmpeq_epi32_mask(active, zx, sx),
+				zy, sy);
+			periodic |= cycle;
+			active &= ~cycle;
+			if (k + 1 == check) {
+				sx = zx;
+				sy = zy;
+				check <<= 1;
+			}
+		}
+		_mm512_storeu_si512((void *)&iter[i], count);
+		skipped += mandel_batch_fixup(&iter[i], 16, periodic, max);
+	}
+
+	return skipped +
+		mandel_batch_avx2_fixed(&x[i], &y[i], n - i, max, &iter[i]);
+}
+#endif /* MANDEL_HAVE_X86 */
+
+/*
+ * Streaming kernels, for mandel_iterations_stream().
+ *
+ * The batch kernels above keep a vector busy until its slowest lane is
+ * done, so near the boundary most lanes sit idle while one point runs
+ * on towards max. The streaming kernels instead hand a lane the next
+ * pending point as soon as the point in it escapes, reaches max or is
+ * found periodic, so every lane holds a point until the source of
+ * points runs dry. Each lane counts its own iterations and does its
+ * own cycle detection, exactly as mandel_iterate() does.
+ *
+ * The vector state of every lane is spilled to struct mandel_lanes
+ * whenever a lane finishes, so that finishing and refilling lanes is
+ * done once, in plain C, for all the kernels.
+ *
+ * With a state array (see mandel_iterations_resume()), point id starts
+ * from state[id] instead of from z = c, and its final z goes back there.
+ */
+#define MANDEL_STREAM_LANES 8
+
+struct mandel_stream {
+	mandel_next_fn *next;
+	mandel_done_fn *done;
+	void *arg;
+	int max;
+	struct mandel_state *state;	/* Where points start, or NULL */
+	int drained;			/* next() has run out of points */
+	unsigned long long skipped;
+	unsigned long long busy;	/* Iterations done by lanes */
+	unsigned long long slots;	/* Iterations done by vectors, times width */
+};
+
+struct mandel_lanes {
+	double cx[MANDEL_STREAM_LANES], cy[MANDEL_STREAM_LANES];
+	double zx[MANDEL_STREAM_LANES], zy[MANDEL_STREAM_LANES];
+	double sx[MANDEL_STREAM_LANES], sy[MANDEL_STREAM_LANES];
+	int64_t count[MANDEL_STREAM_LANES];
+	int64_t start[MANDEL_STREAM_LANES];	/* count when loaded */
+	int64_t check[MANDEL_STREAM_LANES];
+	int64_t on[MANDEL_STREAM_LANES];	/* -1 if active, else 0 */
+	int id[MANDEL_STREAM_LANES];
+	unsigned active;
+};
+
+static unsigned long long mandel_stream_busy;
+static unsigned long long mandel_stream_slots;
+
+/*
+ * Returns how many lane iterations the streaming kernels have done
+ * so far, out of how many they could have done with every lane busy.
+ */
+void mandel_stream_stats(unsigned long long *busy, unsigned long long *slots)
+{
+	*busy = __sync_fetch_and_add(&mandel_stream_busy, 0);
+	*slots = __sync_fetch_and_add(&mandel_stream_slots, 0);
+}
+
+/*
+ * Get the next point that needs iterating from the source, storing its
+ * coordinates in *x, *y. Points inside the main bulbs are finished
+ * right away. Returns the id of the point, or -1 if there are no more.
+ */
+static int mandel_stream_fetch(struct mandel_stream *s, double *x, double *y)
+{
+	int id;
+
+	while (!s->drained) {
+		if ((id = s->next(s->arg, x, y)) < 0) {
+			s->drained = 1;
+			break;
+		}
+		if (!mandel_in_main_bulbs(*x, *y))
+			return id;
+		s->skipped += s->max;
+		s->done(s->arg, id, s->max);
+	}
+
+	return -1;
+}
+
+/*
+ * Retire the lanes in finished, reporting their iteration counts
+ * (max for the ones in periodic), then load new points into every
+ * free lane of the first lanes. Returns the new mask of active lanes.
+ */
+static unsigned mandel_stream_refill(struct mandel_stream *s,
+	struct mandel_lanes *l, int lanes, unsigned finished, unsigned periodic)
+{
+	struct mandel_state *st;
+	int j;
+
+	for (j = 0; j < lanes; j++) {
+		if (!(finished & (1u << j)))
+			continue;
+		s->busy += l->count[j] - l->start[j];
+		if (periodic & (1u << j))
+			s->skipped += s->max - l->count[j];
+		if (s->state) {
+			st = &s->state[l->id[j]];
+			st->zx = l->zx[j];
+			st->zy = l->zy[j];
+			st->iter = periodic & (1u << j) ? s->max : l->count[j];
+			st->inside = !!(periodic & (1u << j));
+		}
+		s->done(s->arg, l->id[j],
+			periodic & (1u << j) ? s->max : l->count[j]);
+		l->active &= ~(1u << j);
+		l->on[j] = 0;
+	}
+
+	for (j = 0; j < lanes; j++) {
+		if (l->active & (1u << j))
+			continue;
+		if ((l->id[j] = mandel_stream_fetch(s, &l->cx[j], &l->cy[j])) < 0)
+			break;
+		if (s->state) {
+			st = &s->state[l->id[j]];
+			l->zx[j] = l->sx[j] = st->zx;
+			l->zy[j] = l->sy[j] = st->zy;
+			l->count[j] = l->start[j] = st->iter;
+		} else {
+			l->zx[j] = l->sx[j] = l->cx[j];
+			l->zy[j] = l->sy[j] = l->cy[j];
+			l->count[j] = l->start[j] = 0;
+		}
+		for (l->check[j] = 8; l->check[j] <= l->count[j];)
+			l->check[j] <<= 1;
+		l->on[j] = -1;
+		l->active |= 1u << j;
+	}
+
+	return l->active;
+}
+
+/*
+ * mandel_iterate(), starting from and updating the state st of the
+ * point (x0, y0). A point found periodic is marked inside.
+ */
+static int mandel_iterate_state(double x0, double y0,
+	struct mandel_state *st, int max, unsigned long long *skipped)
+{
+	double x = st->zx, y = st->zy;
+	double xs = x, ys = y;
+	int iter = st->iter;
+	int check = 8;
+
+	while (check <= iter)
+		check <<= 1;
+
+	while ( (x * x + y * y <= 4) && iter < max) {
+		double xt = x * x - y * y + x0;
+		double yt = 2 * x * y + y0;
+
+		x = xt;
+		y = yt;
+
+		++iter;
+
+		if (x == xs && y == ys) {
+			*skipped += max - iter;
+			iter = max;
+			st->inside = 1;
+			break;
+		}
+		if (iter == check) {
+			xs = x;
+			ys = y;
+			check <<= 1;
+		}
+	}
+
+	st->zx = x;
+	st->zy = y;
+	st->iter = iter;
+	return iter;
+}
+
+static void mandel_stream_scalar(struct mandel_stream *s)
+{
+	struct mandel_state fresh, *st;
+	unsigned long long skipped;
+	double x, y;
+	int id, iter, start;
+
+	while ((id = mandel_stream_fetch(s, &x, &y)) >= 0) {
+		if (s->state) {
+			st = &s->state[id];
+		} else {
+			st = &fresh;
+			mandel_state_init(st, &x, &y, 1);
+		}
+		start = st->iter;
+		skipped = 0;
+		iter = mandel_iterate_state(x, y, st, s->max, &skipped);
+		s->skipped += skipped;
+		s->busy += iter - start - skipped;
+		s->slots += iter - start - skipped;
+		s->done(s->arg, id, iter);
+	}
+}
+
+#if MANDEL_HAVE_X86
+__attribute__((target("avx2")))
+static void mandel_stream_avx2(struct mandel_stream *s)
+{
+	struct mandel_lanes l = { .active = 0 };
+	__m256d four = _mm256_set1_pd(4.0);
+	__m256i maxv = _mm256_set1_epi64x(s->max);
+	unsigned finished = 0, periodic = 0;
+	unsigned long long steps;
+
+	while (mandel_stream_refill(s, &l, 4, finished, periodic)) {
+		__m256d cx = _mm256_loadu_pd(l.cx), cy = _mm256_loadu_pd(l.cy);
+		__m256d zx = _mm256_loadu_pd(l.zx), zy = _mm256_loadu_pd(l.zy);
+		__m256d sx = _mm256_loadu_pd(l.sx), sy = _mm256_loadu_pd(l.sy);
+		__m256i count = _mm256_loadu_si256((__m256i *)l.count);
+		__m256i check = _mm256_loadu_si256((__m256i *)l.check);
+		__m256d active = _mm256_loadu_pd((double *)l.on);
+		__m256d cycle, save;
+
+		periodic = 0;
+
+		for (steps = 0;; steps++) {
+			__m256d x2 = _mm256_mul_pd(zx, zx);
+			__m256d y2 = _mm256_mul_pd(zy, zy);
+
+			finished = _mm256_movemask_pd(_mm256_and_pd(active,
+				_mm256_or_pd(_mm256_cmp_pd(_mm256_add_pd(x2, y2),
+						four, _CMP_NLE_UQ),
+					_mm256_castsi256_pd(
+						_mm256_cmpeq_epi64(count, maxv)))));
+			if (finished)
+				break;
+			/* Active lanes are all ones, i.e. -1 */
+			count = _mm256_sub_epi64(count,
+				_mm256_castpd_si256(active));
+
+			zy = _mm256_add_pd(_mm256_mul_pd(
+				_mm256_add_pd(zx, zx), zy), cy);
+			zx = _mm256_add_pd(_mm256_sub_pd(x2, y2), cx);
+
+			cycle = _mm256_and_pd(active, _mm256_and_pd(
+				_mm256_cmp_pd(zx, sx, _CMP_EQ_OQ),
+				_mm256_cmp_pd(zy, sy, _CMP_EQ_OQ)));
+			save = _mm256_and_pd(active, _mm256_castsi256_pd(
+				_mm256_cmpeq_epi64(count, check)));
+			sx = _mm256_blendv_pd(sx, zx, save);
+			sy = _mm256_blendv_pd(sy, zy, save);
+			check = _mm256_add_epi64(check, _mm256_and_si256(check,
+				_mm256_castpd_si256(save)));
+			if ((periodic = _mm256_movemask_pd(cycle))) {
+				finished = periodic;
+				steps++;
+				break;
+			}
+		}
+		s->slots += 4 * steps;
+
+		_mm256_storeu_pd(l.zx, zx);
+		_mm256_storeu_pd(l.zy, zy);
+		_mm256_storeu_pd(l.sx, sx);
+		_mm256_storeu_pd(l.sy, sy);
+		_mm256_storeu_si256((__m256i *)l.count, count);
+		_mm256_storeu_si256((__m256i *)l.check, check);
+	}
+}
+
+/* See mandel_batch_avx512() for fp-contract */
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+static void mandel_stream_avx512(struct mandel_stream *s)
+{
+	struct mandel_lanes l = { .active = 0 };
+	__m512d four = _mm512_set1_pd(4.0);
+	__m512i maxv = _mm512_set1_epi64(s->max);
+	__m512i one = _mm512_set1_epi64(1);
+	unsigned finished = 0, periodic = 0;
+	unsigned long long steps;
+
+	while (mandel_stream_refill(s, &l, 8, finished, periodic)) {
+		__m512d cx = _mm512_loadu_pd(l.cx), cy = _mm512_loadu_pd(l.cy);
+		__m512d zx = _mm512_loadu_pd(l.zx), zy = _mm512_loadu_pd(l.zy);
+		__m512d sx = _mm512_loadu_pd(l.sx), sy = _mm512_loadu_pd(l.sy);
+		__m512i count = _mm512_loadu_si512(l.count);
+		__m512i check = _mm512_loadu_si512(l.check);
+		__mmask8 active = l.active, cycle, save;
+
+		periodic = 0;
+
+		for (steps = 0;; steps++) {
+			__m512d x2 = _mm512_mul_pd(zx, zx);
+			__m512d y2 = _mm512_mul_pd(zy, zy);
+
+			finished = _mm512_mask_cmp_pd_mask(active,
+				_mm512_add_pd(x2, y2), four, _CMP_NLE_UQ) |
+				_mm512_mask_cmpeq_epi64_mask(active, count, maxv);
+			if (finished)
+				break;
+			count = _mm512_mask_add_epi64(count, active, count, one);
+
+			zy = _mm512_add_pd(_mm512_mul_pd(
+				_mm512_add_pd(zx, zx), zy), cy);
+			zx = _mm512_add_pd(_mm512_sub_pd(x2, y2), cx);
+
+			cycle = _mm512_mask_cmp_pd_mask(
+				_mm512_mask_cmp_pd_mask(active, zx, sx, _CMP_EQ_OQ),
+				zy, sy, _CMP_EQ_OQ);
+			save = _mm512_mask_cmpeq_epi64_mask(active, count, check);
+			sx = _mm512_mask_mov_pd(sx, save, zx);
+			sy = _mm512_mask_mov_pd(sy, save, zy);
+			check = _mm512_mask_add_epi64(check, save, check, check);
+			if ((periodic = cycle)) {
+				finished = periodic;
+				steps++;
+				break;
+			}
+		}
+		s->slots += 8 * steps;
+
+		_mm512_storeu_pd(l.zx, zx);
+		_mm512_storeu_pd(l.zy, zy);
+		_mm512_storeu_pd(l.sx, sx);
+		_mm512_storeu_pd(l.sy, sy);
+		_mm512_storeu_si512(l.count, count);
+		_mm512_storeu_si512(l.check, check);
+	}
+}
+#endif /* MANDEL_HAVE_X86 */
+
+typedef unsigned long long mandel_batch_fn(const double [], const double [],
+	int, int, int []);
+typedef unsigned long long mandel_batch_float_fn(const float [],
+	const float [], int, int, int []);
+typedef unsigned long long mandel_batch_fixed_fn(const int32_t [],
+	const int32_t [], int, int, int []);
+typedef void mandel_stream_kernel_fn(struct mandel_stream *);
+
+/*
+ * SSE2 has no signed 32x32->64 bit multiply, so its fixed-point
+ * kernel is the scalar one. Two lanes are too few for refilling
+ * them to pay off, so its streaming kernel is the scalar one too.
+ */
+static struct {
+	const char *name;
+	mandel_batch_fn *fn;
+	mandel_batch_float_fn *float_fn;
+	mandel_batch_fixed_fn *fixed_fn;
+	mandel_stream_kernel_fn *stream_fn;
+} mandel_kernels[] = {
+#if MANDEL_HAVE_X86
+	{ "avx512", mandel_batch_avx512, mandel_batch_avx512_float,
+		mandel_batch_avx512_fixed, mandel_stream_avx512 },
+	{ "avx2",   mandel_batch_avx2,   mandel_batch_avx2_float,
+		mandel_batch_avx2_fixed, mandel_stream_avx2 },
+	{ "sse2",   mandel_batch_sse2,   mandel_batch_sse2_float,
+		mandel_batch_scalar_fixed, mandel_stream_scalar },
+#endif
+	{ "scalar", mandel_batch_scalar, mandel_batch_scalar_float,
+		mandel_batch_scalar_fixed, mandel_stream_scalar }
+};
+
+static int mandel_kernel_selected = -1;
+
+/*
+ * Check whether the CPU we are running on can execute
+ * the kernel at position k of mandel_kernels[].
+ */
+static int mandel_kernel_supported(int k)
+{
+#if MANDEL_HAVE_X86
+	__builtin_cpu_init();
+	if (!strcmp(mandel_kernels[k].name, "avx512"))
+		return __builtin_cpu_supports("avx512f");
+	if (!strcmp(mandel_kernels[k].name, "avx2"))
+		return __builtin_cpu_supports("avx2");
+	if (!strcmp(mandel_kernels[k].name, "sse2"))
+		return __builtin_cpu_supports("sse2");
+#endif
+	return 1;
+}
+
+/*
+ * Pick the widest kernel the CPU supports. The choice can be
+ * forced (for benchmarking or debugging) by setting MANDEL_SIMD
+ * to one of "avx512", "avx2", "sse2" or "scalar" in the environment.
+ * Asking for a kernel the CPU cannot run falls back to autodetection.
+ */
+static int mandel_kernel_select(void)
+{
+	int k, nkernels = sizeof(mandel_kernels) / sizeof(mandel_kernels[0]);
+	const char *want = getenv("MANDEL_SIMD");
+
+	if (want)
+		for (k = 0; k < nkernels; k++)
+			if (!strcmp(want, mandel_kernels[k].name) &&
+			    mandel_kernel_supported(k))
+				return k;
+
+	for (k = 0; k < nkernels; k++)
+		if (mandel_kernel_supported(k))
+			return k;
+
+	return nkernels - 1;
+}
+
+/*
+ * The position in mandel_kernels[] of the kernel in use, picked on
+ * first use. Threads racing to pick it all pick the same one.
+ */
+static int mandel_kernel(void)
+{
+	int k = __atomic_load_n(&mandel_kernel_selected, __ATOMIC_ACQUIRE);
+
+	if (k < 0) {
+		k = mandel_kernel_select();
+		__atomic_store_n(&mandel_kernel_selected, k, __ATOMIC_RELEASE);
+	}
+	return k;
+}
+
+/*
+ * Returns the name of the kernel used by mandel_iterations_batch().
+ */
+const char *mandel_simd_name(void)
+{
+	return mandel_kernels[mandel_kernel()].name;
+}
+
+/*
+ * Points are handed to the kernels in chunks of this many,
+ * after the ones inside the main cardioid or the period-2 bulb
+ * have been filtered out.
+ */
+#define MANDEL_BATCH_CHUNK 256
+
+/*
+ * Filter out the points inside the main bulbs, hand the rest to the
+ * selected kernel in the given precision (MANDEL_DOUBLE, MANDEL_FLOAT
+ * or MANDEL_FIXED), and account for the iterations skipped.
+ */
+static void mandel_batch_run(enum mandel_precision prec,
+	const double x[], const double y[], int n, int max, int iter[])
+{
+	double bx[MANDEL_BATCH_CHUNK], by[MANDEL_BATCH_CHUNK];
+	float fx[MANDEL_BATCH_CHUNK], fy[MANDEL_BATCH_CHUNK];
+	int32_t ix[MANDEL_BATCH_CHUNK], iy[MANDEL_BATCH_CHUNK];
+	int bidx[MANDEL_BATCH_CHUNK], biter[MANDEL_BATCH_CHUNK];
+	unsigned long long skipped = 0, run = 0;
+	int i, j, m, k = mandel_kernel();
+
+	for (i = 0; i < n; i += MANDEL_BATCH_CHUNK) {
+		/* Keep only the points that really need iterating */
+		for (j = i, m = 0; j < n && j < i + MANDEL_BATCH_CHUNK; j++) {
+			if (mandel_in_main_bulbs(x[j], y[j])) {
+				iter[j] = max;
+				skipped += max;
+				continue;
+			}
+			switch (prec) {
+			case MANDEL_FLOAT:
+				fx[m] = x[j];
+				fy[m] = y[j];
+				break;
+			case MANDEL_FIXED:
+				/* These escape right away, and do not fit */
+				if (fabs(x[j]) > 2 || fabs(y[j]) > 2) {
+					iter[j] = 0;
+					continue;
+				}
+				ix[m] = mandel_to_fixed(x[j]);
+				iy[m] = mandel_to_fixed(y[j]);
+				break;
+			default:
+				bx[m] = x[j];
+				by[m] = y[j];
+			}
+			bidx[m++] = j;
+		}
+
+		switch (prec) {
+		case MANDEL_FLOAT:
+			skipped += mandel_kernels[k].float_fn(fx, fy, m, max,
+				biter);
+			break;
+		case MANDEL_FIXED:
+			skipped += mandel_kernels[k].fixed_fn(ix, iy, m, max,
+				biter);
+			break;
+		default:
+			skipped += mandel_kernels[k].fn(bx, by, m, max, biter);
+		}
+		for (j = 0; j < m; j++)
+			iter[bidx[j]] = biter[j];
+	}
+
+	for (j = 0; j < n; j++)
+		run += iter[j];
+	if (skipped)
+		__sync_fetch_and_add(&mandel_skipped, skipped);
+	__sync_fetch_and_add(&mandel_run, run - skipped);
+}
+
+/*
+ * This function computes the escape time of n points at once,
+ * (x[i], y[i]) for 0 <= i < n, and stores it in iter[i].
+ * It is equivalent to calling mandel_iterations_at_point() for
+ * every point, only faster: it runs the widest SIMD kernel the CPU
+ * supports (AVX-512, AVX2 or SSE2), selected at runtime.
+ *
+ * It is safe to call from multiple threads at once; the kernel
+ * is selected the first time around and every thread selects the same.
+ */
+void mandel_iterations_batch(const double x[], const double y[],
+	int n, int max, int iter[])
+{
+	mandel_batch_run(MANDEL_DOUBLE, x, y, n, max, iter);
+}
+
+/*
+ * Same as mandel_iterations_batch(), but iterating in single precision,
+ * with twice the points per vector.
+ */
+void mandel_iterations_batch_float(const double x[], const double y[],
+	int n, int max, int iter[])
+{
+	mandel_batch_run(MANDEL_FLOAT, x, y, n, max, iter);
+}
+
+/*
+ * Same as mandel_iterations_batch(), but iterating in 32-bit fixed
+ * point, with as many points per vector as single precision.
+ */
+void mandel_iterations_batch_fixed(const double x[], const double y[],
+	int n, int max, int iter[])
+{
+	mandel_batch_run(MANDEL_FIXED, x, y, n, max, iter);
+}
+
+/*
+ * Compute the escape time of every point next(arg, &x, &y) hands out,
+ * until it returns -1, in double precision. next() returns an id for
+ * the point, and once its escape time iter is known, done(arg, id, iter)
+ * is called. Points finish out of order: a point is started as soon as
+ * a SIMD lane is free, so lanes do not sit idle waiting for the slowest
+ * point in their vector. Results are the same as with
+ * mandel_iterations_at_point(); see mandel_stream_stats() for how busy
+ * the lanes were kept.
+ *
+ * next() and done() are only called from the calling thread.
+ */
+static void mandel_stream_run(struct mandel_stream *s)
+{
+	mandel_kernels[mandel_kernel()].stream_fn(s);
+
+	if (s->skipped)
+		__sync_fetch_and_add(&mandel_skipped, s->skipped);
+	__sync_fetch_and_add(&mandel_run, s->busy);
+	__sync_fetch_and_add(&mandel_stream_busy, s->busy);
+	__sync_fetch_and_add(&mandel_stream_slots, s->slots);
+}
+
+void mandel_iterations_stream(mandel_next_fn *next, mandel_done_fn *done,
+	void *arg, int max)
+{
+	struct mandel_stream s = {
+		.next = next, .done = done, .arg = arg, .max = max
+	};
+
+	mandel_stream_run(&s);
+}
+
+/*
+ * Set up the iteration state of the n points (x[i], y[i]) before their
+ * first call to mandel_iterations_resume(): no iterations done yet.
+ */
+void mandel_state_init(struct mandel_state st[], const double x[],
+	const double y[], int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		st[i].zx = x[i];
+		st[i].zy = y[i];
+		st[i].iter = 0;
+		st[i].inside = mandel_in_main_bulbs(x[i], y[i]);
+	}
+}
+
+struct mandel_resume {
+	const double *x, *y;
+	struct mandel_state *st;
+	int n, next, max;
+	int *iter;
+	unsigned long long skipped;
+};
+
+/* Hand out the points that can still escape; answer the rest directly */
+static int mandel_resume_next(void *arg, double *x, double *y)
+{
+	struct mandel_resume *r = arg;
+	struct mandel_state *st;
+	int i;
+
+	while (r->next < r->n) {
+		i = r->next++;
+		st = &r->st[i];
+		if (st->inside) {
+			if (r->max > st->iter) {
+				r->skipped += r->max - st->iter;
+				st->iter = r->max;
+			}
+			r->iter[i] = r->max;
+		} else if (st->iter >= r->max ||
+			   st->zx * st->zx + st->zy * st->zy > 4) {
+			r->iter[i] = st->iter < r->max ? st->iter : r->max;
+		} else {
+			*x = r->x[i];
+			*y = r->y[i];
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static void mandel_resume_done(void *arg, int id, int iter)
+{
+	struct mandel_resume *r = arg;
+
+	r->iter[id] = iter;
+}
+
+/*
+ * Compute the escape time of the n points (x[i], y[i]) with a limit of
+ * max iterations, like mandel_iterations_batch(), but carrying on from
+ * where the iteration of every point stopped last time, as recorded in
+ * st[i], and recording where it stops this time.
+ *
+ * Points that have escaped, or are known never to escape, cost nothing;
+ * the rest only run the iterations between the old limit and max.
+ * Raising max over several calls gives exactly the same escape times
+ * as a single call with the final max.
+ */
+void mandel_iterations_resume(const double x[], const double y[],
+	struct mandel_state st[], int n, int max, int iter[])
+{
+	struct mandel_resume r = {
+		.x = x, .y = y, .st = st, .n = n, .max = max, .iter = iter
+	};
+	struct mandel_stream s = {
+		.next = mandel_resume_next, .done = mandel_resume_done,
+		.arg = &r, .max = max, .state = st
+	};
+
+	mandel_stream_run(&s);
+	if (r.skipped)
+		__sync_fetch_and_add(&mandel_skipped, r.skipped);
+}
+
+/*******************************************
+ *                                         *
+ * Deep zoom: double-double arithmetic and *
+ * perturbation around a reference orbit   *
+ *                                         *
+ *******************************************/
+
+/*
+ * Double-double arithmetic, after Dekker and Bailey: a value is
+ * the unevaluated sum hi + lo of two doubles, with |lo| at most
+ * half an ulp of hi, for about 32 significant decimal digits.
+ */
+
+/* a + b exactly, as hi + lo */
+static mandel_dd dd_two_sum(double a, double b)
+{
+	mandel_dd r;
+	double bb;
+
+	r.hi = a + b;
+	bb = r.hi - a;
+	r.lo = (a - (r.hi - bb)) + (b - bb);
+	return r;
+}
+
+/* Same, but only if |a| >= |b| */
+static mandel_dd dd_quick_two_sum(double a, double b)
+{
+	mandel_dd r;
+
+	r.hi = a + b;
+	r.lo = b - (r.hi - a);
+	return r;
+}
+
+/* a * b exactly, as hi + lo */
+static mandel_dd dd_two_prod(double a, double b)
+{
+	mandel_dd r;
+
+	r.hi = a * b;
+#ifdef __FP_FAST_FMA
+	r.lo = __builtin_fma(a, b, -r.hi);
+#else
+	{
+		/* Split a and b in halves of 26 bits, whose products are exact */
+		double t, ahi, alo, bhi, blo;
+
+		t = 134217729.0 * a;
+		ahi = t - (t - a);
+		alo = a - ahi;
+		t = 134217729.0 * b;
+		bhi = t - (t - b);
+		blo = b - bhi;
+		r.lo = ((ahi * bhi - r.hi) + ahi * blo + alo * bhi) + alo * blo;
+	}
+#endif
+	return r;
+}
+
+mandel_dd mandel_dd_add(mandel_dd a, mandel_dd b)
+{
+	mandel_dd s, t;
+
+	s = dd_two_sum(a.hi, b.hi);
+	t = dd_two_sum(a.lo, b.lo);
+	s.lo += t.hi;
+	s = dd_quick_two_sum(s.hi, s.lo);
+	s.lo += t.lo;
+	return dd_quick_two_sum(s.hi, s.lo);
+}
+
+mandel_dd mandel_dd_mul(mandel_dd a, mandel_dd b)
+{
+	mandel_dd p;
+
+	p = dd_two_prod(a.hi, b.hi);
+	p.lo += a.hi * b.lo + a.lo * b.hi;
+	return dd_quick_two_sum(p.hi, p.lo);
+}
+
+static mandel_dd dd_from(double a)
+{
+	mandel_dd r = { a, 0.0 };
+
+	return r;
+}
+
+static mandel_dd dd_neg(mandel_dd a)
+{
+	a.hi = -a.hi;
+	a.lo = -a.lo;
+	return a;
+}
+
+static mandel_dd dd_div(mandel_dd a, mandel_dd b)
+{
+	double q1, q2, q3;
+	mandel_dd r;
+
+	q1 = a.hi / b.hi;
+	r = mandel_dd_add(a, dd_neg(mandel_dd_mul(dd_from(q1), b)));
+	q2 = r.hi / b.hi;
+	r = mandel_dd_add(r, dd_neg(mandel_dd_mul(dd_from(q2), b)));
+	q3 = r.hi / b.hi;
+
+	return mandel_dd_add(dd_quick_two_sum(q1, q2), dd_from(q3));
+}
+
+/*
+ * Parse a decimal number, like "-0.743643887037158704752191506114774"
+ * or "1.5e-20", keeping all the digits a double-double can hold.
+ * Returns 0 on success, -1 if s is not a number.
+ */
+int mandel_dd_parse(const char *s, mandel_dd *value)
+{
+	mandel_dd v = { 0.0, 0.0 }, scale = { 1.0, 0.0 }, ten = { 10.0, 0.0 };
+	int neg = 0, digits = 0, point = 0, exp = 0;
+	char *endp;
+
+	if (*s == '-' || *s == '+')
+		neg = (*s++ == '-');
+
+	for (; (*s >= '0' && *s <= '9') || (*s == '.' && !point); s++) {
+		if (*s == '.') {
+			point = 1;
+			continue;
+		}
+		v = mandel_dd_add(mandel_dd_mul(v, ten), dd_from(*s - '0'));
+		exp -= point;
+		digits++;
+	}
+	if (!digits)
+		return -1;
+
+	if (*s == 'e' || *s == 'E') {
+		exp += strtol(s + 1, &endp, 10);
+		if (endp == s + 1)
+			return -1;
+		s = endp;
+	}
+	if (*s != '\0')
+		return -1;
+
+	for (; exp > 0; exp--)
+		v = mandel_dd_mul(v, ten);
+	for (; exp < 0; exp++)
+		scale = mandel_dd_mul(scale, ten);
+	v = dd_div(v, scale);
+
+	*value = neg ? dd_neg(v) : v;
+	return 0;
+}
+
+/*
+ * Compute the orbit of the reference point C = (cx, cy) in double-double
+ * precision, z_0 = 0, z_n+1 = z_n^2 + C, until it escapes or max
+ * iterations. Only the double part of every z_n is kept; that is all
+ * the perturbed iterations need, since the rest is in the deltas.
+ */
+struct mandel_orbit *mandel_reference_orbit(mandel_dd cx, mandel_dd cy,
+	int max)
+{
+	struct mandel_orbit *orbit;
+	mandel_dd zx = { 0.0, 0.0 }, zy = { 0.0, 0.0 }, x2, y2, two = { 2.0, 0.0 };
+	int n;
+
+	if ((orbit = malloc(sizeof(*orbit))) == NULL)
+		return NULL;
+	orbit->zx = malloc((max + 1) * sizeof(double));
+	orbit->zy = malloc((max + 1) * sizeof(double));
+	if (!orbit->zx || !orbit->zy) {
+		mandel_orbit_free(orbit);
+		return NULL;
+	}
+
+	for (n = 0; ; n++) {
+		orbit->zx[n] = zx.hi;
+		orbit->zy[n] = zy.hi;
+		if (n == max || zx.hi * zx.hi + zy.hi * zy.hi > 4)
+			break;
+
+		x2 = mandel_dd_mul(zx, zx);
+		y2 = mandel_dd_mul(zy, zy);
+		zy = mandel_dd_add(mandel_dd_mul(mandel_dd_mul(two, zx), zy), cy);
+		zx = mandel_dd_add(mandel_dd_add(x2, dd_neg(y2)), cx);
+	}
+	orbit->len = n;
+
+	return orbit;
+}
+
+void mandel_orbit_free(struct mandel_orbit *orbit)
+{
+	if (!orbit)
+		return;
+	free(orbit->zx);
+	free(orbit->zy);
+	free(orbit);
+}
+
+/*
+ * Glitch detection threshold (Pauldelbrot's criterion): once the pixel
+ * orbit is this much smaller than the reference orbit, squared, the
+ * deltas have lost too many digits to cancellation to be trusted.
+ */
+#define MANDEL_GLITCH_TOLERANCE 1e-6
+
+static unsigned long long mandel_rebases;
+static unsigned long long mandel_glitches;
+
+/*
+ * Returns the number of times a pixel orbit was rebased on the
+ * reference orbit, and how many of these were detected glitches.
+ */
+void mandel_perturbation_stats(unsigned long long *rebases,
+	unsigned long long *glitches)
+{
+	*rebases = __sync_fetch_and_add(&mandel_rebases, 0);
+	*glitches = __sync_fetch_and_add(&mandel_glitches, 0);
+}
+
+/*
+ * Iterate the point C + (dcx, dcy) as a perturbation of the reference
+ * orbit: with z_n = Z_n + d_n, d_n+1 = 2 Z_n d_n + d_n^2 + dc, which only
+ * involves small numbers and is accurate in plain doubles.
+ *
+ * The pixel is rebased (d = z, back to the start of the reference
+ * orbit, where Z_0 = 0) whenever its orbit comes closer to zero than
+ * its delta, whenever a glitch is detected, and whenever it outlives
+ * the reference orbit. Returns the same iteration count as
+ * mandel_iterations_at_point() would with infinite precision.
+ */
+static int mandel_perturbed(const struct mandel_orbit *orbit,
+	double dcx, double dcy, int max,
+	unsigned long long *rebases, unsigned long long *glitches)
+{
+	double dx = 0.0, dy = 0.0, zx, zy, t, z2, ref2;
+	int m = 0, iter = 0;
+
+	while (iter < max) {
+		double rx = orbit->zx[m], ry = orbit->zy[m];
+
+		t = 2 * (rx * dx - ry * dy) + (dx * dx - dy * dy) + dcx;
+		dy = 2 * (rx * dy + ry * dx) + 2 * dx * dy + dcy;
+		dx = t;
+		m++;
+
+		zx = orbit->zx[m] + dx;
+		zy = orbit->zy[m] + dy;
+		z2 = zx * zx + zy * zy;
+		if (z2 > 4)
+			break;
+		++iter;
+
+		ref2 = orbit->zx[m] * orbit->zx[m] + orbit->zy[m] * orbit->zy[m];
+		if (z2 < MANDEL_GLITCH_TOLERANCE * ref2)
+			++*glitches;
+		else if (m < orbit->len && z2 >= dx * dx + dy * dy)
+			continue;
+
+		dx = zx;
+		dy = zy;
+		m = 0;
+		++*rebases;
+	}
+
+	return iter;
+}
+
+/*
+ * This function computes the escape time of the n points
+ * C + (dcx[i], dcy[i]), where C is the reference point of orbit,
+ * and stores it in iter[i].
+ */
+void mandel_perturbed_batch(const struct mandel_orbit *orbit,
+	const double dcx[], const double dcy[], int n, int max, int iter[])
+{
+	unsigned long long rebases = 0, glitches = 0, run = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		iter[i] = mandel_perturbed(orbit, dcx[i], dcy[i], max,
+			&rebases, &glitches);
+		run += iter[i];
+	}
+
+	__sync_fetch_and_add(&mandel_run, run);
+	if (rebases)
+		__sync_fetch_and_add(&mandel_rebases, rebases);
+	if (glitches)
+		__sync_fetch_and_add(&mandel_glitches, glitches);
+}
+
+/*******************************************
+ *                                         *
+ * Precision tiers: the cheapest arithmetic *
+ * that can still tell pixels apart        *
+ *                                         *
+ *******************************************/
+
+/*
+ * Bits of headroom a tier must have beyond telling two adjacent pixels
+ * apart, besides those spent on the rounding errors of the iterations.
+ */
+#define MANDEL_PRECISION_MARGIN 12
+
+static const struct {
+	const char *name;
+	int mantissa;		/* Significant bits */
+} mandel_precisions[] = {
+	[MANDEL_FLOAT]		= { "float",		FLT_MANT_DIG },
+	[MANDEL_DOUBLE]		= { "double",		DBL_MANT_DIG },
+	[MANDEL_LONG_DOUBLE]	= { "long double",	LDBL_MANT_DIG },
+	[MANDEL_DOUBLE_DOUBLE]	= { "double-double",	2 * DBL_MANT_DIG },
+	[MANDEL_FIXED]		= { "fixed-point",	MANDEL_FIXED_SHIFT },
+};
+
+const char *mandel_precision_name(enum mandel_precision prec)
+{
+	return mandel_precisions[prec].name;
+}
+
+/*
+ * Pick the cheapest precision for pixels step apart, iterated up to
+ * max times. Points of interest lie within |z| <= 2, where a type with
+ * p bits of mantissa resolves 2^(2-p). Every iteration may add its
+ * rounding error to the orbit, so log2(max) bits go to those, and on
+ * top of that we want MANDEL_PRECISION_MARGIN bits to spare. Where
+ * long double is no wider than double (it is on some platforms) the
+ * tier is skipped.
+ */
+enum mandel_precision mandel_pick_precision(double step, int max)
+{
+	int prec, bits, max_bits;
+	double resolved;
+
+	for (max_bits = 0; max > 1; max = (max + 1) / 2)
+		max_bits++;
+
+	for (prec = MANDEL_FLOAT; prec < MANDEL_DOUBLE_DOUBLE; prec++) {
+		if (prec == MANDEL_LONG_DOUBLE && LDBL_MANT_DIG <= DBL_MANT_DIG)
+			continue;
+		resolved = 1.0;
+		bits = mandel_precisions[prec].mantissa - 2 - max_bits -
+			MANDEL_PRECISION_MARGIN;
+		while (bits-- > 0)
+			resolved /= 2;
+		if (step >= resolved)
+			return prec;
+	}
+
+	return MANDEL_DOUBLE_DOUBLE;
+}
+
+/* The escape time loop in long double, otherwise as mandel_iterate() */
+static int mandel_iterate_long(long double x, long double y, int max,
+	unsigned long long *skipped)
+{
+	long double x0 = x;
+	long double y0 = y;
+	long double xs = x, ys = y;
+	int check = 8;
+	int iter = 0;
+
+	if (mandel_in_main_bulbs(x0, y0)) {
+		*skipped += max;
+		return max;
+	}
+
+	while ( (x * x + y * y <= 4) && iter < max) {
+		long double xt = x * x - y * y + x0;
+		long double yt = 2 * x * y + y0;
+
+		x = xt;
+		y = yt;
+
+		++iter;
+
+		if (x == xs && y == ys) {
+			*skipped += max - iter;
+			return max;
+		}
+		if (iter == check) {
+			xs = x;
+			ys = y;
+			check <<= 1;
+		}
+	}
+
+	return iter;
+}
+
+/* The escape time loop in double-double, otherwise as mandel_iterate() */
+static int mandel_iterate_dd(mandel_dd x, mandel_dd y, int max,
+	unsigned long long *skipped)
+{
+	mandel_dd x0 = x, y0 = y, xs = x, ys = y, x2, y2;
+	int check = 8;
+	int iter = 0;
+
+	if (mandel_in_main_bulbs(x0.hi, y0.hi)) {
+		*skipped += max;
+		return max;
+	}
+
+	for (;;) {
+		x2 = mandel_dd_mul(x, x);
+		y2 = mandel_dd_mul(y, y);
+		if (x2.hi + y2.hi > 4 || iter >= max)
+			break;
+
+		y = mandel_dd_add(mandel_dd_mul(mandel_dd_add(x, x), y), y0);
+		x = mandel_dd_add(mandel_dd_add(x2, dd_neg(y2)), x0);
+
+		++iter;
+
+		if (x.hi == xs.hi && x.lo == xs.lo &&
+		    y.hi == ys.hi && y.lo == ys.lo) {
+			*skipped += max - iter;
+			return max;
+		}
+		if (iter == check) {
+			xs = x;
+			ys = y;
+			check <<= 1;
+		}
+	}
+
+	return iter;
+}
+
+/*
+ * This function computes the escape time of the n points
+ * (cx + dx[i], cy + dy[i]) in the given precision, and stores it
+ * in iter[i]. Float, double and fixed point run the SIMD kernels;
+ * long double and double-double are scalar.
+ */
+void mandel_iterations_tiered(enum mandel_precision prec,
+	mandel_dd cx, mandel_dd cy, const double dx[], const double dy[],
+	int n, int max, int iter[])
+{
+	unsigned long long skipped = 0;
+	double x[MANDEL_BATCH_CHUNK], y[MANDEL_BATCH_CHUNK];
+	int i, j, m;
+
+	switch (prec) {
+	case MANDEL_FLOAT:
+	case MANDEL_DOUBLE:
+	case MANDEL_FIXED:
+		for (i = 0; i < n; i += m) {
+			m = n - i < MANDEL_BATCH_CHUNK ? n - i : MANDEL_BATCH_CHUNK;
+			for (j = 0; j < m; j++) {
+				x[j] = mandel_dd_add(cx, dd_from(dx[i + j])).hi;
+				y[j] = mandel_dd_add(cy, dd_from(dy[i + j])).hi;
+			}
+			mandel_batch_run(prec, x, y, m, max, &iter[i]);
+		}
+		return;
+	case MANDEL_LONG_DOUBLE:
+		for (i = 0; i < n; i++)
+			iter[i] = mandel_iterate_long(
+				(long double)cx.hi + cx.lo + dx[i],
+				(long double)cy.hi + cy.lo + dy[i],
+				max, &skipped);
+		break;
+	case MANDEL_DOUBLE_DOUBLE:
+		for (i = 0; i < n; i++)
+			iter[i] = mandel_iterate_dd(
+				mandel_dd_add(cx, dd_from(dx[i])),
+				mandel_dd_add(cy, dd_from(dy[i])),
+				max, &skipped);
+		break;
+	}
+
+	if (skipped)
+		__sync_fetch_and_add(&mandel_skipped, skipped);
+}
+
+/*
+ * This function takes a color value as returned
+ * by mandelbrot_iterations() and uses the palette in use
+ * (see mandel_palette_use()) to return an approximation
+ * for 256-color xterms.
+ */
+unsigned char xterm_color(int color_val)
+{
+	return mandel_palette_color(mandel_palette_current(), color_val);
+}
+
+/*
+ * Insist until all count bytes beginning at
+ * address buff have been written to file descriptor fd.
+ */
+ssize_t insist_write(int fd, const char *buf, size_t count)
+{
+	ssize_t ret;
+	size_t orig_count = count;
+
+	while (count > 0) {
+		ret = write(fd, buf, count);
+		if (ret < 0)
+			return ret;
+		buf += ret;
+		count -= ret;
+	}
+
+	return orig_count;
+}
+
+/*
+ * This function outputs the proper control sequence
+ * to change the current color of a 256-color xterm.
+ */
+void set_xterm_color(int fd, unsigned char color)
+{
+	char buf[100];
+	snprintf(buf, 100, "\033[38;5;%dm", color);
+
+	if (insist_write(fd, buf, strlen(buf)) != strlen(buf)) {
+		perror("set_xterm_color: insist_write");
+		exit(1);
+	}
+}
+
+/*
+ * A frame encoder: cells are '@' characters in xterm-256 colors,
+ * encoded from precomputed escape sequences into one buffer, so that
+ * a whole frame can be sent with a single writev(). A color escape
+ * is only emitted when a cell differs from its left neighbour.
+ *
+ * Line i lives at buf + i * stride, stride being enough for the
+ * worst case of one escape per cell; iov[i] points to its encoded
+ * part. Lines are independent (each one starts by setting its first
+ * color), so they can be encoded in any order, or by different
+ * threads, and written out in any grouping.
+ *
+ * A line can also be encoded as the difference from what is on the
+ * screen already: only the runs of cells whose color changed, each
+ * one preceded by moving the cursor there, which at worst happens
+ * every other cell.
+ */
+#define XTERM_ESCAPE_MAX sizeof("\033[38;5;255m")
+#define XTERM_MOVE_MAX sizeof("\033[2147483647;2147483647H")
+
+/* limits.h only has it with _XOPEN_SOURCE; Linux takes 1024 iovecs */
+#ifndef IOV_MAX
+# define IOV_MAX 1024
+#endif
+
+struct xterm_frame {
+	int width, height;
+	size_t stride;
+	char *buf;
+	struct iovec *iov;
+	char escape[256][XTERM_ESCAPE_MAX];
+	unsigned char escape_len[256];
+};
+
+/* Returns NULL if out of memory */
+struct xterm_frame *xterm_frame_create(int width, int height)
+{
+	struct xterm_frame *f;
+	int c, i;
+
+	if ((f = malloc(sizeof(*f))) == NULL)
+		return NULL;
+	f->width = width;
+	f->height = height;
+	f->stride = (size_t)width * XTERM_ESCAPE_MAX +
+		(size_t)(width + 1) / 2 * XTERM_MOVE_MAX + 1;
+	f->buf = malloc(f->stride * height);
+	f->iov = malloc(height * sizeof(struct iovec));
+	if (!f->buf || !f->iov) {
+		xterm_frame_destroy(f);
+		return NULL;
+	}
+	for (i = 0; i < height; i++) {
+		f->iov[i].iov_base = f->buf + i * f->stride;
+		f->iov[i].iov_len = 0;
+	}
+	for (c = 0; c < 256; c++)
+		f->escape_len[c] = snprintf(f->escape[c], XTERM_ESCAPE_MAX,
+			"\033[38;5;%dm", c);
+
+	return f;
+}
+
+/* Encode line of the frame from width color values, as '@'s */
+void xterm_frame_line(struct xterm_frame *f, int line, const int color_val[])
+{
+	char *start = f->buf + line * f->stride;
+	char *p = start;
+	int i, color = -1;
+
+	for (i = 0; i < f->width; i++) {
+		assert(0 <= color_val[i] && color_val[i] <= 255);
+		if (color_val[i] != color) {
+			color = color_val[i];
+			memcpy(p, f->escape[color], f->escape_len[color]);
+			p += f->escape_len[color];
+		}
+		*p++ = '@';
+	}
+	*p++ = '\n';
+	f->iov[line].iov_len = p - start;
+}
+
+/*
+ * Encode line of the frame as only the cells whose color differs
+ * between color_val[] and prev_val[], which is on the screen already.
+ * The frame is assumed to be drawn at the top left of the screen, so
+ * line is on row line + 1; nothing is encoded if no cell changed.
+ */
+void xterm_frame_line_diff(struct xterm_frame *f, int line,
+	const int color_val[], const int prev_val[])
+{
+	char *start = f->buf + line * f->stride;
+	char *p = start;
+	int i, color = -1;
+
+	for (i = 0; i < f->width; i++) {
+		if (color_val[i] == prev_val[i])
+			continue;
+		/* The cursor is already there if the left cell changed too */
+		if (i == 0 || color_val[i - 1] == prev_val[i - 1])
+			p += sprintf(p, "\033[%d;%dH", line + 1, i + 1);
+		assert(0 <= color_val[i] && color_val[i] <= 255);
+		if (color_val[i] != color) {
+			color = color_val[i];
+			memcpy(p, f->escape[color], f->escape_len[color]);
+			p += f->escape_len[color];
+		}
+		*p++ = '@';
+	}
+	f->iov[line].iov_len = p - start;
+}
+
+/*
+ * Write lines first to first + count - 1 to fd, in a single writev()
+ * as long as it does not come back short and count is within IOV_MAX.
+ */
+void xterm_frame_write(int fd, struct xterm_frame *f, int first, int count)
+{
+	struct iovec iov[IOV_MAX];
+	ssize_t ret;
+	int i, n;
+
+	while (count > 0) {
+		n = count < IOV_MAX ? count : IOV_MAX;
+		memcpy(iov, &f->iov[first], n * sizeof(struct iovec));
+		first += n;
+		count -= n;
+
+		for (i = 0; i < n; ) {
+			ret = writev(fd, &iov[i], n - i);
+			if (ret < 0) {
+				if (errno == EINTR)
+					continue;
+				perror("xterm_frame_write: writev");
+				exit(1);
+			}
+			/* Skip what was written, finishing any partial line */
+			for (; i < n && (size_t)ret >= iov[i].iov_len; i++)
+				ret -= iov[i].iov_len;
+			if (i < n) {
+				iov[i].iov_base = (char *)iov[i].iov_base + ret;
+				iov[i].iov_len -= ret;
+			}
+		}
+	}
+}
+
+void xterm_frame_destroy(struct xterm_frame *f)
+{
+	free(f->iov);
+	free(f->buf);
+	free(f);
+}
+
+/* 
+ * Reset all character attributes before leaving,
+ * to ensure the prompt is not drawn in a funny color
+ */
+void reset_xterm_color(int fd)
+{
+	if (insist_write(fd, "\033[0m", 4) != 4) {
+		perror("reset_xterm_color: insist_write");
+		exit(1);
+	}
+}
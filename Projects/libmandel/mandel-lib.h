@@ -0,0 +1,117 @@
+/*
+ * mandel-lib.h
+ *
+ * A library with useful functions
+ * for computing the Mandelbrot Set and handling a 256-color xterm.
+ *
+ */
+
+#ifndef MANDEL_LIB_H__
+#define MANDEL_LIB_H__
+
+/* A double-double number: the unevaluated sum hi + lo */
+typedef struct {
+	double hi;
+	double lo;
+} mandel_dd;
+
+/*
+ * The orbit of a reference point for perturbation rendering:
+ * zx[n], zy[n] for 0 <= n <= len, rounded to double.
+ */
+struct mandel_orbit {
+	int len;
+	double *zx;
+	double *zy;
+};
+
+/*
+ * Arithmetic used to iterate, cheapest first.
+ * See mandel_pick_precision(); fixed point is never picked
+ * automatically, only on request.
+ */
+enum mandel_precision {
+	MANDEL_FLOAT,
+	MANDEL_DOUBLE,
+	MANDEL_LONG_DOUBLE,
+	MANDEL_DOUBLE_DOUBLE,
+	MANDEL_FIXED
+};
+
+/*
+ * Where the iteration of a point stopped, for mandel_iterations_resume():
+ * z = zx + zy i after iter iterations. If inside is set, the point is
+ * known never to escape.
+ */
+struct mandel_state {
+	double zx, zy;
+	int iter;
+	int inside;
+};
+
+/*
+ * Sources of points for mandel_iterations_stream(): next() stores the
+ * next point in *x, *y and returns its id, or returns -1 if there are
+ * no more; done() receives the escape time of point id.
+ */
+typedef int mandel_next_fn(void *arg, double *x, double *y);
+typedef void mandel_done_fn(void *arg, int id, int iter);
+
+/* Function prototypes */
+int mandel_iterations_at_point(double x, double y, int max);
+int mandel_distance_at_point(double x, double y, int max, double *dist,
+	double *same);
+void mandel_iterations_batch(const double x[], const double y[],
+	int n, int max, int iter[]);
+void mandel_iterations_batch_float(const double x[], const double y[],
+	int n, int max, int iter[]);
+void mandel_iterations_batch_fixed(const double x[], const double y[],
+	int n, int max, int iter[]);
+void mandel_iterations_stream(mandel_next_fn *next, mandel_done_fn *done,
+	void *arg, int max);
+void mandel_stream_stats(unsigned long long *busy, unsigned long long *slots);
+void mandel_state_init(struct mandel_state st[], const double x[],
+	const double y[], int n);
+void mandel_iterations_resume(const double x[], const double y[],
+	struct mandel_state st[], int n, int max, int iter[]);
+const char *mandel_simd_name(void);
+unsigned long long mandel_skipped_iterations(void);
+unsigned long long mandel_run_iterations(void);
+mandel_dd mandel_dd_add(mandel_dd a, mandel_dd b);
+mandel_dd mandel_dd_mul(mandel_dd a, mandel_dd b);
+int mandel_dd_parse(const char *s, mandel_dd *value);
+struct mandel_orbit *mandel_reference_orbit(mandel_dd cx, mandel_dd cy,
+	int max);
+void mandel_orbit_free(struct mandel_orbit *orbit);
+void mandel_perturbed_batch(const struct mandel_orbit *orbit,
+	const double dcx[], const double dcy[], int n, int max, int iter[]);
+void mandel_perturbation_stats(unsigned long long *rebases,
+	unsigned long long *glitches);
+enum mandel_precision mandel_pick_precision(double step, int max);
+const char *mandel_precision_name(enum mandel_precision prec);
+void mandel_iterations_tiered(enum mandel_precision prec,
+	mandel_dd cx, mandel_dd cy, const double dx[], const double dy[],
+	int n, int max, int iter[]);
+struct mandel_palette *mandel_palette_create(const char *name,
+	const unsigned char rgb[][3], int n);
+struct mandel_palette *mandel_palette_load(const char *path);
+const char *mandel_palette_builtin_name(int i);
+const struct mandel_palette *mandel_palette_builtin(const char *name);
+void mandel_palette_use(const struct mandel_palette *p);
+const struct mandel_palette *mandel_palette_current(void);
+unsigned char mandel_palette_color(const struct mandel_palette *p, int val);
+void mandel_palette_rgb(const struct mandel_palette *p, int val,
+	unsigned char rgb[3]);
+void mandel_palette_free(struct mandel_palette *p);
+unsigned char xterm_color(int color_val);
+ssize_t insist_write(int fd, const char *buf, size_t count);
+void set_xterm_color(int fd, unsigned char color);
+void reset_xterm_color(int fd);
+struct xterm_frame *xterm_frame_create(int width, int height);
+void xterm_frame_line(struct xterm_frame *f, int line, const int color_val[]);
+void xterm_frame_line_diff(struct xterm_frame *f, int line,
+	const int color_val[], const int prev_val[]);
+void xterm_frame_write(int fd, struct xterm_frame *f, int first, int count);
+void xterm_frame_destroy(struct xterm_frame *f);
+
+#endif /* MANDEL_LIB_H__ */
@@ -0,0 +1,219 @@
+/*
+ * mandel-render.c
+ *
+ * Reentrant rendering of the Mandelbrot Set, on top of the
+ * batch kernels of mandel-lib.c. Nothing here is global: a
+ * context only changes through atomic updates of its counters.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "mandel-lib.h"
+#include "mandel-render.h"
+
+struct mandel_ctx {
+	enum mandel_precision prec;
+	const struct mandel_palette *palette;
+	unsigned long long pixels;
+	unsigned long long iterations;
+};
+
+struct mandel_ctx *mandel_ctx_create(enum mandel_precision prec,
+	const struct mandel_palette *palette)
+{
+	struct mandel_ctx *ctx;
+
+	if (prec != MANDEL_FLOAT && prec != MANDEL_DOUBLE &&
+	    prec != MANDEL_FIXED) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if ((ctx = malloc(sizeof(*ctx))) == NULL)
+		return NULL;
+
+	ctx->prec = prec;
+	ctx->palette = palette ? palette : mandel_palette_current();
+	ctx->pixels = 0;
+	ctx->iterations = 0;
+	return ctx;
+}
+
+int mandel_viewport_check(const struct mandel_viewport *vp)
+{
+	if (vp->width <= 0 || vp->height <= 0 || vp->max_iteration <= 0 ||
+	    !(vp->xmin < vp->xmax) || !(vp->ymin < vp->ymax))
+		return -1;
+	return 0;
+}
+
+int mandel_render_lines(struct mandel_ctx *ctx,
+	const struct mandel_viewport *vp, int first, int count, int out[])
+{
+	double xstep, ystep, x;
+	double *xs, *ys;
+	unsigned long long sum = 0;
+	int line, n;
+
+	if (mandel_viewport_check(vp) < 0 || first < 0 || count < 0 ||
+	    count > vp->height - first) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((xs = malloc(2 * vp->width * sizeof(double))) == NULL)
+		return -1;
+	ys = xs + vp->width;
+
+	/*
+	 * Step along each line the same way the renderers always have,
+	 * so the same viewport gives exactly the same pixels.
+	 */
+	xstep = (vp->xmax - vp->xmin) / vp->width;
+	ystep = (vp->ymax - vp->ymin) / vp->height;
+	for (x = vp->xmin, n = 0; n < vp->width; x += xstep, n++)
+		xs[n] = x;
+
+	for (line = first; line < first + count; line++, out += vp->width) {
+		for (n = 0; n < vp->width; n++)
+			ys[n] = vp->ymax - ystep * line;
+
+		switch (ctx->prec) {
+		case MANDEL_FLOAT:
+			mandel_iterations_batch_float(xs, ys, vp->width,
+				vp->max_iteration, out);
+			break;
+		case MANDEL_FIXED:
+			mandel_iterations_batch_fixed(xs, ys, vp->width,
+				vp->max_iteration, out);
+			break;
+		default:
+			mandel_iterations_batch(xs, ys, vp->width,
+				vp->max_iteration, out);
+		}
+		for (n = 0; n < vp->width; n++)
+			sum += out[n];
+	}
+	free(xs);
+
+	__sync_fetch_and_add(&ctx->pixels,
+		(unsigned long long)count * vp->width);
+	__sync_fetch_and_add(&ctx->iterations, sum);
+	return 0;
+}
+
+int mandel_render(struct mandel_ctx *ctx, const struct mandel_viewport *vp,
+	int out[])
+{
+	return mandel_render_lines(ctx, vp, 0, vp->height, out);
+}
+
+double mandel_grid_step(int zoom)
+{
+	return ldexp(MANDEL_GRID_STEP, -zoom);
+}
+
+void mandel_grid_snap(const struct mandel_viewport *vp,
+	struct mandel_grid_view *v)
+{
+	double step = (vp->xmax - vp->xmin) / vp->width;
+
+	v->zoom = (int)ceil(log2(MANDEL_GRID_STEP / step));
+	step = mandel_grid_step(v->zoom);
+	v->px = (long)floor(vp->xmin / step);
+	v->py = (long)floor(-vp->ymax / step);
+	v->width = vp->width;
+	v->height = vp->height;
+	v->max_iteration = vp->max_iteration;
+}
+
+/*
+ * Grid pixels are placed by multiplying their index with the step,
+ * a power of two, so a pixel lands on the same point whichever tile
+ * or view it is rendered for.
+ */
+void mandel_render_tile(struct mandel_ctx *ctx, int zoom, long tx, long ty,
+	int max, int out[])
+{
+	double xs[MANDEL_TILE_SIZE * MANDEL_TILE_SIZE];
+	double ys[MANDEL_TILE_SIZE * MANDEL_TILE_SIZE];
+	double step = mandel_grid_step(zoom);
+	long px = tx * MANDEL_TILE_SIZE, py = ty * MANDEL_TILE_SIZE;
+	int n = MANDEL_TILE_SIZE * MANDEL_TILE_SIZE;
+	unsigned long long sum = 0;
+	int i;
+
+	/* The whole tile goes through the kernels as one batch */
+	for (i = 0; i < n; i++) {
+		xs[i] = (double)(px + i % MANDEL_TILE_SIZE) * step;
+		ys[i] = -(double)(py + i / MANDEL_TILE_SIZE) * step;
+	}
+	switch (ctx->prec) {
+	case MANDEL_FLOAT:
+		mandel_iterations_batch_float(xs, ys, n, max, out);
+		break;
+	case MANDEL_FIXED:
+		mandel_iterations_batch_fixed(xs, ys, n, max, out);
+		break;
+	default:
+		mandel_iterations_batch(xs, ys, n, max, out);
+	}
+	for (i = 0; i < n; i++)
+		sum += out[i];
+
+	__sync_fetch_and_add(&ctx->pixels, n);
+	__sync_fetch_and_add(&ctx->iterations, sum);
+}
+
+long mandel_floor_div(long a, long b)
+{
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+void mandel_tile_blit(const int tile[], long tx, long ty,
+	const struct mandel_grid_view *v, int out[], int stride)
+{
+	long x0 = tx * MANDEL_TILE_SIZE, y0 = ty * MANDEL_TILE_SIZE;
+	long left, right, first, last, line;
+
+	left = x0 < v->px ? v->px - x0 : 0;
+	right = x0 + MANDEL_TILE_SIZE > v->px + v->width ?
+		v->px + v->width - x0 : MANDEL_TILE_SIZE;
+	first = y0 < v->py ? v->py - y0 : 0;
+	last = y0 + MANDEL_TILE_SIZE > v->py + v->height ?
+		v->py + v->height - y0 : MANDEL_TILE_SIZE;
+	if (left >= right)
+		return;
+	for (line = first; line < last; line++)
+		memcpy(&out[(y0 + line - v->py) * stride + x0 + left - v->px],
+			&tile[line * MANDEL_TILE_SIZE + left],
+			(right - left) * sizeof(int));
+}
+
+enum mandel_precision mandel_ctx_precision(const struct mandel_ctx *ctx)
+{
+	return ctx->prec;
+}
+
+void mandel_render_colors(const struct mandel_ctx *ctx, const int iter[],
+	int n, int color[])
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		color[i] = mandel_palette_color(ctx->palette, iter[i]);
+}
+
+void mandel_ctx_stats(struct mandel_ctx *ctx, unsigned long long *pixels,
+	unsigned long long *iterations)
+{
+	*pixels = __sync_fetch_and_add(&ctx->pixels, 0);
+	*iterations = __sync_fetch_and_add(&ctx->iterations, 0);
+}
+
+void mandel_ctx_destroy(struct mandel_ctx *ctx)
+{
+	free(ctx);
+}
@@ -0,0 +1,126 @@
+/*
+ * mandel-render.h
+ *
+ * Reentrant rendering of the Mandelbrot Set: everything a frame
+ * depends on is passed in, as a rendering context and a viewport,
+ * so any number of threads may render any number of viewports
+ * at once, sharing contexts or not.
+ *
+ */
+
+#ifndef MANDEL_RENDER_H__
+#define MANDEL_RENDER_H__
+
+#include "mandel-lib.h"
+
+/*
+ * The part of the complex plane to be drawn, and how: upper left
+ * corner is (xmin, ymax), lower right corner is (xmax, ymin), cut
+ * into width x height pixels, each iterated at most max_iteration
+ * times.
+ */
+struct mandel_viewport {
+	double xmin, xmax;
+	double ymin, ymax;
+	int width, height;
+	int max_iteration;
+};
+
+/*
+ * The tile grid, on which rendered pixels can be cached and shared
+ * (see mandel-cache.h). At zoom level z, pixels are
+ * mandel_grid_step(z) = MANDEL_GRID_STEP / 2^z apart, and grid pixel
+ * (px, py) lies at px * step - py * step i, so py grows downward.
+ * Tiles are MANDEL_TILE_SIZE pixels square: tile (tx, ty) starts at
+ * grid pixel (tx * MANDEL_TILE_SIZE, ty * MANDEL_TILE_SIZE).
+ */
+#define MANDEL_GRID_STEP (1.0 / 64)
+#define MANDEL_TILE_SIZE 32
+
+/* A part of the grid to be drawn: width x height pixels from (px, py) */
+struct mandel_grid_view {
+	int zoom;
+	long px, py;
+	int width, height;
+	int max_iteration;
+};
+
+struct mandel_ctx;
+
+/*
+ * Create a rendering context, iterating in precision prec
+ * (MANDEL_FLOAT, MANDEL_DOUBLE or MANDEL_FIXED) and coloring
+ * with palette or, if it is NULL, the palette in use right now
+ * (see mandel_palette_use()). Returns NULL if prec is not
+ * supported or out of memory.
+ */
+struct mandel_ctx *mandel_ctx_create(enum mandel_precision prec,
+	const struct mandel_palette *palette);
+
+/* Returns 0 if vp can be rendered, -1 if it is empty or inverted */
+int mandel_viewport_check(const struct mandel_viewport *vp);
+
+/*
+ * Store the escape time of every pixel of vp in out[], line by line,
+ * width values per line. Returns -1 if vp is invalid.
+ */
+int mandel_render(struct mandel_ctx *ctx, const struct mandel_viewport *vp,
+	int out[]);
+
+/*
+ * Like mandel_render(), but only for lines first to first + count - 1
+ * of vp, stored from out[0] on; a frame may be split among threads
+ * this way. Returns -1 if vp is invalid or the lines are not in it.
+ */
+int mandel_render_lines(struct mandel_ctx *ctx,
+	const struct mandel_viewport *vp, int first, int count, int out[]);
+
+/* The pixel spacing of the grid at zoom level zoom */
+double mandel_grid_step(int zoom);
+
+/*
+ * Fill in v with the view of the grid closest to vp: at the finest
+ * zoom level no coarser than the pixels of vp across, with its top
+ * left pixel the one holding the top left corner of vp.
+ */
+void mandel_grid_snap(const struct mandel_viewport *vp,
+	struct mandel_grid_view *v);
+
+/*
+ * Store the escape times of tile (tx, ty) of the grid at zoom level
+ * zoom in out[], MANDEL_TILE_SIZE lines of MANDEL_TILE_SIZE values.
+ */
+void mandel_render_tile(struct mandel_ctx *ctx, int zoom, long tx, long ty,
+	int max, int out[]);
+
+/* Floor of a / b, for b > 0, also for negative a: the tile of a pixel */
+long mandel_floor_div(long a, long b);
+
+/*
+ * Copy the part of tile (tx, ty), as stored by mandel_render_tile(),
+ * inside v into out[], which holds the pixels of v line by line,
+ * stride values apart.
+ */
+void mandel_tile_blit(const int tile[], long tx, long ty,
+	const struct mandel_grid_view *v, int out[], int stride);
+
+/* Returns the precision ctx iterates in */
+enum mandel_precision mandel_ctx_precision(const struct mandel_ctx *ctx);
+
+/*
+ * Turn n escape times into xterm colors of the palette of ctx;
+ * iter and color may be the same array.
+ */
+void mandel_render_colors(const struct mandel_ctx *ctx, const int iter[],
+	int n, int color[]);
+
+/*
+ * Returns how many pixels ctx has rendered so far,
+ * and the sum of their escape times.
+ */
+void mandel_ctx_stats(struct mandel_ctx *ctx, unsigned long long *pixels,
+	unsigned long long *iterations);
+
+void mandel_ctx_destroy(struct mandel_ctx *ctx);
+
+#endif /* MANDEL_RENDER_H__ */
@@ -0,0 +1,178 @@
+/*
+ * mandel-ring.c
+ *
+ * A reorder ring: worker threads publish numbered lines in any
+ * order, without waiting for each other, and a drain thread
+ * emits them in order in the background.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "mandel-ring.h"
+
+/*
+ * Line seq goes to slot seq % size. Its worker fills the slot in,
+ * then stores seq in seq[slot] with release semantics; once the drain
+ * thread sees it there (with acquire semantics), the contents of the
+ * slot are complete. After emitting a line, the drain thread advances
+ * drained, which frees its slot for line seq + size. There are no
+ * locks: a worker only waits if it gets a whole ring ahead of output.
+ *
+ * The ready semaphore is posted once per published line, so that the
+ * drain thread can sleep while the line it needs next is not there.
+ * A worker that has to wait for a slot sleeps on freed, counting
+ * itself in waiting, so that the drain thread only takes the lock to
+ * wake it up when someone is actually waiting.
+ */
+struct mandel_ring {
+	int size, width, count;
+	int *buf;		/* size slots of width ints */
+	int *seq;		/* Line in every slot, or -1 */
+	int drained;		/* Lines emitted so far */
+	sem_t ready;
+	pthread_mutex_t lock;
+	pthread_cond_t freed;
+	int waiting;		/* Workers asleep on freed */
+	ring_emit_fn *emit;
+	ring_flush_fn *flush;
+	void *arg;
+	pthread_t drainer;
+};
+
+static void *ring_drain(void *arg)
+{
+	struct mandel_ring *ring = arg;
+	int seq, slot;
+
+	for (seq = 0; seq < ring->count; seq++) {
+		slot = seq % ring->size;
+		if (ring->flush &&
+		    __atomic_load_n(&ring->seq[slot], __ATOMIC_ACQUIRE) != seq)
+			ring->flush(ring->arg, seq);
+		while (__atomic_load_n(&ring->seq[slot], __ATOMIC_ACQUIRE) != seq)
+			if (sem_wait(&ring->ready) < 0 && errno != EINTR) {
+				perror("ring_drain: sem_wait");
+				exit(1);
+			}
+		ring->emit(ring->arg, seq, &ring->buf[slot * ring->width]);
+
+		/*
+		 * Sequentially consistent, like the accesses of a waiting
+		 * worker: either we see it counted in waiting, or it sees
+		 * the slot free before going to sleep.
+		 */
+		__atomic_store_n(&ring->drained, seq + 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST)) {
+			pthread_mutex_lock(&ring->lock);
+			pthread_cond_broadcast(&ring->freed);
+			pthread_mutex_unlock(&ring->lock);
+		}
+	}
+	if (ring->flush)
+		ring->flush(ring->arg, ring->count);
+
+	return NULL;
+}
+
+static void *ring_malloc(size_t size)
+{
+	void *p;
+
+	if ((p = malloc(size)) == NULL && size) {
+		fprintf(stderr, "Out of memory, failed to allocate %zd bytes\n",
+			size);
+		exit(1);
+	}
+	return p;
+}
+
+struct mandel_ring *ring_create(int size, int width, int count,
+	ring_emit_fn *emit, ring_flush_fn *flush, void *arg)
+{
+	struct mandel_ring *ring;
+	int i, ret;
+
+	ring = ring_malloc(sizeof(*ring));
+	ring->size = size;
+	ring->width = width;
+	ring->count = count;
+	ring->buf = ring_malloc((size_t)size * width * sizeof(int));
+	ring->seq = ring_malloc(size * sizeof(int));
+	for (i = 0; i < size; i++)
+		ring->seq[i] = -1;
+	ring->drained = 0;
+	ring->waiting = 0;
+	pthread_mutex_init(&ring->lock, NULL);
+	pthread_cond_init(&ring->freed, NULL);
+	ring->emit = emit;
+	ring->flush = flush;
+	ring->arg = arg;
+	if (sem_init(&ring->ready, 0, 0) < 0) {
+		perror("ring_create: sem_init");
+		exit(1);
+	}
+
+	ret = pthread_create(&ring->drainer, NULL, ring_drain, ring);
+	if (ret) {
+		errno = ret;
+		perror("ring_create: pthread_create");
+		exit(1);
+	}
+
+	return ring;
+}
+
+/* Wait until the slot of line seq is no longer in use */
+static void ring_wait_slot(struct mandel_ring *ring, int seq)
+{
+	if (__atomic_load_n(&ring->drained, __ATOMIC_ACQUIRE) >
+	    seq - ring->size)
+		return;
+
+	pthread_mutex_lock(&ring->lock);
+	__atomic_add_fetch(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&ring->drained, __ATOMIC_SEQ_CST) <=
+	       seq - ring->size)
+		pthread_cond_wait(&ring->freed, &ring->lock);
+	__atomic_sub_fetch(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&ring->lock);
+}
+
+int *ring_slot(struct mandel_ring *ring, int seq)
+{
+	ring_wait_slot(ring, seq);
+	return &ring->buf[(seq % ring->size) * ring->width];
+}
+
+void ring_publish(struct mandel_ring *ring, int seq)
+{
+	ring_wait_slot(ring, seq);
+	__atomic_store_n(&ring->seq[seq % ring->size], seq, __ATOMIC_RELEASE);
+	if (sem_post(&ring->ready) < 0) {
+		perror("ring_publish: sem_post");
+		exit(1);
+	}
+}
+
+void ring_finish(struct mandel_ring *ring)
+{
+	int ret;
+
+	ret = pthread_join(ring->drainer, NULL);
+	if (ret) {
+		errno = ret;
+		perror("ring_finish: pthread_join");
+	}
+
+	sem_destroy(&ring->ready);
+	pthread_cond_destroy(&ring->freed);
+	pthread_mutex_destroy(&ring->lock);
+	free(ring->seq);
+	free(ring->buf);
+	free(ring);
+}
@@ -0,0 +1,50 @@
+/*
+ * mandel-ring.h
+ *
+ * A reorder ring: worker threads publish numbered lines in any
+ * order, without waiting for each other, and a drain thread
+ * emits them in order in the background.
+ *
+ */
+
+#ifndef MANDEL_RING_H__
+#define MANDEL_RING_H__
+
+/* Emit line seq, whose slot is buf */
+typedef void ring_emit_fn(void *arg, int seq, int buf[]);
+
+/* Lines before seq have all been emitted, and line seq is not ready */
+typedef void ring_flush_fn(void *arg, int seq);
+
+struct mandel_ring;
+
+/*
+ * Create a ring of size slots of width ints each, for lines 0 to
+ * count - 1, and start a thread that emits them in order with emit()
+ * as they are published. width may be 0 if the lines are somewhere
+ * else, and only their order matters. If flush() is not NULL, it is
+ * called whenever the drain thread catches up with the workers and is
+ * about to wait, and once after the last line, so that emit() can
+ * batch up its output in the meantime.
+ */
+struct mandel_ring *ring_create(int size, int width, int count,
+	ring_emit_fn *emit, ring_flush_fn *flush, void *arg);
+
+/*
+ * Returns the slot of line seq, for its worker to fill in. This only
+ * waits if line seq is size or more lines ahead of the last emitted,
+ * so a ring of count slots never makes a worker wait.
+ */
+int *ring_slot(struct mandel_ring *ring, int seq);
+
+/*
+ * Hand line seq over to the drain thread. Like ring_slot(), this only
+ * waits if line seq is a whole ring ahead; a line whose slot is not
+ * used (see ring_create()) may be published without calling it.
+ */
+void ring_publish(struct mandel_ring *ring, int seq);
+
+/* Wait until every line has been emitted, and free the ring */
+void ring_finish(struct mandel_ring *ring);
+
+#endif /* MANDEL_RING_H__ */
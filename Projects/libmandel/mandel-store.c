@@ -0,0 +1,341 @@
+/*
+ * mandel-store.c
+ *
+ * A persistent store of rendered tiles, in a single file
+ * mapped into memory. The file is laid out as
+ *
+ *	header			STORE_HEADER bytes
+ *	tile area		tile_cap tiles, the first tiles of them used
+ *	index			index_slots entries, an open addressing
+ *				hash table of (key, tile slot)
+ *
+ * When the tile area fills up, the file grows to twice as many tiles
+ * and a new index is built past them; the old index is left in place
+ * until the new one is complete and written out, and only then does
+ * the header switch over to it. A tile is only counted in the header
+ * once it and its index entry are in place.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "mandel-lib.h"
+#include "mandel-render.h"
+#include "mandel-cache.h"
+#include "mandel-store.h"
+
+#define STORE_MAGIC "MANDTILE"
+#define STORE_VERSION 1
+#define STORE_HEADER 4096
+
+/* Tiles a new store has room for */
+#define STORE_FIRST_TILES 64
+
+#define TILE_PIXELS (MANDEL_TILE_SIZE * MANDEL_TILE_SIZE)
+#define TILE_BYTES (TILE_PIXELS * sizeof(int32_t))
+
+struct store_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t tile_size;
+	uint64_t tile_cap;
+	uint64_t tiles;
+	uint64_t index_off;
+	uint64_t index_slots;	/* A power of two, 4 per tile of tile_cap */
+};
+
+/* An index entry; slot is the tile slot plus one, 0 if it is free */
+struct store_entry {
+	int64_t tx, ty;
+	int32_t zoom;
+	int32_t max_iteration;
+	int32_t prec;
+	uint32_t slot;
+};
+
+struct mandel_store {
+	int fd;
+	pthread_rwlock_t lock;	/* Taken for writing to insert */
+	char *map;
+	size_t size;
+	unsigned long long hits, misses, inserts;
+};
+
+static struct store_header *store_header(struct mandel_store *store)
+{
+	return (struct store_header *)store->map;
+}
+
+static size_t store_size(uint64_t tile_cap, uint64_t index_slots)
+{
+	return STORE_HEADER + tile_cap * TILE_BYTES +
+		index_slots * sizeof(struct store_entry);
+}
+
+/* Find the entry of key in the index at index_off, or the free one for it */
+static struct store_entry *store_find(char *map, uint64_t index_off,
+	uint64_t index_slots, const struct mandel_tile_key *key)
+{
+	struct store_entry *index = (struct store_entry *)(map + index_off);
+	uint64_t i = mandel_tile_hash(key) & (index_slots - 1);
+
+	while (index[i].slot && !(index[i].tx == key->tx &&
+	       index[i].ty == key->ty && index[i].zoom == key->zoom &&
+	       index[i].max_iteration == key->max_iteration &&
+	       index[i].prec == (int32_t)key->prec))
+		i = (i + 1) & (index_slots - 1);
+	return &index[i];
+}
+
+/*
+ * Make the file size bytes long and map it again. Disk space is
+ * allocated up front where possible, so that running out of it
+ * shows up here and not as SIGBUS on a later store to the map.
+ */
+static int store_resize(struct mandel_store *store, size_t size)
+{
+	char *map;
+	int ret;
+
+	if (ftruncate(store->fd, size) < 0)
+		return -1;
+	ret = posix_fallocate(store->fd, 0, size);
+	if (ret && ret != EOPNOTSUPP && ret != EINVAL) {
+		errno = ret;
+		return -1;
+	}
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		store->fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+	if (store->map)
+		munmap(store->map, store->size);
+	store->map = map;
+	store->size = size;
+	return 0;
+}
+
+/*
+ * Returns 0 if the header and the file size agree, and the index has
+ * a free entry left for store_find() to stop at. Sizes are compared
+ * by division, so that a corrupt header cannot overflow them.
+ *
+ * Entries past the tiles there are, as left by an insert cut short
+ * before counting its tile, are dropped: their tile is a miss, and
+ * is put back in a later run.
+ */
+static int store_check(struct mandel_store *store)
+{
+	struct store_header *h = store_header(store);
+	struct store_entry *index;
+	uint64_t i, used = 0;
+
+	if (store->size < STORE_HEADER ||
+	    memcmp(h->magic, STORE_MAGIC, sizeof(h->magic)) ||
+	    h->version != STORE_VERSION ||
+	    h->tile_size != MANDEL_TILE_SIZE ||
+	    h->tiles > h->tile_cap ||
+	    h->tile_cap > (store->size - STORE_HEADER) / TILE_BYTES ||
+	    h->index_slots == 0 || (h->index_slots & (h->index_slots - 1)) ||
+	    h->index_off < STORE_HEADER + h->tile_cap * TILE_BYTES ||
+	    h->index_off > store->size ||
+	    h->index_slots > (store->size - h->index_off) /
+	    sizeof(struct store_entry))
+		return -1;
+
+	index = (struct store_entry *)(store->map + h->index_off);
+	for (i = 0; i < h->index_slots; i++) {
+		if (index[i].slot > h->tiles)
+			index[i].slot = 0;
+		used += index[i].slot != 0;
+	}
+	return used < h->index_slots ? 0 : -1;
+}
+
+struct mandel_store *mandel_store_open(const char *path)
+{
+	struct mandel_store *store;
+	struct store_header *h;
+	struct stat st;
+	int err;
+
+	if ((store = calloc(1, sizeof(*store))) == NULL)
+		return NULL;
+	if ((store->fd = open(path, O_RDWR | O_CREAT, 0644)) < 0)
+		goto out_free;
+	if (flock(store->fd, LOCK_EX | LOCK_NB) < 0 ||
+	    fstat(store->fd, &st) < 0)
+		goto out_close;
+
+	if (st.st_size == 0) {
+		if (store_resize(store, store_size(STORE_FIRST_TILES,
+		    4 * STORE_FIRST_TILES)) < 0)
+			goto out_close;
+		h = store_header(store);
+		h->version = STORE_VERSION;
+		h->tile_size = MANDEL_TILE_SIZE;
+		h->tile_cap = STORE_FIRST_TILES;
+		h->tiles = 0;
+		h->index_off = STORE_HEADER + STORE_FIRST_TILES * TILE_BYTES;
+		h->index_slots = 4 * STORE_FIRST_TILES;
+		memcpy(h->magic, STORE_MAGIC, sizeof(h->magic));
+	} else {
+		store->size = st.st_size;
+		store->map = mmap(NULL, store->size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, store->fd, 0);
+		if (store->map == MAP_FAILED) {
+			store->map = NULL;
+			goto out_close;
+		}
+		if (store_check(store) < 0) {
+			errno = EINVAL;
+			goto out_unmap;
+		}
+	}
+
+	pthread_rwlock_init(&store->lock, NULL);
+	return store;
+
+out_unmap:
+	err = errno;
+	munmap(store->map, store->size);
+	errno = err;
+out_close:
+	err = errno;
+	close(store->fd);
+	errno = err;
+out_free:
+	free(store);
+	return NULL;
+}
+
+int mandel_store_lookup(struct mandel_store *store,
+	const struct mandel_tile_key *key, int iter[])
+{
+	struct store_header *h;
+	struct store_entry *e;
+	int found;
+
+	pthread_rwlock_rdlock(&store->lock);
+	h = store_header(store);
+	e = store_find(store->map, h->index_off, h->index_slots, key);
+	/* Never trust the file past the tiles it has */
+	found = e->slot != 0 && e->slot <= h->tiles;
+	if (found)
+		memcpy(iter, store->map + STORE_HEADER +
+			(e->slot - 1) * TILE_BYTES, TILE_BYTES);
+	pthread_rwlock_unlock(&store->lock);
+
+	__sync_fetch_and_add(found ? &store->hits : &store->misses, 1);
+	return found;
+}
+
+/*
+ * Double the tile area, and build an index for it past the new
+ * tile area, with store->lock held for writing.
+ */
+static int store_grow(struct mandel_store *store)
+{
+	struct store_header *h = store_header(store);
+	uint64_t cap = h->tile_cap * 2, slots = h->index_slots * 2;
+	uint64_t off = STORE_HEADER + cap * TILE_BYTES, i;
+	struct store_entry *old, *e;
+	struct mandel_tile_key key;
+
+	if (store_resize(store, store_size(cap, slots)) < 0)
+		return -1;
+	h = store_header(store);
+
+	/* The new index lies past the end of the old file: all free */
+	old = (struct store_entry *)(store->map + h->index_off);
+	for (i = 0; i < h->index_slots; i++) {
+		if (!old[i].slot)
+			continue;
+		key.zoom = old[i].zoom;
+		key.tx = old[i].tx;
+		key.ty = old[i].ty;
+		key.max_iteration = old[i].max_iteration;
+		key.prec = old[i].prec;
+		e = store_find(store->map, off, slots, &key);
+		*e = old[i];
+	}
+	msync(store->map, store->size, MS_SYNC);
+
+	h->index_off = off;
+	h->index_slots = slots;
+	h->tile_cap = cap;
+	return 0;
+}
+
+int mandel_store_insert(struct mandel_store *store,
+	const struct mandel_tile_key *key, const int iter[])
+{
+	struct store_header *h;
+	struct store_entry *e;
+	int ret = 0;
+
+	pthread_rwlock_wrlock(&store->lock);
+	h = store_header(store);
+	e = store_find(store->map, h->index_off, h->index_slots, key);
+	if (e->slot)
+		goto out;
+
+	if (h->tiles == h->tile_cap) {
+		if (store_grow(store) < 0) {
+			ret = -1;
+			goto out;
+		}
+		h = store_header(store);
+		e = store_find(store->map, h->index_off, h->index_slots, key);
+	}
+
+	/* The tile first, then its entry, then the count */
+	memcpy(store->map + STORE_HEADER + h->tiles * TILE_BYTES, iter,
+		TILE_BYTES);
+	e->tx = key->tx;
+	e->ty = key->ty;
+	e->zoom = key->zoom;
+	e->max_iteration = key->max_iteration;
+	e->prec = key->prec;
+	e->slot = h->tiles + 1;
+	h->tiles++;
+	__sync_fetch_and_add(&store->inserts, 1);
+out:
+	pthread_rwlock_unlock(&store->lock);
+	return ret;
+}
+
+void mandel_store_stats(struct mandel_store *store,
+	struct mandel_store_stats *st)
+{
+	st->hits = __sync_fetch_and_add(&store->hits, 0);
+	st->misses = __sync_fetch_and_add(&store->misses, 0);
+	st->inserts = __sync_fetch_and_add(&store->inserts, 0);
+	pthread_rwlock_rdlock(&store->lock);
+	st->tiles = store_header(store)->tiles;
+	st->bytes = store->size;
+	pthread_rwlock_unlock(&store->lock);
+}
+
+int mandel_store_close(struct mandel_store *store)
+{
+	int ret = 0;
+
+	if (msync(store->map, store->size, MS_SYNC) < 0)
+		ret = -1;
+	munmap(store->map, store->size);
+	if (close(store->fd) < 0)
+		ret = -1;
+	pthread_rwlock_destroy(&store->lock);
+	free(store);
+	return ret;
+}
@@ -0,0 +1,58 @@
+/*
+ * mandel-store.h
+ *
+ * A persistent store of rendered tiles of the grid (see
+ * mandel-render.h): a single file, mapped into memory, holding the
+ * tiles and a compact hash index of them, so tiles rendered by one
+ * run can be reused by every later one.
+ *
+ */
+
+#ifndef MANDEL_STORE_H__
+#define MANDEL_STORE_H__
+
+#include <stddef.h>
+
+#include "mandel-cache.h"
+
+struct mandel_store_stats {
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long inserts;
+	size_t tiles;		/* Tiles in the file */
+	size_t bytes;		/* Size of the file */
+};
+
+struct mandel_store;
+
+/*
+ * Open the store in file path, creating it if it does not exist.
+ * The file is locked for as long as it is open, so only one process
+ * uses it at a time. Returns NULL with errno set on failure: EINVAL
+ * if path is not a tile store, EWOULDBLOCK if it is in use.
+ */
+struct mandel_store *mandel_store_open(const char *path);
+
+/*
+ * Copy the escape times of tile key into iter[], MANDEL_TILE_SIZE
+ * lines of MANDEL_TILE_SIZE values. Returns 1 if the tile is in the
+ * store, 0 if not.
+ */
+int mandel_store_lookup(struct mandel_store *store,
+	const struct mandel_tile_key *key, int iter[]);
+
+/*
+ * Add tile key to the store, growing the file if needed; a tile
+ * already there is left as it is. Returns -1 with errno set if the
+ * file could not grow.
+ */
+int mandel_store_insert(struct mandel_store *store,
+	const struct mandel_tile_key *key, const int iter[]);
+
+void mandel_store_stats(struct mandel_store *store,
+	struct mandel_store_stats *st);
+
+/* Write everything out and close the store; returns -1 on failure */
+int mandel_store_close(struct mandel_store *store);
+
+#endif /* MANDEL_STORE_H__ */